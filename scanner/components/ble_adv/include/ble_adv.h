@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+ * Walks the AD structures of a BLE advertisement in place, and recognizes beacon formats
+ * from them.  Nothing is copied: the iterator and the decoded beacon point into the
+ * caller's buffer, so that buffer must outlive them.  No dependencies on ESP-IDF, so it
+ * also builds on the host.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLE_ADV_TYPE_FLAGS        (0x01)
+#define BLE_ADV_TYPE_SERVICE_DATA (0x16)  // 16-bit service UUID, followed by data
+#define BLE_ADV_TYPE_MANUFACTURER (0xFF)  // 16-bit company ID, followed by data
+
+#define BLE_ADV_ID_LEN (16)
+
+typedef struct bleAdv_iter_t {
+    uint8_t const * pos;
+    uint8_t const * end;
+} bleAdv_iter_t;
+
+typedef struct bleAdv_ad_t {
+    uint8_t         type;
+    uint8_t         len;   // excludes the length and type octets
+    uint8_t const * data;
+} bleAdv_ad_t;
+
+#define BLE_ADV_FMT_MAP(XX) \
+  XX(0, NONE,         none)         \
+  XX(1, IBEACON,      iBeacon)      \
+  XX(2, ALTBEACON,    AltBeacon)    \
+  XX(3, EDDYSTONE_UID, eddystoneUid) \
+  XX(4, EDDYSTONE_URL, eddystoneUrl) \
+  XX(5, EDDYSTONE_TLM, eddystoneTlm)
+
+typedef enum bleAdv_fmt_t {
+#define XX(num, name, str) BLE_ADV_FMT_##name = num,
+  BLE_ADV_FMT_MAP(XX)
+#undef XX
+  BLE_ADV_FMT_COUNT
+} bleAdv_fmt_t;
+
+/*
+ * Common view of a beacon.  iBeacon and AltBeacon identify themselves with 16+2+2 bytes;
+ * the 16 byte namespace and instance of Eddystone-UID fill `id`, and leave major/minor 0.
+ * Eddystone-URL and -TLM frames don't carry an identity, so `id` is NULL.
+ */
+
+typedef struct bleAdv_beacon_t {
+    bleAdv_fmt_t    fmt;
+    uint8_t const * id;       // BLE_ADV_ID_LEN bytes inside the advertisement, or NULL
+    uint16_t        major;    // [host order]
+    uint16_t        minor;    // [host order]
+    int8_t          txPwr;    // calibrated RSSI at 1 m [dBm], 0 when the frame has none
+    uint16_t        company;  // manufacturer ID, 0 for Eddystone
+} bleAdv_beacon_t;
+
+extern char const * const bleAdv_fmtNames[BLE_ADV_FMT_COUNT];
+
+void bleAdv_iterInit(bleAdv_iter_t * const iter, uint8_t const * const adv, size_t const len);
+
+// returns false at the end of the significant part, or when a structure runs past the end
+bool bleAdv_next(bleAdv_iter_t * const iter, bleAdv_ad_t * const ad);
+
+// returns the format of the first beacon in `adv`, and describes it in `beacon`
+bleAdv_fmt_t bleAdv_parseBeacon(uint8_t const * const adv, size_t const len, bleAdv_beacon_t * const beacon);
@@ -0,0 +1,180 @@
+/**
+ * @brief ble_adv, zero-copy AD structure iterator and beacon recognizer
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include "ble_adv.h"
+
+/*
+ * Beacon layouts, offsets are relative to the data of the AD structure, i.e. after
+ * the length and type octets.
+ *
+ *   iBeacon      FF  4C 00 02 15 UUID[16] major[2,BE] minor[2,BE] txPwr
+ *   AltBeacon    FF  MFG[2,LE] BE AC ID1[16] ID2[2,BE] ID3[2,BE] refRssi mfgRsvd
+ *   Eddystone    16  AA FE frameType ..
+ *     UID               00 txPwr0m namespace[10] instance[6] [rfu[2]]
+ *     URL               10 txPwr0m scheme url[..]
+ *     TLM               20 version vbatt[2] temp[2] advCnt[4] secCnt[4]
+ */
+
+#define IBEACON_COMPANY    (0x004C)
+#define IBEACON_LEN        (25)
+#define ALTBEACON_LEN      (26)
+#define EDDYSTONE_UUID     (0xFEAA)
+#define EDDYSTONE_UID_LEN  (2 + 2 + BLE_ADV_ID_LEN)
+#define EDDYSTONE_URL_LEN  (2 + 3)
+#define EDDYSTONE_TLM_LEN  (2 + 14)
+#define EDDYSTONE_1M_LOSS  (41)  // Eddystone calibrates at 0 m, the others at 1 m [dB]
+
+char const * const bleAdv_fmtNames[BLE_ADV_FMT_COUNT] = {
+#define XX(num, name, str) [num] = #str,
+  BLE_ADV_FMT_MAP(XX)
+#undef XX
+};
+
+static uint16_t
+_le16(uint8_t const * const p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint16_t
+_be16(uint8_t const * const p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+void
+bleAdv_iterInit(bleAdv_iter_t * const iter, uint8_t const * const adv, size_t const len)
+{
+    iter->pos = adv;
+    iter->end = adv + len;
+}
+
+bool
+bleAdv_next(bleAdv_iter_t * const iter, bleAdv_ad_t * const ad)
+{
+    if (iter->pos >= iter->end) {
+        return false;
+    }
+    uint8_t const len = iter->pos[0];
+    if (len == 0 || len > iter->end - iter->pos - 1) {  // early end of the significant part, or truncated
+        iter->pos = iter->end;
+        return false;
+    }
+    ad->type = iter->pos[1];
+    ad->len = len - 1;
+    ad->data = iter->pos + 2;
+    iter->pos += 1 + len;
+    return true;
+}
+
+static bleAdv_fmt_t
+_manufacturer(bleAdv_ad_t const * const ad, bleAdv_beacon_t * const beacon)
+{
+    uint8_t const * const d = ad->data;
+
+    if (ad->len == IBEACON_LEN && _le16(d) == IBEACON_COMPANY && d[2] == 0x02 && d[3] == 0x15) {
+        *beacon = (bleAdv_beacon_t) {
+            .fmt = BLE_ADV_FMT_IBEACON,
+            .id = d + 4,
+            .major = _be16(d + 20),
+            .minor = _be16(d + 22),
+            .txPwr = (int8_t)d[24],
+            .company = IBEACON_COMPANY,
+        };
+        return BLE_ADV_FMT_IBEACON;
+    }
+    if (ad->len == ALTBEACON_LEN && d[2] == 0xBE && d[3] == 0xAC) {
+        *beacon = (bleAdv_beacon_t) {
+            .fmt = BLE_ADV_FMT_ALTBEACON,
+            .id = d + 4,
+            .major = _be16(d + 20),
+            .minor = _be16(d + 22),
+            .txPwr = (int8_t)d[24],
+            .company = _le16(d),
+        };
+        return BLE_ADV_FMT_ALTBEACON;
+    }
+    return BLE_ADV_FMT_NONE;
+}
+
+static bleAdv_fmt_t
+_serviceData(bleAdv_ad_t const * const ad, bleAdv_beacon_t * const beacon)
+{
+    uint8_t const * const d = ad->data;
+
+    if (ad->len < 3 || _le16(d) != EDDYSTONE_UUID) {
+        return BLE_ADV_FMT_NONE;
+    }
+    switch (d[2]) {
+        case 0x00:
+            if (ad->len < EDDYSTONE_UID_LEN) {
+                break;
+            }
+            *beacon = (bleAdv_beacon_t) {
+                .fmt = BLE_ADV_FMT_EDDYSTONE_UID,
+                .id = d + 4,
+                .txPwr = (int8_t)d[3] - EDDYSTONE_1M_LOSS,
+            };
+            return BLE_ADV_FMT_EDDYSTONE_UID;
+        case 0x10:
+            if (ad->len < EDDYSTONE_URL_LEN) {
+                break;
+            }
+            *beacon = (bleAdv_beacon_t) {
+                .fmt = BLE_ADV_FMT_EDDYSTONE_URL,
+                .txPwr = (int8_t)d[3] - EDDYSTONE_1M_LOSS,
+            };
+            return BLE_ADV_FMT_EDDYSTONE_URL;
+        case 0x20:
+            if (ad->len < EDDYSTONE_TLM_LEN) {
+                break;
+            }
+            *beacon = (bleAdv_beacon_t) {
+                .fmt = BLE_ADV_FMT_EDDYSTONE_TLM,
+            };
+            return BLE_ADV_FMT_EDDYSTONE_TLM;
+    }
+    return BLE_ADV_FMT_NONE;
+}
+
+bleAdv_fmt_t
+bleAdv_parseBeacon(uint8_t const * const adv, size_t const len, bleAdv_beacon_t * const beacon)
+{
+    bleAdv_iter_t iter;
+    bleAdv_ad_t ad;
+    bleAdv_iterInit(&iter, adv, len);
+
+    while (bleAdv_next(&iter, &ad)) {
+        bleAdv_fmt_t fmt = BLE_ADV_FMT_NONE;
+        switch (ad.type) {
+            case BLE_ADV_TYPE_MANUFACTURER:
+                fmt = _manufacturer(&ad, beacon);
+                break;
+            case BLE_ADV_TYPE_SERVICE_DATA:
+                fmt = _serviceData(&ad, beacon);
+                break;
+        }
+        if (fmt != BLE_ADV_FMT_NONE) {
+            return fmt;
+        }
+    }
+    beacon->fmt = BLE_ADV_FMT_NONE;
+    return BLE_ADV_FMT_NONE;
+}
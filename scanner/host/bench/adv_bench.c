@@ -0,0 +1,108 @@
+/**
+ * @brief adv_bench, compares the AD structure parser with the fixed-layout iBeacon check
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+
+#include "esp_ibeacon_api.h"
+#include "ble_adv.h"
+
+/*
+ * Times esp_ble_is_ibeacon_packet() against bleAdv_parseBeacon() over a mix of advertisements
+ * as seen in the GAP callback, and reports how many of each kind either one recognizes.
+ * Usage: blescan_adv_bench [ITERATIONS]
+ */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+#define UUID 0xFD, 0xA5, 0x06, 0x93, 0xA4, 0xE2, 0x4F, 0xB1, 0xAF, 0xCF, 0xC6, 0xEB, 0x07, 0x64, 0x78, 0x25
+
+typedef struct sample_t {
+    char const * name;
+    uint8_t      len;
+    uint8_t      adv[62];
+} sample_t;
+
+static sample_t const _samples[] = {
+    { "iBeacon", 30, { 0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, UUID, 0x27, 0xB7, 0xF2, 0x06, 0xC5 } },
+    { "iBeaconFlags", 30, { 0x02, 0x01, 0x1A, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, UUID, 0x00, 0x01, 0x00, 0x02, 0xBF } },
+    { "iBeaconNamed", 36, { 0x02, 0x01, 0x06, 0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, UUID, 0x00, 0x01, 0x00, 0x02, 0xBF,
+                            0x05, 0x09, 'b', 'e', 'a', 'c' } },
+    { "AltBeacon", 28, { 0x1B, 0xFF, 0x18, 0x01, 0xBE, 0xAC, UUID, 0x00, 0x03, 0x00, 0x04, 0xC3, 0x00 } },
+    { "eddystoneUid", 31, { 0x02, 0x01, 0x06, 0x03, 0x03, 0xAA, 0xFE,
+                            0x17, 0x16, 0xAA, 0xFE, 0x00, 0xEE, UUID, 0x00, 0x00 } },
+    { "other", 12, { 0x02, 0x01, 0x06, 0x04, 0x09, 's', 'i', 'm', 0x03, 0x03, 0xAA, 0xFE } },
+};
+
+static int64_t
+_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(int argc, char * argv[])
+{
+    uint const iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    uint const cnt = ARRAY_SIZE(_samples);
+    uint memcmpHits[ARRAY_SIZE(_samples)] = {};
+    uint parseHits[ARRAY_SIZE(_samples)] = {};
+    sample_t samples[ARRAY_SIZE(_samples)];
+    memcpy(samples, _samples, sizeof(samples));  // non-const, as esp_ble_is_ibeacon_packet() wants
+
+    int64_t const t0 = _nsec();
+    for (uint ii = 0; ii < iterations; ii++) {
+        for (uint jj = 0; jj < cnt; jj++) {
+            memcmpHits[jj] += esp_ble_is_ibeacon_packet(samples[jj].adv, samples[jj].len);
+        }
+    }
+    int64_t const t1 = _nsec();
+    for (uint ii = 0; ii < iterations; ii++) {
+        for (uint jj = 0; jj < cnt; jj++) {
+            bleAdv_beacon_t beacon;
+            parseHits[jj] += bleAdv_parseBeacon(samples[jj].adv, samples[jj].len, &beacon) != BLE_ADV_FMT_NONE;
+        }
+    }
+    int64_t const t2 = _nsec();
+
+    uint const total = iterations * cnt;
+    printf("{ \"advs\": %u, \"nsPerAdv\": { \"memcmp\": %.1f, \"parse\": %.1f }, \"recognized\": {",
+           total, (double)(t1 - t0) / total, (double)(t2 - t1) / total);
+    for (uint jj = 0; jj < cnt; jj++) {
+        printf("%s \"%s\": { \"memcmp\": %u, \"parse\": %u }", jj ? "," : "",
+               samples[jj].name, memcmpHits[jj] / iterations, parseHits[jj] / iterations);
+    }
+    printf(" } }\n");
+
+    // every beacon should be recognized by the parser, and only the plain iBeacon by memcmp
+    for (uint jj = 0; jj < cnt; jj++) {
+        bool const isBeacon = strcmp(samples[jj].name, "other") != 0;
+        if (parseHits[jj] != (isBeacon ? iterations : 0) || memcmpHits[jj] != (jj == 0 ? iterations : 0)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+/**
+ * @brief alloc_count, counts heap allocations by interposing glibc's malloc family
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "alloc_count.h"
+
+// glibc's implementations, these are what malloc() etc. resolve to without us
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t nmemb, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+extern void __libc_free(void * ptr);
+
+static atomic_uint_fast64_t _allocs = 0;
+
+void *
+malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&_allocs, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    atomic_fetch_add_explicit(&_allocs, 1, memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void * ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&_allocs, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void
+free(void * ptr)
+{
+    __libc_free(ptr);
+}
+
+uint64_t
+allocCount(void)
+{
+    return atomic_load_explicit(&_allocs, memory_order_relaxed);
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+uint64_t allocCount(void);  // heap allocations since the program started
@@ -0,0 +1,370 @@
+/**
+ * @brief bench, scan path throughput benchmark with pass/fail thresholds
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <mqtt_client.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "ipc.h"
+#include "sim_gap.h"
+#include "pipeline.h"
+#include "alloc_count.h"
+
+static char const * const TAG = "bench";
+
+/*
+ * Each scenario feeds `count` synthetic advertisements through the GAP handler at `rate`.
+ * A rate of 0 searches for the sustained rate instead: the rate doubles for as long as no
+ * more than SUSTAINED_DROP_PCT of the beacon records are dropped.
+ */
+
+#define SUSTAINED_DROP_PCT (1.0)
+#define SUSTAINED_RATE_MIN (2000)
+#define SUSTAINED_RATE_MAX (2048000)
+
+typedef struct scenario_t {
+    char const * name;
+    uint         count;     // advertisements, or per step for a sustained rate search
+    uint         rate;      // advertisements per second, 0 searches for the sustained rate
+    uint         beacons;
+    uint         otherPct;  // percentage of advertisements that are not beacons
+    char const * ctrl[3];   // control messages applied before the run
+} scenario_t;
+
+static scenario_t const _scenarios[] = {
+    { "json_5k",            2500,  5000,   16,  0, { NULL } },
+    { "json_mixed_5k",      2500,  5000,   16, 50, { NULL } },
+    { "json_batch_20k",    10000, 20000,   64,  0, { "batch 50" } },
+    { "bin_batch_20k",     10000, 20000,   64,  0, { "fmt bin", "batch 50" } },
+    { "summary_20k",       10000, 20000,  256,  0, { "summary 100" } },
+    { "filtered_20k",      10000, 20000,  256,  0, { "filter allow minor=0-15" } },
+    { "json_sustained",        0,     0,   16,  0, { NULL } },
+    { "bin_batch_sustained",   0,     0,   64,  0, { "fmt bin", "batch 50" } },
+};
+
+// control messages that restore the defaults between scenarios
+static char const * const _reset[] = { "fmt json", "batch 0", "summary 0", "filter clear" };
+
+#define BENCH_METRIC_MAP(XX) \
+  XX(0, advPerSec)           /* advertisements handled by the GAP callback per second */ \
+  XX(1, sustainedAdvPerSec)  /* highest rate with at most SUSTAINED_DROP_PCT drops */ \
+  XX(2, recPerSec)           /* scan records published per second */ \
+  XX(3, dropPct)             /* beacon records dropped in the scan ring or toMqttQ [%] */ \
+  XX(4, cpuUsPerAdv)         /* process CPU time, all threads, per advertisement [usec] */ \
+  XX(5, gapCbUsAvg)          /* time spent in the GAP callback per advertisement [usec] */ \
+  XX(6, allocsPerRec)        /* heap allocations per beacon record */ \
+  XX(7, allocsPerMsg)        /* heap allocations per published MQTT message */
+
+typedef enum {
+#define XX(num, name) BENCH_METRIC_##name = num,
+  BENCH_METRIC_MAP(XX)
+#undef XX
+  BENCH_METRIC_COUNT
+} benchMetric_t;
+
+static const char * const _metrics[] = {
+#define XX(num, name) #name,
+  BENCH_METRIC_MAP(XX)
+#undef XX
+};
+
+typedef struct result_t {
+    double metric[BENCH_METRIC_COUNT];
+    uint   adv;
+    uint   published;
+    char   failures[512];  // JSON strings, comma separated
+    uint   failureCnt;
+} result_t;
+
+/*
+ * Thresholds file, one per line:  SCENARIO METRIC min|max LIMIT
+ * SCENARIO can be `*` for all scenarios.  Lines starting with '#' are ignored.
+ */
+
+typedef struct threshold_t {
+    char          scenario[32];
+    benchMetric_t metric;
+    bool          isMax;
+    double        limit;
+} threshold_t;
+
+static threshold_t _thresholds[64];
+static uint _thresholdCnt = 0;
+
+static int
+_metric_nr(char const * const name)
+{
+    ELEM_POS(_metrics, name);
+}
+
+static bool
+_loadThresholds(char const * const fname)
+{
+    FILE * const f = fopen(fname, "r");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Can't open thresholds (%s)", fname);
+        return false;
+    }
+    char line[128];
+    uint lineNr = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNr++;
+        char scenario[32], metric[32], op[4];
+        double limit;
+        if (*line == '#' || *line == '\n') {
+            continue;
+        }
+        int metricNr;
+        if (sscanf(line, "%31s %31s %3s %lf", scenario, metric, op, &limit) != 4 ||
+            (metricNr = _metric_nr(metric)) < 0 ||
+            (strcmp(op, "min") && strcmp(op, "max")) ||
+            _thresholdCnt == ARRAY_SIZE(_thresholds)) {
+            ESP_LOGE(TAG, "%s:%u: can't parse", fname, lineNr);
+            fclose(f);
+            return false;
+        }
+        threshold_t * const t = &_thresholds[_thresholdCnt++];
+        snprintf(t->scenario, sizeof(t->scenario), "%s", scenario);
+        t->metric = metricNr;
+        t->isMax = strcmp(op, "max") == 0;
+        t->limit = limit;
+    }
+    fclose(f);
+    return true;
+}
+
+static void
+_check(scenario_t const * const scenario, result_t * const result)
+{
+    for (uint ii = 0; ii < _thresholdCnt; ii++) {
+        threshold_t const * const t = &_thresholds[ii];
+        if (strcmp(t->scenario, "*") && strcmp(t->scenario, scenario->name)) {
+            continue;
+        }
+        double const value = result->metric[t->metric];
+        if (t->isMax ? value > t->limit : value < t->limit) {
+            size_t const len = strlen(result->failures);
+            snprintf(result->failures + len, sizeof(result->failures) - len, "%s\"%s %.2f %s %.2f\"",
+                     result->failureCnt ? ", " : "", _metrics[t->metric], value, t->isMax ? ">" : "<", t->limit);
+            result->failureCnt++;
+        }
+    }
+}
+
+// counters that are sampled before and after a run
+
+typedef struct sample_t {
+    int64_t  time;
+    int64_t  cpuUs;
+    uint64_t allocs;
+    uint     adv;
+    uint     beacon;
+    uint     ringDrop;
+    uint     toMqttDrop;
+    uint     published;
+    uint64_t msgs;
+    uint64_t gapCbUs;
+} sample_t;
+
+static void
+_sample(ipc_t const * const ipc, sample_t * const s)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    mqtt_shim_stats_t mqtt;
+    mqtt_shim_stats(&mqtt);
+
+    *s = (sample_t) {
+        .time = esp_timer_get_time(),
+        .cpuUs = (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec,
+        .allocs = allocCount(),
+        .adv = ipc->dev.count.advRx,
+        .beacon = ipc->dev.count.beaconRx,
+        .ringDrop = ipc->dev.count.scanDrop,
+        .toMqttDrop = ipc->toMqttQ->drop,
+        .published = ipc->dev.count.scanPublished,
+        .msgs = mqtt.msgs,
+        .gapCbUs = ipc->dev.count.gapCbTotUs,
+    };
+}
+
+static void
+_run(ipc_t const * const ipc, scenario_t const * const scenario, uint const count, uint const rate, result_t * const result)
+{
+    simGap_cfg_t const sim = {
+        .count = count,
+        .rate = rate,
+        .beacons = scenario->beacons,
+        .otherPct = scenario->otherPct,
+        .seed = 1,
+    };
+    sample_t before, generated, after;
+
+    _sample(ipc, &before);
+    simGap_synth(&sim, pipeline_gapHandler);
+    _sample(ipc, &generated);
+    pipeline_drain();
+    _sample(ipc, &after);
+
+    uint const adv = after.adv - before.adv;
+    uint const beacon = after.beacon - before.beacon;
+    uint const dropped = (after.ringDrop - before.ringDrop) + (after.toMqttDrop - before.toMqttDrop);
+    int64_t const genUs = MAX(generated.time - before.time, (int64_t)1);
+
+    *result = (result_t) {
+        .adv = adv,
+        .published = after.published - before.published,
+    };
+    double * const m = result->metric;
+    m[BENCH_METRIC_advPerSec] = adv * 1e6 / genUs;
+    m[BENCH_METRIC_recPerSec] = result->published * 1e6 / genUs;
+    m[BENCH_METRIC_dropPct] = beacon ? 100.0 * dropped / beacon : 0;
+    m[BENCH_METRIC_cpuUsPerAdv] = adv ? (double)(after.cpuUs - before.cpuUs) / adv : 0;
+    m[BENCH_METRIC_gapCbUsAvg] = adv ? (double)(after.gapCbUs - before.gapCbUs) / adv : 0;
+    m[BENCH_METRIC_allocsPerRec] = beacon ? (double)(after.allocs - before.allocs) / beacon : 0;
+    m[BENCH_METRIC_allocsPerMsg] = (after.msgs > before.msgs) ? (double)(after.allocs - before.allocs) / (after.msgs - before.msgs) : 0;
+}
+
+static void
+_scenario(ipc_t const * const ipc, scenario_t const * const scenario, result_t * const result)
+{
+    for (uint ii = 0; ii < ARRAY_SIZE(_reset); ii++) {
+        pipeline_ctrl(_reset[ii]);
+    }
+    for (uint ii = 0; ii < ARRAY_SIZE(scenario->ctrl) && scenario->ctrl[ii]; ii++) {
+        pipeline_ctrl(scenario->ctrl[ii]);
+    }
+    vTaskDelay(200 / portTICK_PERIOD_MS);  // let the responses and summary flush go out
+
+    if (scenario->rate) {
+        _run(ipc, scenario, scenario->count, scenario->rate, result);
+    } else {
+        result_t step;
+        uint sustained = 0;
+        for (uint rate = SUSTAINED_RATE_MIN; rate <= SUSTAINED_RATE_MAX; rate *= 2) {
+            _run(ipc, scenario, rate / 4, rate, &step);  // 250 msec per step
+            if (step.metric[BENCH_METRIC_dropPct] > SUSTAINED_DROP_PCT) {
+                _run(ipc, scenario, rate / 4, rate, &step);  // retry once, a scheduling hiccup is not a limit
+            }
+            if (step.metric[BENCH_METRIC_dropPct] > SUSTAINED_DROP_PCT) {
+                break;
+            }
+            *result = step;
+            sustained = rate;
+        }
+        if (sustained == 0) {
+            *result = step;
+        }
+        result->metric[BENCH_METRIC_sustainedAdvPerSec] = sustained;
+    }
+    _check(scenario, result);
+}
+
+static void
+_print(FILE * const f, scenario_t const * const scenario, result_t const * const result, bool const last)
+{
+    fprintf(f, "    { \"name\": \"%s\", \"count\": %u, \"rate\": %u, \"beacons\": %u, \"otherPct\": %u, \"ctrl\": [",
+            scenario->name, scenario->count, scenario->rate, scenario->beacons, scenario->otherPct);
+    for (uint ii = 0; ii < ARRAY_SIZE(scenario->ctrl) && scenario->ctrl[ii]; ii++) {
+        fprintf(f, "%s\"%s\"", ii ? ", " : "", scenario->ctrl[ii]);
+    }
+    fprintf(f, "], \"adv\": %u, \"published\": %u, \"metrics\": {", result->adv, result->published);
+    for (uint ii = 0; ii < BENCH_METRIC_COUNT; ii++) {
+        fprintf(f, "%s\"%s\": %.2f", ii ? ", " : " ", _metrics[ii], result->metric[ii]);
+    }
+    fprintf(f, " }, \"failures\": [%s] }%s\n", result->failures, last ? "" : ",");
+}
+
+static void
+_usage(char const * const prog)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -b URI    broker, mqtt://HOST[:PORT] or null (default)\n"
+        "  -s NAME   only run scenarios whose name contains NAME\n"
+        "  -t FILE   fail when a metric exceeds a threshold in FILE\n"
+        "  -o FILE   write the JSON results to FILE instead of stdout\n"
+        "  -v        verbose\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char * argv[])
+{
+    char const * filter = "";
+    char const * outName = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:s:t:o:v")) != -1) {
+        switch (opt) {
+            case 'b': host_mqttUrl = optarg; break;
+            case 's': filter = optarg; break;
+            case 't': if (!_loadThresholds(optarg)) return 2; break;
+            case 'o': outName = optarg; break;
+            case 'v': esp_log_level_set("*", ESP_LOG_INFO); break;
+            default: _usage(argv[0]);
+        }
+    }
+    ipc_t const * const ipc = pipeline_start("bench");
+    if (ipc == NULL) {
+        return 2;
+    }
+
+    static result_t results[ARRAY_SIZE(_scenarios)];
+    scenario_t const * selected[ARRAY_SIZE(_scenarios)];
+    uint selectedCnt = 0;
+    uint failureCnt = 0;
+    for (uint ii = 0; ii < ARRAY_SIZE(_scenarios); ii++) {
+        if (strstr(_scenarios[ii].name, filter)) {
+            selected[selectedCnt] = &_scenarios[ii];
+            _scenario(ipc, selected[selectedCnt], &results[selectedCnt]);
+            failureCnt += results[selectedCnt].failureCnt;
+            if (results[selectedCnt].failureCnt) {
+                ESP_LOGE(TAG, "%s: [%s]", _scenarios[ii].name, results[selectedCnt].failures);
+            }
+            selectedCnt++;
+        }
+    }
+
+    FILE * const f = outName ? fopen(outName, "w") : stdout;
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Can't create (%s)", outName);
+        return 2;
+    }
+    fprintf(f, "{ \"scenarios\": [\n");
+    for (uint ii = 0; ii < selectedCnt; ii++) {
+        _print(f, selected[ii], &results[ii], ii == selectedCnt - 1);
+    }
+    fprintf(f, "  ], \"pass\": %s }\n", failureCnt ? "false" : "true");
+    if (outName) {
+        fclose(f);
+    }
+    return failureCnt ? EXIT_FAILURE : EXIT_SUCCESS;
+}
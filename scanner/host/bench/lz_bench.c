@@ -0,0 +1,193 @@
+/**
+ * @brief lz_bench, compression ratio against CPU time for binary scan payloads
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+
+#include "ble_adv.h"
+#include "blescan_wire.h"
+#include "blescan_lz.h"
+#include "sim_gap.h"
+
+/*
+ * Compresses binary scan payloads, as mqtt_task does with "compress on", and reports the
+ * compression ratio and the time it takes to compress and decompress, for several batch sizes.
+ * The scan results come from a replay file (see blescan_host -f), or are synthesized for a
+ * small, medium and large beacon population.  Fails when a payload doesn't round trip.
+ * Usage: blescan_lz_bench [FILE]
+ */
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX_RECS (20000)
+#define ADV_PER_SEC (1000)  // neither source has timestamps, so spaces the scan results evenly
+#define ITERATIONS (20)
+
+static struct {
+    blescan_wire_rec_t recs[MAX_RECS];
+    int64_t            times[MAX_RECS];  // [usec]
+    uint               cnt;
+    uint               advs;
+} _data;
+
+static void
+_collect(esp_gap_ble_cb_event_t const event, esp_ble_gap_cb_param_t * const param)
+{
+    struct ble_scan_result_evt_param const * const scan_rst = &param->scan_rst;
+    bleAdv_beacon_t beacon;
+    int64_t const time = (int64_t)_data.advs++ * 1000000 / ADV_PER_SEC;
+
+    if (_data.cnt == MAX_RECS || bleAdv_parseBeacon(scan_rst->ble_adv, scan_rst->adv_data_len, &beacon) == BLE_ADV_FMT_NONE) {
+        return;
+    }
+    blescan_wire_rec_t * const rec = &_data.recs[_data.cnt];
+    *rec = (blescan_wire_rec_t) {
+        .rssi = scan_rst->rssi,
+        .txPwr = beacon.txPwr,
+        .major = beacon.major,
+        .minor = beacon.minor,
+    };
+    memcpy(rec->bda, scan_rst->bda, ESP_BD_ADDR_LEN);
+    _data.times[_data.cnt++] = time;
+}
+
+static int64_t
+_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// builds the payload for the `cnt` scan results starting at `first`, as a batch would hold them
+
+static uint
+_payload(uint8_t * const buf, uint const first, uint const cnt)
+{
+    blescan_wire_hdr_t * const hdr = (blescan_wire_hdr_t *)buf;
+    blescan_wire_rec_t * const rec = (blescan_wire_rec_t *)(hdr + 1);
+
+    *hdr = (blescan_wire_hdr_t) {
+        .version = BLESCAN_WIRE_VERSION,
+        .count = cnt,
+        .baseTime = 1666000000000000LL + _data.times[first],
+    };
+    for (uint ii = 0; ii < cnt; ii++) {
+        rec[ii] = _data.recs[first + ii];
+        rec[ii].timeDelta = _data.times[first + ii] - _data.times[first];
+    }
+    return sizeof(*hdr) + cnt * sizeof(*rec);
+}
+
+// reports on the collected scan results in payloads of at most `maxBytes`, returns false when one doesn't round trip
+
+static bool
+_bench(uint const maxBytes)
+{
+    static blescan_lz_t lz;
+    static uint8_t raw[4096];
+    static uint8_t packed[BLESCAN_LZ_BOUND(sizeof(raw))];
+    static uint8_t unpacked[sizeof(raw)];
+    uint const perPayload = (maxBytes - sizeof(blescan_wire_hdr_t)) / sizeof(blescan_wire_rec_t);
+    uint64_t rawBytes = 0, packedBytes = 0, recsBytes = 0;
+    int64_t compressNs = 0, decompressNs = 0;
+    bool ok = true;
+
+    for (uint first = 0; first < _data.cnt; first += perPayload) {
+        uint const len = _payload(raw, first, MIN(perPayload, _data.cnt - first));
+        uint8_t const * const recs = raw + sizeof(blescan_wire_hdr_t);
+        size_t const recsLen = len - sizeof(blescan_wire_hdr_t);
+
+        size_t packedLen = 0;
+        int64_t const t0 = _nsec();
+        for (uint ii = 0; ii < ITERATIONS; ii++) {
+            packedLen = blescan_lz_compress(&lz, recs, recsLen, packed, sizeof(packed));
+        }
+        int64_t const t1 = _nsec();
+        int unpackedLen = 0;
+        for (uint ii = 0; ii < ITERATIONS; ii++) {
+            unpackedLen = blescan_lz_decompress(packed, packedLen, unpacked, sizeof(unpacked));
+        }
+        int64_t const t2 = _nsec();
+
+        ok = ok && packedLen && unpackedLen == (int)recsLen && memcmp(recs, unpacked, recsLen) == 0;
+        rawBytes += len;
+        recsBytes += recsLen;
+        packedBytes += sizeof(blescan_wire_hdr_t) + MIN(packedLen, recsLen);  // mqtt_task publishes it uncompressed when that's smaller
+        compressNs += t1 - t0;
+        decompressNs += t2 - t1;
+    }
+    uint64_t const bytes = recsBytes * ITERATIONS;
+    printf("\"%u\": { \"payloads\": %u, \"ratio\": %.2f, \"nsPerByte\": { \"compress\": %.2f, \"decompress\": %.2f } }",
+           maxBytes, (_data.cnt + perPayload - 1) / perPayload, (double)rawBytes / packedBytes,
+           (double)compressNs / bytes, (double)decompressNs / bytes);
+    return ok;
+}
+
+static bool
+_benchAll(char const * const name)
+{
+    uint const maxBytes[] = { 256, 1024, 4096 };
+    bool ok = true;
+
+    printf("\"%s\": { \"recs\": %u", name, _data.cnt);
+    for (uint ii = 0; ii < ARRAY_SIZE(maxBytes); ii++) {
+        printf(", ");
+        ok = _bench(maxBytes[ii]) && ok;
+    }
+    printf(" }");
+    return ok;
+}
+
+int
+main(int argc, char * argv[])
+{
+    bool ok = true;
+    printf("{ ");
+    if (argc > 1) {
+        FILE * const f = fopen(argv[1], "r");
+        if (f == NULL || simGap_replay(f, 0, _collect) < 0) {
+            fprintf(stderr, "Can't replay (%s)\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+        fclose(f);
+        ok = _benchAll(argv[1]);
+    } else {
+        uint const populations[] = { 4, 16, 256 };
+        for (uint ii = 0; ii < ARRAY_SIZE(populations); ii++) {
+            simGap_cfg_t const cfg = { .count = MAX_RECS, .beacons = populations[ii], .seed = 1 };
+            _data.cnt = _data.advs = 0;
+            simGap_synth(&cfg, _collect);
+
+            char name[16];
+            snprintf(name, sizeof(name), "beacons%u", populations[ii]);
+            printf("%s", ii ? ", " : "");
+            ok = _benchAll(name) && ok;
+        }
+    }
+    printf(" }\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,180 @@
+/**
+ * @brief host_main, runs the scanner pipeline on Linux with a simulated GAP event source
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <mqtt_client.h>
+#include <freertos/FreeRTOS.h>
+
+#include "ipc.h"
+#include "sim_gap.h"
+#include "pipeline.h"
+#include "blescan_wire.h"
+#include "scan_log.h"
+#include "outbox.h"
+#include "timesync.h"
+
+static char const * const TAG = "host_main";
+
+static void
+_usage(char const * const prog)
+{
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -b URI    broker, mqtt://HOST[:PORT] or null (default)\n"
+        "  -n COUNT  advertisements to synthesize (10000)\n"
+        "  -r RATE   advertisements per second, 0 is as fast as possible (1000)\n"
+        "  -k NUM    distinct beacons (16)\n"
+        "  -o PCT    percentage of advertisements that are not beacons (0)\n"
+        "  -f FILE   replay advertisements from FILE, - is stdin, instead of synthesizing them\n"
+        "  -c CMD    control message, as if received on the control topic, can be repeated\n"
+        "  -d NAME   device name (host)\n"
+        "  -x        disconnect from the broker during the middle third of the advertisements\n"
+        "  -s        stall the broker's acknowledgements during the middle third of the advertisements\n"
+        "  -j MSEC   step the clock back by MSEC halfway through the advertisements, like an SNTP re-sync\n"
+        "  -D        fail when a message to mqtt_task is dropped for lack of a free slot\n"
+        "  -R        fail when backpressure hasn't stepped back from summaries by the end\n"
+        "  -v        verbose\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char * argv[])
+{
+    simGap_cfg_t sim = {
+        .count = 10000,
+        .rate = 1000,
+        .beacons = 16,
+        .seed = 1,
+    };
+    char const * replay = NULL;
+    char const * ctrls[16];
+    uint ctrlCnt = 0;
+    char const * name = "host";
+    bool outage = false;
+    bool stall = false;
+    bool noDrops = false;
+    bool recovered = false;
+    uint stepBack = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:r:k:o:f:c:d:xsj:DRv")) != -1) {
+        switch (opt) {
+            case 'b': host_mqttUrl = optarg; break;
+            case 'n': sim.count = strtoul(optarg, NULL, 0); break;
+            case 'r': sim.rate = strtoul(optarg, NULL, 0); break;
+            case 'k': sim.beacons = strtoul(optarg, NULL, 0); break;
+            case 'o': sim.otherPct = strtoul(optarg, NULL, 0); break;
+            case 'f': replay = optarg; break;
+            case 'c':
+                if (ctrlCnt == ARRAY_SIZE(ctrls)) _usage(argv[0]);
+                ctrls[ctrlCnt++] = optarg;
+                break;
+            case 'd': name = optarg; break;
+            case 'x': outage = true; break;
+            case 's': stall = true; break;
+            case 'j': stepBack = strtoul(optarg, NULL, 0); break;
+            case 'D': noDrops = true; break;
+            case 'R': recovered = true; break;
+            case 'v': esp_log_level_set("*", ESP_LOG_INFO); break;
+            default: _usage(argv[0]);
+        }
+    }
+
+    ipc_t const * const ipc = pipeline_start(name);
+    if (ipc == NULL) {
+        return 2;
+    }
+    for (uint ii = 0; ii < ctrlCnt; ii++) {
+        pipeline_ctrl(ctrls[ii]);
+    }
+
+    int64_t const start = esp_timer_get_time();
+    if (replay) {
+        FILE * const f = strcmp(replay, "-") == 0 ? stdin : fopen(replay, "r");
+        if (f == NULL || simGap_replay(f, sim.rate, pipeline_gapHandler) < 0) {
+            ESP_LOGE(TAG, "Can't replay (%s)", replay);
+            return 2;
+        }
+    } else if (outage || stall) {
+        // an outage sends scan results to the scan log, to be replayed after reconnecting;
+        // stalled acknowledgements fill the outbox of scan results published at QoS 1
+        simGap_cfg_t third = sim;
+        third.count = sim.count / 3;
+        simGap_synth(&third, pipeline_gapHandler);
+        outage ? mqtt_shim_outage(true) : mqtt_shim_stallAcks(true);
+        simGap_synth(&third, pipeline_gapHandler);
+        outage ? mqtt_shim_outage(false) : mqtt_shim_stallAcks(false);
+        third.count = sim.count - 2 * third.count;
+        simGap_synth(&third, pipeline_gapHandler);
+    } else if (stepBack) {
+        // the records that follow are time-stamped before those already batched
+        simGap_cfg_t half = sim;
+        half.count = sim.count / 2;
+        simGap_synth(&half, pipeline_gapHandler);
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        timeSync_update(esp_timer_get_time(), (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec - stepBack * 1000LL);
+        half.count = sim.count - half.count;
+        simGap_synth(&half, pipeline_gapHandler);
+    } else {
+        simGap_synth(&sim, pipeline_gapHandler);
+    }
+    int64_t const elapsed = esp_timer_get_time() - start;
+    pipeline_drain();
+
+    ipc_count_t const * const count = &ipc->dev.count;
+    scanLog_stats_t const * const log = scanLog_stats();
+    outbox_stats_t const * const outbox = outbox_stats();
+    mqtt_shim_stats_t mqtt;
+    mqtt_shim_stats(&mqtt);
+    printf("{ \"adv\": %u, \"beacon\": %u, \"enqueued\": %u, \"published\": %u, "
+           "\"drop\": { \"ring\": %u, \"toMqtt\": %u }, \"hwm\": { \"ring\": %u, \"toMqtt\": %u }, "
+           "\"log\": { \"logged\": %u, \"replayed\": %u, \"lost\": %u }, "
+           "\"outbox\": { \"hwm\": %u, \"queued\": %u, \"dropped\": %u, \"droppedRecs\": %u }, "
+           "\"mqtt\": { \"msgs\": %" PRIu64 ", \"bytes\": %" PRIu64 ", \"future\": %" PRIu64 " }, "
+           "\"elapsedMs\": %" PRId64 ", \"advPerSec\": %" PRId64 " }\n",
+           count->advRx, count->beaconRx, count->scanEnqueued, count->scanPublished,
+           count->scanDrop, ipc->toMqttQ->drop, count->ringHwm, ipc->toMqttQ->hwm,
+           log->logged, log->replayed, log->lost,
+           outbox->inflightHwm, outbox->queued, outbox->dropped, outbox->droppedRecs,
+           mqtt.msgs, mqtt.bytes, mqtt.future,
+           elapsed / 1000, elapsed ? (int64_t)count->advRx * 1000000 / elapsed : 0);
+
+    if (mqtt.future) {
+        return EXIT_FAILURE;
+    }
+    if (noDrops && ipc->toMqttQ->drop) {
+        return EXIT_FAILURE;
+    }
+    if (recovered && ipc->cfg.pressure == IPC_PRESSURE_summary) {
+        return EXIT_FAILURE;
+    }
+    return count->scanPublished + outbox->droppedRecs == count->scanEnqueued ? EXIT_SUCCESS : EXIT_FAILURE;
+}
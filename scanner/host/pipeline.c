@@ -0,0 +1,133 @@
+/**
+ * @brief pipeline, starts the scanner tasks on the host in place of app_main() and ble_task
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <mqtt_client.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "ipc.h"
+#include "devname.h"
+#include "esp_ibeacon_api.h"
+#include "scan_filter.h"
+#include "blescan_wire.h"
+#include "scan_log.h"
+#include "timesync.h"
+#include "outbox.h"
+#include "scan_task.h"
+#include "mqtt_task.h"
+#include "pipeline.h"
+
+static char const * const TAG = "pipeline";
+
+static ipc_t _ipc = {
+    .cfg = {
+        .scanFmt = IPC_SCAN_FMT_JSON,
+        .summaryMs = CONFIG_BLESCAN_SUMMARY_WINDOW,
+        .trackDb = CONFIG_BLESCAN_TRACK_HYST_DB,
+        .trackMs = CONFIG_BLESCAN_TRACK_SILENCE_MSEC,
+    },
+};
+
+// takes the place of ble_task's GAP callback
+
+void
+pipeline_gapHandler(esp_gap_ble_cb_event_t const event, esp_ble_gap_cb_param_t * const param)
+{
+    if (event == ESP_GAP_BLE_SCAN_RESULT_EVT) {
+        sendToScan(param, &_ipc);
+    }
+}
+
+// takes the place of ble_task, there is no radio to control
+
+static void
+_ble_task(void * ipc_void)
+{
+    ipc_t * const ipc = ipc_void;
+
+    while (1) {
+        ipc_to_ble_msg_t * const msg = ipc_receive(ipc->toBleQ, portMAX_DELAY);
+        ESP_LOGW(TAG, "Ignoring \"%s\", the host always scans", msg->data);
+        sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, "{ \"response\": { \"mode\": \"SCAN\", \"interval\": 0, \"window\": 0, \"switchUs\": 0 } }", ipc);
+        ipc_release(ipc->toBleQ, msg);
+    }
+}
+
+ipc_t *
+pipeline_start(char const * const devName)
+{
+    devName_init();  // no partition on the host, uses the built-in names
+    scanFilter_init();
+    scanLog_init();  // in RAM on the host
+    timeSync_start();  // syncs right away to the host's clock
+    ipc_init(&_ipc);
+    uint8_t const bda[ESP_BD_ADDR_LEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };  // locally administered
+    bda2str(bda, _ipc.dev.bda);
+    snprintf(_ipc.dev.name, sizeof(_ipc.dev.name), "%s", devName);
+    snprintf(_ipc.dev.ipAddr, sizeof(_ipc.dev.ipAddr), "127.0.0.1");
+    sendToMqtt(IPC_TO_MQTT_IPC_DEV_AVAILABLE, _ipc.dev.name, &_ipc);
+
+    xTaskCreate(&scan_task, "scan_task", 4096, &_ipc, CONFIG_BLESCAN_SCAN_TASK_PRIORITY, NULL);
+    xTaskCreate(&_ble_task, "ble_task", 4096, &_ipc, 5, NULL);
+    xTaskCreate(&mqtt_task, "mqtt_task", 2 * 4096, &_ipc, 5, NULL);
+
+    for (uint ii = 0; ii < 100 && _ipc.dev.count.mqttConnect == 0; ii++) {  // 5 sec
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+    }
+    if (_ipc.dev.count.mqttConnect == 0) {
+        ESP_LOGE(TAG, "Can't connect to broker (%s)", host_mqttUrl);
+        return NULL;
+    }
+    return &_ipc;
+}
+
+// as if `cmd` was received on the device's control topic
+
+void
+pipeline_ctrl(char const * const cmd)
+{
+    char topic[80];
+    snprintf(topic, sizeof(topic), "%s/%s", CONFIG_BLESCAN_MQTT_CTRL_TOPIC, _ipc.dev.name);
+    mqtt_shim_inject(topic, cmd);
+}
+
+// waits until every scan message handed to mqtt_task has been published or dropped from the outbox, and no more arrive
+
+void
+pipeline_drain(void)
+{
+    uint lastEnqueued = ~0U;
+    for (uint ii = 0; ii < 200; ii++) {  // 10 sec
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+        uint const enqueued = _ipc.dev.count.scanEnqueued;
+        if (enqueued == lastEnqueued && _ipc.dev.count.scanPublished + outbox_stats()->droppedRecs == enqueued) {
+            return;
+        }
+        lastEnqueued = enqueued;
+    }
+}
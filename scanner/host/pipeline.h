@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+ * Starts the scanner tasks on the host, in place of app_main() and ble_task.
+ */
+
+ipc_t * pipeline_start(char const * const devName);
+void pipeline_gapHandler(esp_gap_ble_cb_event_t const event, esp_ble_gap_cb_param_t * const param);
+void pipeline_ctrl(char const * const cmd);
+void pipeline_drain(void);
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * Kconfig values for the host build.  These mirror the defaults in ../main/Kconfig; change
+ * them here to experiment, or at runtime with the control messages.
+ */
+
+#define CONFIG_BLESCAN_MQTT_DATA_TOPIC "blescan/data"
+#define CONFIG_BLESCAN_MQTT_CTRL_TOPIC "blescan/ctrl"
+#define CONFIG_BLESCAN_SCAN_TASK_PRIORITY 5
+#define CONFIG_BLESCAN_SCAN_RING_LEN 64
+#define CONFIG_BLESCAN_IPC_TO_MQTT_DEPTH 16
+#define CONFIG_BLESCAN_IPC_TO_MQTT_MSG_SIZE 768
+#define CONFIG_BLESCAN_IPC_TO_BLE_DEPTH 4
+#define CONFIG_BLESCAN_IPC_TO_BLE_MSG_SIZE 256
+#define CONFIG_BLESCAN_BATCH_WINDOW 0
+#define CONFIG_BLESCAN_BATCH_MAX_BYTES 4096
+#define CONFIG_BLESCAN_SCAN_FORMAT_JSON 1
+#define CONFIG_BLESCAN_SUMMARY_WINDOW 0
+#define CONFIG_BLESCAN_SUMMARY_TABLE_LEN 128
+#define CONFIG_BLESCAN_STATS_PERIOD 10
+#define CONFIG_BLESCAN_FILTER_MAX_RULES 16
+#define CONFIG_BLESCAN_SCANLOG_REPLAY_RATE 500
+#define CONFIG_BLESCAN_SCANLOG_REPLAY_BATCH 64
+#define CONFIG_BLESCAN_SNTP_SERVER "pool.ntp.org"
+#define CONFIG_BLESCAN_MIX_CYCLE_MSEC 1000
+#define CONFIG_BLESCAN_MIX_ADV_PCT 20
+#define CONFIG_BLESCAN_MIX_JITTER_MSEC 50
+#define CONFIG_BLESCAN_GAP_TIMEOUT_MSEC 500
+#define CONFIG_BLESCAN_GAP_RETRIES 2
+#define CONFIG_BLESCAN_MQTT_QOS_DATA 0
+#define CONFIG_BLESCAN_MQTT_QOS_CTRL 1
+#define CONFIG_BLESCAN_MQTT_OUTBOX_SIZE 8192
+#define CONFIG_BLESCAN_MQTT_INFLIGHT_MAX 4096
+#define CONFIG_BLESCAN_MQTT_INFLIGHT_TIMEOUT_MSEC 30000
+#define CONFIG_BLESCAN_TRACK_HYST_DB 3
+#define CONFIG_BLESCAN_TRACK_SILENCE_MSEC 10000
+#define CONFIG_BLESCAN_TRACK_TABLE_LEN 64
+#define CONFIG_BLESCAN_TRACK_EMA_PCT 25
+#define CONFIG_BLESCAN_TRACK_KALMAN_Q 400
+#define CONFIG_BLESCAN_TRACK_KALMAN_R 16
+#define CONFIG_BLESCAN_TRACK_PATH_LOSS 20
+// CONFIG_BLESCAN_BACKPRESSURE is off, so the benchmark measures what gets dropped; "backpressure on" enables it
+#define CONFIG_BLESCAN_BACKPRESSURE_HIGH_PCT 75
+#define CONFIG_BLESCAN_BACKPRESSURE_LOW_PCT 25
+#define CONFIG_BLESCAN_BACKPRESSURE_HOLD_MSEC 2000
+#define CONFIG_BLESCAN_BACKPRESSURE_RECOVER_MSEC 10000
+#define CONFIG_BLESCAN_BACKPRESSURE_SAMPLE_N 4
+#define CONFIG_BLESCAN_BACKPRESSURE_SUMMARY_MSEC 1000
+#define CONFIG_BLESCAN_SCAN_INTERVAL_MSEC 0
+#define CONFIG_BLESCAN_SCAN_DUP_FLUSH_MSEC 10000
+#define CONFIG_BLESCAN_ADV_IDENT_MAX 16
+#define CONFIG_BLESCAN_ADV_ROTATE_MSEC 1000
+#define CONFIG_BLESCAN_PROBE_PERIOD_MSEC 200
+#define CONFIG_BLESCAN_PROBE_TABLE_LEN 8
+#define CONFIG_BLESCAN_PROBE_REPORT_MSEC 10000
+
+// the broker comes from the command line, see host_main.c
+
+#define CONFIG_BLESCAN_HARDCODED_MQTT_CREDENTIALS 1
+#define CONFIG_BLESCAN_HARDCODED_MQTT_URL host_mqttUrl
+extern char const * host_mqttUrl;
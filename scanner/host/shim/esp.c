@@ -0,0 +1,351 @@
+/**
+ * @brief ESP-IDF system services for the host build: logging, timer, NVS, partitions, SNTP, OTA and Wi-Fi
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_sntp.h>
+#include <nvs_flash.h>
+
+char const * host_mqttUrl = "null";  // CONFIG_BLESCAN_HARDCODED_MQTT_URL, see ../sdkconfig.h
+
+char const *
+esp_err_to_name(esp_err_t const code)
+{
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+// log, a single level for all tags
+
+static esp_log_level_t _logLevel = ESP_LOG_WARN;
+
+void
+esp_log_level_set(char const * const tag, esp_log_level_t const level)
+{
+    _logLevel = level;
+}
+
+void
+esp_log_write(esp_log_level_t const level, char const * const tag, char const * const format, ...)
+{
+    if (level > _logLevel) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, format);
+    vfprintf(stderr, format, ap);
+    va_end(ap);
+}
+
+// system
+
+int64_t
+esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000L;
+}
+
+void
+esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() called, exiting\n");
+    exit(EXIT_SUCCESS);
+}
+
+size_t
+heap_caps_get_free_size(uint32_t const caps)
+{
+    return 0;  // not meaningful on the host
+}
+
+esp_err_t
+esp_wifi_sta_get_ap_info(wifi_ap_record_t * const ap_info)
+{
+    *ap_info = (wifi_ap_record_t) {
+        .ssid = "host",
+        .rssi = 0,
+    };
+    return ESP_OK;
+}
+
+// flash, only "scanlog" exists, in RAM, with NOR flash semantics: writing only clears bits
+
+static uint8_t _scanlogFlash[8 * SPI_FLASH_SEC_SIZE];
+static esp_partition_t const _scanlog = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x41,
+    .size = sizeof(_scanlogFlash),
+    .label = "scanlog",
+};
+
+esp_partition_t const *
+esp_partition_find_first(esp_partition_type_t const type, esp_partition_subtype_t const subtype, char const * const label)
+{
+    if (label && strcmp(label, _scanlog.label) == 0) {
+        static bool erased = false;
+        if (!erased) {
+            memset(_scanlogFlash, 0xFF, sizeof(_scanlogFlash));
+            erased = true;
+        }
+        return &_scanlog;
+    }
+    return NULL;
+}
+
+esp_err_t
+esp_partition_read(esp_partition_t const * const part, size_t const offset, void * const dst, size_t const size)
+{
+    if (part != &_scanlog || offset + size > part->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memcpy(dst, _scanlogFlash + offset, size);
+    return ESP_OK;
+}
+
+esp_err_t
+esp_partition_write(esp_partition_t const * const part, size_t const offset, void const * const src, size_t const size)
+{
+    if (part != &_scanlog || offset + size > part->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (size_t ii = 0; ii < size; ii++) {
+        _scanlogFlash[offset + ii] &= ((uint8_t const *)src)[ii];
+    }
+    return ESP_OK;
+}
+
+esp_err_t
+esp_partition_erase_range(esp_partition_t const * const part, size_t const offset, size_t const size)
+{
+    if (part != &_scanlog || offset + size > part->size || offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(_scanlogFlash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+esp_err_t
+esp_partition_mmap(esp_partition_t const * const part, size_t const offset, size_t const size, spi_flash_mmap_memory_t const memory, void const ** const out_ptr, spi_flash_mmap_handle_t * const out_handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void
+spi_flash_munmap(spi_flash_mmap_handle_t const handle)
+{
+}
+
+esp_partition_t const *
+esp_ota_get_running_partition(void)
+{
+    static esp_partition_t const running = {
+        .type = ESP_PARTITION_TYPE_APP,
+        .label = "host",
+    };
+    return &running;
+}
+
+esp_err_t
+esp_ota_get_partition_description(esp_partition_t const * const part, esp_app_desc_t * const app_desc)
+{
+    *app_desc = (esp_app_desc_t) {
+        .project_name = "scanner",
+        .version = "host",
+        .date = __DATE__,
+        .time = __TIME__,
+    };
+    return ESP_OK;
+}
+
+// sntp, the host's clock is already synced
+
+static sntp_sync_time_cb_t _sntpCb = NULL;
+static bool _sntpEnabled = false;
+
+void
+sntp_setoperatingmode(uint8_t const operating_mode)
+{
+}
+
+void
+sntp_setservername(uint8_t const idx, char const * const server)
+{
+}
+
+void
+sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t const callback)
+{
+    _sntpCb = callback;
+}
+
+void
+sntp_init(void)
+{
+    _sntpEnabled = true;
+    if (_sntpCb) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        _sntpCb(&tv);
+    }
+}
+
+bool
+sntp_enabled(void)
+{
+    return _sntpEnabled;
+}
+
+// nvs, kept in memory
+
+#define NVS_ENTRIES (16)
+
+static struct {
+    char     key[16];  // NVS keys are at most 15 characters
+    void *   value;
+    size_t   len;
+} _nvs[NVS_ENTRIES];
+
+esp_err_t
+nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t
+nvs_flash_erase(void)
+{
+    for (int ii = 0; ii < NVS_ENTRIES; ii++) {
+        free(_nvs[ii].value);
+    }
+    memset(_nvs, 0, sizeof(_nvs));
+    return ESP_OK;
+}
+
+esp_err_t
+nvs_open(char const * const name, nvs_open_mode_t const open_mode, nvs_handle_t * const out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+static int
+_nvsFind(char const * const key)
+{
+    for (int ii = 0; ii < NVS_ENTRIES; ii++) {
+        if (_nvs[ii].value && strcmp(_nvs[ii].key, key) == 0) {
+            return ii;
+        }
+    }
+    return -1;
+}
+
+esp_err_t
+nvs_get_str(nvs_handle_t const handle, char const * const key, char * const out_value, size_t * const length)
+{
+    return nvs_get_blob(handle, key, out_value, length);
+}
+
+esp_err_t
+nvs_get_blob(nvs_handle_t const handle, char const * const key, void * const out_value, size_t * const length)
+{
+    int const ii = _nvsFind(key);
+    if (ii < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value) {
+        if (*length < _nvs[ii].len) {
+            return ESP_ERR_NVS_INVALID_LENGTH;
+        }
+        memcpy(out_value, _nvs[ii].value, _nvs[ii].len);
+    }
+    *length = _nvs[ii].len;
+    return ESP_OK;
+}
+
+esp_err_t
+nvs_set_blob(nvs_handle_t const handle, char const * const key, void const * const value, size_t const length)
+{
+    int ii = _nvsFind(key);
+    if (ii < 0) {
+        for (ii = 0; ii < NVS_ENTRIES && _nvs[ii].value; ii++) {
+        }
+        if (ii == NVS_ENTRIES) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        snprintf(_nvs[ii].key, sizeof(_nvs[ii].key), "%s", key);
+    }
+    void * const copy = malloc(length ? length : 1);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(copy, value, length);
+    free(_nvs[ii].value);
+    _nvs[ii].value = copy;
+    _nvs[ii].len = length;
+    return ESP_OK;
+}
+
+esp_err_t
+nvs_erase_key(nvs_handle_t const handle, char const * const key)
+{
+    int const ii = _nvsFind(key);
+    if (ii < 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    free(_nvs[ii].value);
+    memset(&_nvs[ii], 0, sizeof(_nvs[ii]));
+    return ESP_OK;
+}
+
+esp_err_t
+nvs_commit(nvs_handle_t const handle)
+{
+    return ESP_OK;
+}
+
+void
+nvs_close(nvs_handle_t const handle)
+{
+}
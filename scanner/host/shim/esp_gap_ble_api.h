@@ -0,0 +1,49 @@
+#pragma once
+
+/*
+ * The scan result part of the Bluedroid GAP API.  The host has no radio; scan results
+ * are synthesized by sim_gap.c and passed to the same handler as on the device.
+ */
+
+#include <stdint.h>
+#include <esp_err.h>
+#include <esp_bt_defs.h>
+
+#define ESP_BLE_ADV_DATA_LEN_MAX (31)
+#define ESP_BLE_SCAN_RSP_DATA_LEN_MAX (31)
+
+typedef enum {
+    ESP_GAP_BLE_SCAN_RESULT_EVT = 3,
+} esp_gap_ble_cb_event_t;
+
+typedef enum {
+    ESP_GAP_SEARCH_INQ_RES_EVT = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT = 1,
+} esp_gap_search_evt_t;
+
+typedef enum {
+    ESP_BLE_EVT_CONN_ADV = 0x00,
+    ESP_BLE_EVT_CONN_DIR_ADV = 0x01,
+    ESP_BLE_EVT_DISC_ADV = 0x02,
+    ESP_BLE_EVT_NON_CONN_ADV = 0x03,
+    ESP_BLE_EVT_SCAN_RSP = 0x04,
+} esp_ble_evt_type_t;
+
+typedef union {
+    struct ble_scan_result_evt_param {
+        esp_gap_search_evt_t search_evt;
+        esp_bd_addr_t        bda;
+        esp_bt_dev_type_t    dev_type;
+        esp_ble_addr_type_t  ble_addr_type;
+        esp_ble_evt_type_t   ble_evt_type;
+        int                  rssi;
+        uint8_t              ble_adv[ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX];
+        int                  flag;
+        int                  num_resps;
+        uint8_t              adv_data_len;
+        uint8_t              scan_rsp_len;
+        uint32_t             num_dis;
+    } scan_rst;
+} esp_ble_gap_cb_param_t;
+
+typedef void (* esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param);
@@ -0,0 +1,3 @@
+#pragma once
+
+// included by esp_ibeacon_api.h, nothing from it is used on the host
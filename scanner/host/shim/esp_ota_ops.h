@@ -0,0 +1,14 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_partition.h>
+
+typedef struct {
+    char version[32];
+    char project_name[32];
+    char time[16];
+    char date[16];
+} esp_app_desc_t;
+
+esp_partition_t const * esp_ota_get_running_partition(void);
+esp_err_t esp_ota_get_partition_description(esp_partition_t const * const part, esp_app_desc_t * const app_desc);
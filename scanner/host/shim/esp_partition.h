@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_err.h>
+#include <esp_spi_flash.h>
+
+typedef enum {
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum {
+    ESP_PARTITION_SUBTYPE_DATA_UNDEFINED = 0x40,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+    esp_partition_type_t    type;
+    esp_partition_subtype_t subtype;
+    uint32_t                address;
+    uint32_t                size;
+    char                    label[17];
+    bool                    encrypted;
+} esp_partition_t;
+
+// the host only has a "scanlog" partition, in RAM, other callers take their fallback path
+esp_partition_t const * esp_partition_find_first(esp_partition_type_t const type, esp_partition_subtype_t const subtype, char const * const label);
+esp_err_t esp_partition_read(esp_partition_t const * const part, size_t const offset, void * const dst, size_t const size);
+esp_err_t esp_partition_write(esp_partition_t const * const part, size_t const offset, void const * const src, size_t const size);
+esp_err_t esp_partition_erase_range(esp_partition_t const * const part, size_t const offset, size_t const size);
+esp_err_t esp_partition_mmap(esp_partition_t const * const part, size_t const offset, size_t const size, spi_flash_mmap_memory_t const memory, void const ** const out_ptr, spi_flash_mmap_handle_t * const out_handle);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL (0)
+
+typedef void (* sntp_sync_time_cb_t)(struct timeval * tv);
+
+// the host's clock is already synced, so sntp_init() reports a sync right away
+void sntp_setoperatingmode(uint8_t const operating_mode);
+void sntp_setservername(uint8_t const idx, char const * const server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t const callback);
+void sntp_init(void);
+bool sntp_enabled(void);
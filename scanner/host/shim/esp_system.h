@@ -0,0 +1,6 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+
+void esp_restart(void) __attribute__((noreturn));
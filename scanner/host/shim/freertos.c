@@ -0,0 +1,378 @@
+/**
+ * @brief FreeRTOS tasks, queues, notifications, event groups and mutexes on POSIX threads
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+/*
+ * Time.  Ticks are msec on a monotonic clock; waits convert them to an absolute deadline
+ * on the same clock, so the condition variables are created with CLOCK_MONOTONIC.
+ */
+
+static void
+_deadline(TickType_t const wait, struct timespec * const ts)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    uint64_t const nsec = (uint64_t)ts->tv_nsec + (uint64_t)wait * portTICK_PERIOD_MS * 1000000ULL;
+    ts->tv_sec += nsec / 1000000000ULL;
+    ts->tv_nsec = nsec % 1000000000ULL;
+}
+
+static void
+_condInit(pthread_cond_t * const cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// waits on `cond` for at most `wait` ticks, returns false on timeout
+
+static bool
+_condWait(pthread_cond_t * const cond, pthread_mutex_t * const mutex, TickType_t const wait, struct timespec const * const deadline)
+{
+    if (wait == 0) {
+        return false;
+    }
+    if (wait == portMAX_DELAY) {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+TickType_t
+xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)((uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000L) / portTICK_PERIOD_MS;
+}
+
+void
+vTaskDelay(TickType_t const ticks)
+{
+    struct timespec const ts = {
+        .tv_sec = ticks * portTICK_PERIOD_MS / 1000,
+        .tv_nsec = (ticks * portTICK_PERIOD_MS % 1000) * 1000000L,
+    };
+    nanosleep(&ts, NULL);
+}
+
+/*
+ * Tasks.  Each task is a detached thread with a notification counter.  Priorities and stack
+ * depths are ignored.
+ */
+
+struct tskTaskControlBlock {
+    pthread_t       thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t        notify;
+    TaskFunction_t  fnc;
+    void *          param;
+};
+
+static _Thread_local TaskHandle_t _current = NULL;
+
+static TaskHandle_t
+_taskAlloc(TaskFunction_t const fnc, void * const param)
+{
+    TaskHandle_t const task = calloc(1, sizeof(*task));
+    if (task) {
+        pthread_mutex_init(&task->mutex, NULL);
+        _condInit(&task->cond);
+        task->fnc = fnc;
+        task->param = param;
+    }
+    return task;
+}
+
+static void *
+_taskEntry(void * const task_void)
+{
+    _current = task_void;
+    _current->fnc(_current->param);
+    return NULL;
+}
+
+BaseType_t
+xTaskCreate(TaskFunction_t const fnc, char const * const name, uint32_t const stackDepth, void * const param, UBaseType_t const prio, TaskHandle_t * const handle)
+{
+    TaskHandle_t const task = _taskAlloc(fnc, param);
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int const err = pthread_create(&task->thread, &attr, _taskEntry, task);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        free(task);
+        return pdFAIL;
+    }
+    if (handle) {
+        *handle = task;
+    }
+    return pdPASS;
+}
+
+void
+vTaskDelete(TaskHandle_t const task)
+{
+    if (task == NULL || task == _current) {
+        pthread_exit(NULL);  // the control block stays, other tasks may still notify it
+    }
+    pthread_cancel(task->thread);
+}
+
+TaskHandle_t
+xTaskGetCurrentTaskHandle(void)
+{
+    if (_current == NULL) {  // a thread not created by xTaskCreate, such as main()
+        _current = _taskAlloc(NULL, NULL);
+        _current->thread = pthread_self();
+    }
+    return _current;
+}
+
+BaseType_t
+xTaskNotifyGive(TaskHandle_t const task)
+{
+    pthread_mutex_lock(&task->mutex);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return pdPASS;
+}
+
+uint32_t
+ulTaskNotifyTake(BaseType_t const clearOnExit, TickType_t const wait)
+{
+    TaskHandle_t const task = xTaskGetCurrentTaskHandle();
+    struct timespec deadline;
+    _deadline(wait, &deadline);
+
+    pthread_mutex_lock(&task->mutex);
+    while (task->notify == 0 && _condWait(&task->cond, &task->mutex, wait, &deadline)) {
+    }
+    uint32_t const value = task->notify;
+    if (value) {
+        task->notify = clearOnExit ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return value;
+}
+
+/*
+ * Queues.  Items are copied into a ring buffer, as in FreeRTOS.
+ */
+
+struct QueueDefinition {
+    pthread_mutex_t mutex;
+    pthread_cond_t  notEmpty;
+    pthread_cond_t  notFull;
+    UBaseType_t     len;
+    UBaseType_t     itemSize;
+    UBaseType_t     head;   // next item to receive
+    UBaseType_t     count;  // items waiting
+    uint8_t *       items;
+};
+
+QueueHandle_t
+xQueueCreate(UBaseType_t const len, UBaseType_t const itemSize)
+{
+    QueueHandle_t const q = calloc(1, sizeof(*q));
+    if (q == NULL || (q->items = calloc(len ? len : 1, itemSize ? itemSize : 1)) == NULL) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->mutex, NULL);
+    _condInit(&q->notEmpty);
+    _condInit(&q->notFull);
+    q->len = len;
+    q->itemSize = itemSize;
+    return q;
+}
+
+BaseType_t
+xQueueSendToBack(QueueHandle_t const q, void const * const item, TickType_t const wait)
+{
+    struct timespec deadline;
+    _deadline(wait, &deadline);
+
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == q->len) {
+        if (!_condWait(&q->notFull, &q->mutex, wait, &deadline)) {
+            pthread_mutex_unlock(&q->mutex);
+            return pdFAIL;
+        }
+    }
+    if (q->itemSize) {
+        memcpy(q->items + ((q->head + q->count) % q->len) * q->itemSize, item, q->itemSize);
+    }
+    q->count++;
+    pthread_cond_signal(&q->notEmpty);
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+BaseType_t
+xQueueReceive(QueueHandle_t const q, void * const item, TickType_t const wait)
+{
+    struct timespec deadline;
+    _deadline(wait, &deadline);
+
+    pthread_mutex_lock(&q->mutex);
+    while (q->count == 0) {
+        if (!_condWait(&q->notEmpty, &q->mutex, wait, &deadline)) {
+            pthread_mutex_unlock(&q->mutex);
+            return pdFAIL;
+        }
+    }
+    if (q->itemSize) {
+        memcpy(item, q->items + q->head * q->itemSize, q->itemSize);
+    }
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    pthread_cond_signal(&q->notFull);
+    pthread_mutex_unlock(&q->mutex);
+    return pdPASS;
+}
+
+UBaseType_t
+uxQueueMessagesWaiting(QueueHandle_t const q)
+{
+    pthread_mutex_lock(&q->mutex);
+    UBaseType_t const count = q->count;
+    pthread_mutex_unlock(&q->mutex);
+    return count;
+}
+
+/*
+ * Mutexes are queues of length 1 holding no data, as in FreeRTOS.  The queue starts full,
+ * so the first take succeeds.
+ */
+
+SemaphoreHandle_t
+xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t const sem = xQueueCreate(1, 0);
+    if (sem) {
+        sem->count = 1;
+    }
+    return sem;
+}
+
+BaseType_t
+xSemaphoreTake(SemaphoreHandle_t const sem, TickType_t const wait)
+{
+    uint8_t dummy;
+    return xQueueReceive(sem, &dummy, wait);
+}
+
+BaseType_t
+xSemaphoreGive(SemaphoreHandle_t const sem)
+{
+    return xQueueSendToBack(sem, NULL, 0);
+}
+
+/*
+ * Event groups
+ */
+
+struct EventGroupDef_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    EventBits_t     bits;
+};
+
+EventGroupHandle_t
+xEventGroupCreate(void)
+{
+    EventGroupHandle_t const grp = calloc(1, sizeof(*grp));
+    if (grp) {
+        pthread_mutex_init(&grp->mutex, NULL);
+        _condInit(&grp->cond);
+    }
+    return grp;
+}
+
+EventBits_t
+xEventGroupSetBits(EventGroupHandle_t const grp, EventBits_t const bits)
+{
+    pthread_mutex_lock(&grp->mutex);
+    grp->bits |= bits;
+    EventBits_t const value = grp->bits;
+    pthread_cond_broadcast(&grp->cond);
+    pthread_mutex_unlock(&grp->mutex);
+    return value;
+}
+
+EventBits_t
+xEventGroupClearBits(EventGroupHandle_t const grp, EventBits_t const bits)
+{
+    pthread_mutex_lock(&grp->mutex);
+    EventBits_t const value = grp->bits;  // returns the bits before they were cleared
+    grp->bits &= ~bits;
+    pthread_mutex_unlock(&grp->mutex);
+    return value;
+}
+
+EventBits_t
+xEventGroupGetBits(EventGroupHandle_t const grp)
+{
+    pthread_mutex_lock(&grp->mutex);
+    EventBits_t const value = grp->bits;
+    pthread_mutex_unlock(&grp->mutex);
+    return value;
+}
+
+EventBits_t
+xEventGroupWaitBits(EventGroupHandle_t const grp, EventBits_t const bits, BaseType_t const clearOnExit, BaseType_t const waitForAll, TickType_t const wait)
+{
+    struct timespec deadline;
+    _deadline(wait, &deadline);
+
+    pthread_mutex_lock(&grp->mutex);
+    while (!(waitForAll ? (grp->bits & bits) == bits : (grp->bits & bits) != 0)) {
+        if (!_condWait(&grp->cond, &grp->mutex, wait, &deadline)) {
+            break;
+        }
+    }
+    EventBits_t const value = grp->bits;
+    bool const met = waitForAll ? (value & bits) == bits : (value & bits) != 0;
+    if (met && clearOnExit) {
+        grp->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&grp->mutex);
+    return value;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * FreeRTOS API subset used by scanner/main, implemented on POSIX threads in ../freertos.c.
+ * A tick is 1 msec.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <esp_err.h>
+#include <esp_bit_defs.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint32_t EventBits_t;
+
+typedef struct QueueDefinition * QueueHandle_t;
+typedef struct tskTaskControlBlock * TaskHandle_t;
+typedef struct EventGroupDef_t * EventGroupHandle_t;
+typedef struct QueueDefinition * SemaphoreHandle_t;
+typedef void (* TaskFunction_t)(void *);
+
+#define pdFALSE (0)
+#define pdTRUE (1)
+#define pdFAIL (pdFALSE)
+#define pdPASS (pdTRUE)
+
+#define configTICK_RATE_HZ (1000)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t const grp, EventBits_t const bits);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t const grp, EventBits_t const bits);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t const grp);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t const grp, EventBits_t const bits, BaseType_t const clearOnExit, BaseType_t const waitForAll, TickType_t const wait);
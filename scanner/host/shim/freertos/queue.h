@@ -0,0 +1,10 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+QueueHandle_t xQueueCreate(UBaseType_t const len, UBaseType_t const itemSize);
+BaseType_t xQueueSendToBack(QueueHandle_t const q, void const * const item, TickType_t const wait);
+BaseType_t xQueueReceive(QueueHandle_t const q, void * const item, TickType_t const wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t const q);
+
+#define xQueueSend(q, item, wait) xQueueSendToBack((q), (item), (wait))
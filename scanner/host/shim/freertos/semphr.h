@@ -0,0 +1,7 @@
+#pragma once
+
+#include "queue.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t const sem, TickType_t const wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t const sem);
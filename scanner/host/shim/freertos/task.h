@@ -0,0 +1,11 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+BaseType_t xTaskCreate(TaskFunction_t const fnc, char const * const name, uint32_t const stackDepth, void * const param, UBaseType_t const prio, TaskHandle_t * const handle);
+void vTaskDelete(TaskHandle_t const task);
+void vTaskDelay(TickType_t const ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotifyGive(TaskHandle_t const task);
+uint32_t ulTaskNotifyTake(BaseType_t const clearOnExit, TickType_t const wait);
@@ -0,0 +1,295 @@
+/**
+ * @brief esp-mqtt client API on libmosquitto, or a counting sink for broker-less runs
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <esp_log.h>
+#include <mqtt_client.h>
+#include "blescan_wire.h"
+#ifdef BLESCAN_HOST_MOSQUITTO
+# include <mosquitto.h>
+#endif
+
+static char const * const TAG = "mqtt_client";
+
+struct esp_mqtt_client {
+    esp_mqtt_client_config_t cfg;
+    bool                     sink;  // URI "null", publish only counts
+    atomic_bool              down;  // simulated outage, see mqtt_shim_outage()
+    int                      mid;   // last message id, for the null broker
+    pthread_mutex_t          ackLock;
+    bool                     ackStall;  // see mqtt_shim_stallAcks()
+    int *                    acks;      // held back while stalled
+    uint                     ackCnt;
+    uint                     ackMax;
+    char                     host[128];
+    int                      port;
+#ifdef BLESCAN_HOST_MOSQUITTO
+    struct mosquitto *       mosq;
+#endif
+};
+
+static esp_mqtt_client_handle_t _client = NULL;  // the only client, for mqtt_shim_inject()
+static atomic_uint_fast64_t _msgs = 0;
+static atomic_uint_fast64_t _bytes = 0;
+static atomic_uint_fast64_t _future = 0;
+
+static void
+_dispatch(esp_mqtt_client_handle_t const client, esp_mqtt_event_id_t const id, char const * const topic, void const * const data, int const len, int const msgId)
+{
+    char * const topicCopy = topic ? strdup(topic) : NULL;
+    char * const dataCopy = malloc(len + 1);  // zero terminated for convenience, like esp-mqtt
+    memcpy(dataCopy, data, len);
+    dataCopy[len] = '\0';
+
+    esp_mqtt_event_t event = {
+        .event_id = id,
+        .client = client,
+        .user_context = client->cfg.user_context,
+        .data = dataCopy,
+        .data_len = len,
+        .total_data_len = len,
+        .topic = topicCopy,
+        .topic_len = topicCopy ? strlen(topicCopy) : 0,
+        .msg_id = msgId,
+    };
+    client->cfg.event_handle(&event);
+    free(dataCopy);
+    free(topicCopy);
+}
+
+// reports the broker's acknowledgement of a QoS 1 or 2 message, unless acknowledgements are stalled
+
+static void
+_ack(esp_mqtt_client_handle_t const client, int const mid)
+{
+    pthread_mutex_lock(&client->ackLock);
+    if (client->ackStall) {
+        if (client->ackCnt == client->ackMax) {
+            client->ackMax = client->ackMax ? 2 * client->ackMax : 64;
+            client->acks = realloc(client->acks, client->ackMax * sizeof(*client->acks));
+        }
+        client->acks[client->ackCnt++] = mid;
+        pthread_mutex_unlock(&client->ackLock);
+        return;
+    }
+    pthread_mutex_unlock(&client->ackLock);
+    _dispatch(client, MQTT_EVENT_PUBLISHED, NULL, "", 0, mid);
+}
+
+#ifdef BLESCAN_HOST_MOSQUITTO
+
+static void
+_onPublish(struct mosquitto * const mosq, void * const client_void, int const mid)
+{
+    _ack(client_void, mid);
+}
+
+static void
+_onConnect(struct mosquitto * const mosq, void * const client_void, int const rc)
+{
+    if (rc == 0) {
+        _dispatch(client_void, MQTT_EVENT_CONNECTED, NULL, "", 0, 0);
+    }
+}
+
+static void
+_onDisconnect(struct mosquitto * const mosq, void * const client_void, int const rc)
+{
+    _dispatch(client_void, MQTT_EVENT_DISCONNECTED, NULL, "", 0, 0);
+}
+
+static void
+_onMessage(struct mosquitto * const mosq, void * const client_void, struct mosquitto_message const * const message)
+{
+    _dispatch(client_void, MQTT_EVENT_DATA, message->topic, message->payload, message->payloadlen, message->mid);
+}
+
+#endif
+
+esp_mqtt_client_handle_t
+esp_mqtt_client_init(esp_mqtt_client_config_t const * const config)
+{
+    esp_mqtt_client_handle_t const client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->cfg = *config;
+    client->port = 1883;
+    pthread_mutex_init(&client->ackLock, NULL);
+
+    if (strcmp(config->uri, "null") == 0) {
+        client->sink = true;
+    } else if (sscanf(config->uri, "mqtt://%127[^:/]:%d", client->host, &client->port) < 1) {
+        ESP_LOGE(TAG, "Can't parse URI (%s)", config->uri);
+        free(client);
+        return NULL;
+    }
+#ifndef BLESCAN_HOST_MOSQUITTO
+    if (!client->sink) {
+        ESP_LOGE(TAG, "Built without libmosquitto, only the \"null\" URI is supported");
+        free(client);
+        return NULL;
+    }
+#endif
+    _client = client;
+    return client;
+}
+
+esp_err_t
+esp_mqtt_client_start(esp_mqtt_client_handle_t const client)
+{
+    if (client == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (client->sink) {
+        _dispatch(client, MQTT_EVENT_CONNECTED, NULL, "", 0, 0);
+        return ESP_OK;
+    }
+#ifdef BLESCAN_HOST_MOSQUITTO
+    mosquitto_lib_init();
+    client->mosq = mosquitto_new(NULL, true, client);
+    if (client->mosq == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    mosquitto_connect_callback_set(client->mosq, _onConnect);
+    mosquitto_disconnect_callback_set(client->mosq, _onDisconnect);
+    mosquitto_message_callback_set(client->mosq, _onMessage);
+    mosquitto_publish_callback_set(client->mosq, _onPublish);
+    if (mosquitto_connect_async(client->mosq, client->host, client->port, 60) != MOSQ_ERR_SUCCESS ||
+        mosquitto_loop_start(client->mosq) != MOSQ_ERR_SUCCESS) {  // reconnects on its own
+        ESP_LOGE(TAG, "Can't connect to %s:%d", client->host, client->port);
+        return ESP_FAIL;
+    }
+#endif
+    return ESP_OK;
+}
+
+int
+esp_mqtt_client_subscribe(esp_mqtt_client_handle_t const client, char const * const topic, int const qos)
+{
+    int mid = 0;
+#ifdef BLESCAN_HOST_MOSQUITTO
+    if (!client->sink && mosquitto_subscribe(client->mosq, &mid, topic, qos) != MOSQ_ERR_SUCCESS) {
+        return -1;
+    }
+#endif
+    return mid;
+}
+
+// counts the records in a binary scan payload that claim to be from the future, e.g. when a
+// time delta wrapped
+
+static void
+_checkTimes(char const * const data, int const data_len)
+{
+    blescan_wire_hdr_t hdr;
+    if (data_len < (int)sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.flags & (BLESCAN_WIRE_FLAG_UPTIME | BLESCAN_WIRE_FLAG_PRIOR_BOOT | BLESCAN_WIRE_FLAG_LZ4)) {
+        return;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t const limit = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec + 1000000LL;
+    for (uint ii = 0; ii < hdr.count && sizeof(hdr) + (ii + 1) * sizeof(blescan_wire_rec_t) <= (size_t)data_len; ii++) {
+        blescan_wire_rec_t rec;
+        memcpy(&rec, data + sizeof(hdr) + ii * sizeof(rec), sizeof(rec));
+        if (hdr.baseTime + rec.timeDelta > limit) {
+            atomic_fetch_add(&_future, 1);
+        }
+    }
+}
+
+int
+esp_mqtt_client_publish(esp_mqtt_client_handle_t const client, char const * const topic, char const * const data, int const len, int const qos, int const retain)
+{
+    int const data_len = (len == 0 && data) ? (int)strlen(data) : len;  // as esp-mqtt
+    int mid = 0;
+    if (atomic_load(&client->down)) {
+        return -1;
+    }
+#ifdef BLESCAN_HOST_MOSQUITTO
+    if (!client->sink && mosquitto_publish(client->mosq, &mid, topic, data_len, data, qos, retain) != MOSQ_ERR_SUCCESS) {
+        return -1;
+    }
+#endif
+    if (strstr(topic, "/scan") == NULL) {  // responses and statistics, not the bulk data
+        ESP_LOGI(TAG, "%s %.*s", topic, data_len, data);
+    }
+    atomic_fetch_add(&_msgs, 1);
+    atomic_fetch_add(&_bytes, data_len);
+    if (strstr(topic, "/scanbin/")) {
+        _checkTimes(data, data_len);
+    }
+    if (client->sink && qos > 0) {  // acknowledged right away
+        mid = ++client->mid;
+        _ack(client, mid);
+    }
+    return mid;
+}
+
+void
+mqtt_shim_stats(mqtt_shim_stats_t * const stats)
+{
+    stats->msgs = atomic_load(&_msgs);
+    stats->bytes = atomic_load(&_bytes);
+    stats->future = atomic_load(&_future);
+}
+
+void
+mqtt_shim_inject(char const * const topic, char const * const data)
+{
+    if (_client) {
+        _dispatch(_client, MQTT_EVENT_DATA, topic, data, strlen(data), 0);
+    }
+}
+
+void
+mqtt_shim_outage(bool const down)
+{
+    if (_client && atomic_exchange(&_client->down, down) != down) {
+        _dispatch(_client, down ? MQTT_EVENT_DISCONNECTED : MQTT_EVENT_CONNECTED, NULL, "", 0, 0);
+    }
+}
+
+void
+mqtt_shim_stallAcks(bool const stall)
+{
+    if (_client == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&_client->ackLock);
+    _client->ackStall = stall;
+    uint const cnt = stall ? 0 : _client->ackCnt;
+    _client->ackCnt = 0;
+    pthread_mutex_unlock(&_client->ackLock);
+
+    for (uint ii = 0; ii < cnt; ii++) {  // no longer stalled, so nothing is added meanwhile
+        _dispatch(_client, MQTT_EVENT_PUBLISHED, NULL, "", 0, _client->acks[ii]);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+ * esp-mqtt client API subset used by mqtt_task.c.  ../mqtt_client.c implements it on
+ * libmosquitto, or as a sink that only counts when the URI is "null".
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+typedef struct esp_mqtt_client * esp_mqtt_client_handle_t;
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+} esp_mqtt_event_id_t;
+
+typedef struct esp_mqtt_event_t {
+    esp_mqtt_event_id_t      event_id;
+    esp_mqtt_client_handle_t client;
+    void *                   user_context;
+    char *                   data;
+    int                      data_len;
+    int                      total_data_len;
+    int                      current_data_offset;
+    char *                   topic;
+    int                      topic_len;
+    int                      msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t * esp_mqtt_event_handle_t;
+typedef esp_err_t (* mqtt_event_callback_t)(esp_mqtt_event_handle_t event);
+
+typedef struct {
+    mqtt_event_callback_t event_handle;
+    void *                user_context;
+    char const *          uri;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(esp_mqtt_client_config_t const * const config);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t const client);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t const client, char const * const topic, int const qos);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t const client, char const * const topic, char const * const data, int const len, int const qos, int const retain);
+
+// host only
+
+typedef struct mqtt_shim_stats_t {
+    uint64_t msgs;   // messages published
+    uint64_t bytes;  // payload bytes published
+    uint64_t future; // binary scan records time-stamped more than a second after they were published
+} mqtt_shim_stats_t;
+
+void mqtt_shim_stats(mqtt_shim_stats_t * const stats);
+void mqtt_shim_inject(char const * const topic, char const * const data);  // as if received from the broker
+void mqtt_shim_outage(bool const down);  // as if the broker went away or came back
+void mqtt_shim_stallAcks(bool const stall);  // as if the broker stopped acknowledging QoS 1 and 2 messages, or caught up
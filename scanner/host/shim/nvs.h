@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#define ESP_ERR_NVS_BASE (0x1100)
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE (ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+// kept in memory for the life of the process, namespaces are ignored
+esp_err_t nvs_open(char const * const name, nvs_open_mode_t const open_mode, nvs_handle_t * const out_handle);
+esp_err_t nvs_get_str(nvs_handle_t const handle, char const * const key, char * const out_value, size_t * const length);
+esp_err_t nvs_get_blob(nvs_handle_t const handle, char const * const key, void * const out_value, size_t * const length);
+esp_err_t nvs_set_blob(nvs_handle_t const handle, char const * const key, void const * const value, size_t const length);
+esp_err_t nvs_erase_key(nvs_handle_t const handle, char const * const key);
+esp_err_t nvs_commit(nvs_handle_t const handle);
+void nvs_close(nvs_handle_t const handle);
@@ -0,0 +1,173 @@
+/**
+ * @brief sim_gap, synthesizes or replays BLE scan results for the host build
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <esp_timer.h>
+
+#include "esp_ibeacon_api.h"
+#include "sim_gap.h"
+
+// paces the events so that event `nr` is delivered at `start` + nr/rate
+
+static void
+_pace(int64_t const start, uint const nr, uint const rate)
+{
+    if (rate == 0) {
+        return;
+    }
+    int64_t const due = start + (int64_t)nr * 1000000LL / rate;
+    int64_t const ahead = due - esp_timer_get_time();
+    if (ahead > 1000) {  // sleeping for less is too inaccurate
+        struct timespec const ts = {
+            .tv_sec = ahead / 1000000LL,
+            .tv_nsec = (ahead % 1000000LL) * 1000L,
+        };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static uint32_t
+_xorshift(uint32_t * const state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void
+_synthIbeacon(struct ble_scan_result_evt_param * const scan_rst, uint const beacon)
+{
+    esp_ble_ibeacon_vendor_t vendor = {
+        .proximity_uuid = ESP_UUID,
+        .major = ENDIAN_CHANGE_U16(beacon >> 16),
+        .minor = ENDIAN_CHANGE_U16(beacon & 0xFFFF),
+        .measured_power = -59,
+    };
+    esp_ble_ibeacon_t ibeacon;
+    esp_ble_config_ibeacon_data(&vendor, &ibeacon);
+    memcpy(scan_rst->ble_adv, &ibeacon, sizeof(ibeacon));
+    scan_rst->adv_data_len = sizeof(ibeacon);
+    scan_rst->ble_evt_type = ESP_BLE_EVT_NON_CONN_ADV;
+}
+
+static void
+_synthOther(struct ble_scan_result_evt_param * const scan_rst)
+{
+    uint8_t const adv[] = {
+        0x02, 0x01, 0x06,             // flags
+        0x04, 0x09, 's', 'i', 'm',    // complete local name
+        0x03, 0x03, 0xAA, 0xFE,       // 16-bit service UUIDs
+    };
+    memcpy(scan_rst->ble_adv, adv, sizeof(adv));
+    scan_rst->adv_data_len = sizeof(adv);
+    scan_rst->ble_evt_type = ESP_BLE_EVT_CONN_ADV;
+}
+
+uint
+simGap_synth(simGap_cfg_t const * const cfg, esp_gap_ble_cb_t const cb)
+{
+    uint32_t state = cfg->seed ? cfg->seed : 1;
+    uint const beacons = cfg->beacons ? cfg->beacons : 1;
+    int64_t const start = esp_timer_get_time();
+
+    for (uint ii = 0; ii < cfg->count; ii++) {
+        _pace(start, ii, cfg->rate);
+
+        uint const beacon = _xorshift(&state) % beacons;
+        esp_ble_gap_cb_param_t param = {
+            .scan_rst = {
+                .search_evt = ESP_GAP_SEARCH_INQ_RES_EVT,
+                .bda = { 0x5A, 0x1D, 0x00, beacon >> 16, beacon >> 8, beacon },
+                .dev_type = ESP_BT_DEVICE_TYPE_BLE,
+                .ble_addr_type = BLE_ADDR_TYPE_RANDOM,
+                .rssi = -40 - (int)(_xorshift(&state) % 50),
+                .num_resps = 1,
+            },
+        };
+        if (_xorshift(&state) % 100 < cfg->otherPct) {
+            _synthOther(&param.scan_rst);
+        } else {
+            _synthIbeacon(&param.scan_rst, beacon);
+        }
+        cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+    }
+    return cfg->count;
+}
+
+static int
+_hex2bin(char const * hex, uint8_t * const bin, uint const max)
+{
+    uint len = 0;
+    unsigned int byte;
+    while (*hex && *hex != '\n' && len < max) {
+        if (sscanf(hex, "%2x", &byte) != 1) {
+            return -1;
+        }
+        bin[len++] = byte;
+        hex += 2;
+    }
+    return len;
+}
+
+int
+simGap_replay(FILE * const f, uint const rate, esp_gap_ble_cb_t const cb)
+{
+    char line[256];
+    uint nr = 0;
+    int64_t const start = esp_timer_get_time();
+
+    while (fgets(line, sizeof(line), f)) {
+        if (*line == '#' || *line == '\n') {
+            continue;
+        }
+        esp_ble_gap_cb_param_t param = {
+            .scan_rst = {
+                .search_evt = ESP_GAP_SEARCH_INQ_RES_EVT,
+                .dev_type = ESP_BT_DEVICE_TYPE_BLE,
+                .num_resps = 1,
+            },
+        };
+        struct ble_scan_result_evt_param * const scan_rst = &param.scan_rst;
+        unsigned int bda[ESP_BD_ADDR_LEN];
+        char hex[2 * sizeof(scan_rst->ble_adv) + 1];
+        if (sscanf(line, "%x:%x:%x:%x:%x:%x %d %124s", &bda[0], &bda[1], &bda[2], &bda[3], &bda[4], &bda[5], &scan_rst->rssi, hex) != 8) {
+            return -1;
+        }
+        int const len = _hex2bin(hex, scan_rst->ble_adv, ESP_BLE_ADV_DATA_LEN_MAX);
+        if (len < 0) {
+            return -1;
+        }
+        for (uint ii = 0; ii < ESP_BD_ADDR_LEN; ii++) {
+            scan_rst->bda[ii] = bda[ii];
+        }
+        scan_rst->adv_data_len = len;
+
+        _pace(start, nr++, rate);
+        cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+    }
+    return nr;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+/*
+ * Simulated GAP event source.  Feeds ESP_GAP_BLE_SCAN_RESULT_EVT events to a GAP callback,
+ * either synthesized or replayed from a text file with one advertisement per line:
+ *
+ *   aa:bb:cc:dd:ee:ff -67 0201061aff4c000215fda50693a4e24fb1afcfc6eb07647825271bf206c5
+ *
+ * that is the address, RSSI and raw advertisement data in hex.  Lines starting with '#' are
+ * ignored.
+ */
+
+typedef struct simGap_cfg_t {
+    uint     count;     // advertisements to synthesize
+    uint     rate;      // advertisements per second, 0 is as fast as possible
+    uint     beacons;   // distinct beacons, each with its own address, major and minor
+    uint     otherPct;  // percentage of advertisements that are not iBeacons
+    uint32_t seed;
+} simGap_cfg_t;
+
+uint simGap_synth(simGap_cfg_t const * const cfg, esp_gap_ble_cb_t const cb);
+int simGap_replay(FILE * const f, uint const rate, esp_gap_ble_cb_t const cb);
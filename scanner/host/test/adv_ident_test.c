@@ -0,0 +1,91 @@
+/**
+ * @brief tests loading, storing and building the identities that ADV mode rotates through
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <sdkconfig.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "adv_ident.h"
+
+#define UUID "fda50693a4e24fb1afcfc6eb07647825"
+
+extern esp_ble_ibeacon_vendor_t vendor_config;
+
+static esp_err_t
+_load(char const * const text, bool const append)
+{
+    return advIdent_load(text, strlen(text), append);
+}
+
+static void
+_assertIdent(uint const nr, uint16_t const major, uint16_t const minor, int8_t const power)
+{
+    esp_ble_ibeacon_t const * const p = advIdent_payload(nr);
+    assert(memcmp(&p->ibeacon_head, &ibeacon_common_head, sizeof(ibeacon_common_head)) == 0);
+    assert(p->ibeacon_vendor.proximity_uuid[0] == 0xFD && p->ibeacon_vendor.proximity_uuid[15] == 0x25);
+    assert(ENDIAN_CHANGE_U16(p->ibeacon_vendor.major) == major);
+    assert(ENDIAN_CHANGE_U16(p->ibeacon_vendor.minor) == minor);
+    assert(p->ibeacon_vendor.measured_power == power);
+}
+
+int
+main(void)
+{
+    // nothing stored, the built-in identity
+    assert(advIdent_init() != ESP_OK);
+    assert(advIdent_count() == 1);
+    assert(memcmp(&advIdent_payload(0)->ibeacon_vendor, &vendor_config, sizeof(vendor_config)) == 0);
+
+    // replace, the power defaults to the built-in one, and the dashed notation works
+    assert(_load("uuid=" UUID " major=100 minor=1 power=-65; uuid=fda50693-a4e2-4fb1-afcf-c6eb07647825 major=100 minor=2", false) == ESP_OK);
+    assert(advIdent_count() == 2);
+    _assertIdent(0, 100, 1, -65);
+    _assertIdent(1, 100, 2, vendor_config.measured_power);
+    _assertIdent(2, 100, 1, -65);  // wraps around
+
+    // append
+    assert(_load("uuid=" UUID " minor=3 major=100\nuuid=" UUID " major=100 minor=4", true) == ESP_OK);
+    assert(advIdent_count() == 4);
+    _assertIdent(3, 100, 4, vendor_config.measured_power);
+
+    // nothing changes on error
+    assert(_load("uuid=" UUID " major=100", true) == ESP_ERR_INVALID_ARG);                     // no minor
+    assert(_load("uuid=" UUID " major=100 minor=65536", true) == ESP_ERR_INVALID_ARG);
+    assert(_load("uuid=" UUID " major=1 minor=1 power=3", true) == ESP_ERR_INVALID_ARG);
+    assert(_load("uuid=fda50693 major=1 minor=1", true) == ESP_ERR_INVALID_ARG);
+    assert(_load("uuid=" UUID " major=1 minor=1 txpower=-59", true) == ESP_ERR_INVALID_ARG);
+    assert(_load("uuid=00000000000000000000000000000000 major=1 minor=1", false) == ESP_ERR_INVALID_ARG);
+    assert(advIdent_count() == 4);
+    _assertIdent(0, 100, 1, -65);
+
+    char text[ADV_IDENT_MAX * 64] = "";
+    for (uint ii = 0; ii <= ADV_IDENT_MAX; ii++) {
+        snprintf(text + strlen(text), sizeof(text) - strlen(text), "uuid=" UUID " major=200 minor=%u; ", ii);
+    }
+    assert(_load(text, false) == ESP_ERR_INVALID_SIZE);
+    assert(advIdent_count() == 4);
+
+    // survives a restart
+    assert(advIdent_init() == ESP_OK);
+    assert(advIdent_count() == 4);
+    _assertIdent(2, 100, 3, vendor_config.measured_power);
+
+    // back to the built-in identity, also after a restart
+    assert(_load("clear", false) == ESP_OK);
+    assert(advIdent_count() == 1);
+    assert(advIdent_init() != ESP_OK && advIdent_count() == 1);
+    assert(memcmp(&advIdent_payload(0)->ibeacon_vendor, &vendor_config, sizeof(vendor_config)) == 0);
+
+    printf("adv_ident_test: ok\n");
+    return 0;
+}
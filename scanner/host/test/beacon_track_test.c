@@ -0,0 +1,100 @@
+/**
+ * @brief tests RSSI smoothing and change-triggered reporting per beacon
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <sdkconfig.h>
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+#include "beacon_tbl.h"
+#include "beacon_track.h"
+
+#define MSEC (1000LL)
+#define TXPWR (-59)
+
+static beaconTrack_t _tbl;
+
+static beaconKey_t
+_key(uint const nr)
+{
+    beaconKey_t key = { .bda = { 0x5A, 0x1D, 0x00, 0x00, nr >> 8, nr }, .major = 1, .minor = nr };
+    return key;
+}
+
+// feeds `cnt` advertisements 100 msec apart, alternating `rssi` +/- `noise`, returns how many were reported
+
+static uint
+_feed(beaconTrack_cfg_t const * const cfg, uint const nr, uint const cnt, int const rssi, int const noise, int64_t * const time, beaconTrack_est_t * const est)
+{
+    beaconKey_t const key = _key(nr);
+    uint reports = 0;
+    for (uint ii = 0; ii < cnt; ii++, *time += 100 * MSEC) {
+        reports += beaconTrack_update(&_tbl, cfg, &key, rssi + (ii & 1 ? noise : -noise), TXPWR, *time, est);
+    }
+    return reports;
+}
+
+static void
+_testFilter(beaconTrack_filter_t const filter)
+{
+    beaconTrack_cfg_t const cfg = { .filter = filter, .hystDb = 3, .silenceMs = 5000 };
+    beaconTrack_est_t est;
+    int64_t time = 0;
+    beaconTrack_init(&_tbl);
+
+    // reported when first seen, then quiet while the beacon stays put, but for the silence interval
+    assert(_feed(&cfg, 1, 1, -70, 0, &time, &est) == 1);
+    assert(_feed(&cfg, 1, 40, -70, 4, &time, &est) == 0);  // +/- 4 dB of noise, for 4 seconds
+    assert(fabsf(est.rssi + 70) < 3);
+    assert(_feed(&cfg, 1, 20, -70, 4, &time, &est) == 1);  // crosses 5 seconds
+
+    // a step of 10 dB closer is reported within a second, and only a few times
+    uint const reports = _feed(&cfg, 1, 10, -60, 0, &time, &est);
+    assert(reports >= 1 && reports <= 4);
+    assert(fabsf(est.rssi + 60) < 3);
+
+    // at the measured power, the beacon is 1 m away
+    assert(fabsf(est.distance - powf(10.0f, (TXPWR - est.rssi) / 20.0f)) < 0.01f);
+    _feed(&cfg, 1, 50, TXPWR, 0, &time, &est);
+    assert(fabsf(est.distance - 1.0f) < 0.1f);
+}
+
+int
+main(void)
+{
+    _testFilter(BEACON_TRACK_FILTER_ema);
+    _testFilter(BEACON_TRACK_FILTER_kalman);
+
+    // beacons are tracked independently, and the least recently seen is forgotten to make room
+    beaconTrack_cfg_t const cfg = { .filter = BEACON_TRACK_FILTER_ema, .hystDb = 3, .silenceMs = 60000 };
+    beaconTrack_est_t est;
+    int64_t time = 0;
+    beaconTrack_init(&_tbl);
+    for (uint nr = 0; nr < BEACON_TRACK_LEN; nr++) {
+        assert(_feed(&cfg, nr, 1, -70, 0, &time, &est) == 1);
+    }
+    assert(_tbl.used == BEACON_TRACK_LEN && _tbl.evictions == 0);
+    for (uint nr = 1; nr < BEACON_TRACK_LEN; nr++) {
+        assert(_feed(&cfg, nr, 1, -70, 0, &time, &est) == 0);
+    }
+    assert(_feed(&cfg, BEACON_TRACK_LEN, 1, -70, 0, &time, &est) == 1);  // takes the place of beacon 0
+    assert(_tbl.evictions == 1);
+    assert(_feed(&cfg, 1, 1, -70, 0, &time, &est) == 0);  // still tracked
+    assert(_feed(&cfg, 0, 1, -70, 0, &time, &est) == 1);  // forgotten, so reported as new
+
+    // no measured power, no distance
+    beaconKey_t const key = _key(1);
+    beaconTrack_update(&_tbl, &cfg, &key, -70, 0, time, &est);
+    assert(est.distance < 0);
+
+    printf("beacon_track_test: OK\n");
+    return 0;
+}
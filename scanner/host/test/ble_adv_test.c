@@ -0,0 +1,106 @@
+/**
+ * @brief tests the AD structure iterator and beacon recognizer against captured advertisements
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ble_adv.h"
+
+#define UUID 0xFD, 0xA5, 0x06, 0x93, 0xA4, 0xE2, 0x4F, 0xB1, 0xAF, 0xCF, 0xC6, 0xEB, 0x07, 0x64, 0x78, 0x25
+
+static uint8_t const _uuid[] = { UUID };
+
+// the only layout esp_ble_is_ibeacon_packet() accepts
+static uint8_t const _ibeacon[] = {
+    0x02, 0x01, 0x06,
+    0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, UUID, 0x27, 0xB7, 0xF2, 0x06, 0xC5,
+};
+
+// different flags, and a local name after the beacon
+static uint8_t const _ibeaconNamed[] = {
+    0x02, 0x01, 0x1A,
+    0x1A, 0xFF, 0x4C, 0x00, 0x02, 0x15, UUID, 0x00, 0x01, 0x00, 0x02, 0xBF,
+    0x05, 0x09, 'b', 'e', 'a', 'c',
+};
+
+// no flags, padded with zeros as in the GAP callback's buffer
+static uint8_t const _altbeacon[] = {
+    0x1B, 0xFF, 0x18, 0x01, 0xBE, 0xAC, UUID, 0x00, 0x03, 0x00, 0x04, 0xC3, 0x00,
+    0x00, 0x00, 0x00,
+};
+
+static uint8_t const _eddystoneUid[] = {
+    0x02, 0x01, 0x06,
+    0x03, 0x03, 0xAA, 0xFE,
+    0x17, 0x16, 0xAA, 0xFE, 0x00, 0xEE, UUID, 0x00, 0x00,
+};
+
+static uint8_t const _eddystoneUrl[] = {
+    0x03, 0x03, 0xAA, 0xFE,
+    0x0C, 0x16, 0xAA, 0xFE, 0x10, 0xEB, 0x03, 'v', 'o', 'n', 'k', 0x07, 0x00,
+};
+
+static uint8_t const _eddystoneTlm[] = {
+    0x11, 0x16, 0xAA, 0xFE, 0x20, 0x00, 0x0B, 0xB8, 0x17, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x01, 0x00,
+};
+
+// manufacturer data from another company, with iBeacon's length
+static uint8_t const _other[] = {
+    0x02, 0x01, 0x06,
+    0x1A, 0xFF, 0x59, 0x00, 0x02, 0x15, UUID, 0x00, 0x01, 0x00, 0x02, 0xBF,
+};
+
+int
+main(void)
+{
+    bleAdv_beacon_t b;
+    bleAdv_iter_t iter;
+    bleAdv_ad_t ad;
+
+    // iterator
+    bleAdv_iterInit(&iter, _ibeaconNamed, sizeof(_ibeaconNamed));
+    assert(bleAdv_next(&iter, &ad) && ad.type == BLE_ADV_TYPE_FLAGS && ad.len == 1 && ad.data == _ibeaconNamed + 2);
+    assert(bleAdv_next(&iter, &ad) && ad.type == BLE_ADV_TYPE_MANUFACTURER && ad.len == 25);
+    assert(bleAdv_next(&iter, &ad) && ad.type == 0x09 && ad.len == 4 && memcmp(ad.data, "beac", 4) == 0);
+    assert(!bleAdv_next(&iter, &ad));
+    assert(!bleAdv_next(&iter, &ad));
+
+    // a structure that runs past the end stops the walk
+    bleAdv_iterInit(&iter, _ibeacon, sizeof(_ibeacon) - 1);
+    assert(bleAdv_next(&iter, &ad) && ad.type == BLE_ADV_TYPE_FLAGS);
+    assert(!bleAdv_next(&iter, &ad));
+    assert(bleAdv_parseBeacon(_ibeacon, sizeof(_ibeacon) - 1, &b) == BLE_ADV_FMT_NONE);
+    assert(bleAdv_parseBeacon(_ibeacon, 0, &b) == BLE_ADV_FMT_NONE && b.fmt == BLE_ADV_FMT_NONE);
+
+    // formats
+    assert(bleAdv_parseBeacon(_ibeacon, sizeof(_ibeacon), &b) == BLE_ADV_FMT_IBEACON);
+    assert(b.id == _ibeacon + 9 && memcmp(b.id, _uuid, BLE_ADV_ID_LEN) == 0);
+    assert(b.major == 10167 && b.minor == 61958 && b.txPwr == -59 && b.company == 0x004C);
+
+    assert(bleAdv_parseBeacon(_ibeaconNamed, sizeof(_ibeaconNamed), &b) == BLE_ADV_FMT_IBEACON);
+    assert(b.major == 1 && b.minor == 2 && b.txPwr == -65);
+
+    assert(bleAdv_parseBeacon(_altbeacon, sizeof(_altbeacon), &b) == BLE_ADV_FMT_ALTBEACON);
+    assert(memcmp(b.id, _uuid, BLE_ADV_ID_LEN) == 0);
+    assert(b.major == 3 && b.minor == 4 && b.txPwr == -61 && b.company == 0x0118);
+
+    assert(bleAdv_parseBeacon(_eddystoneUid, sizeof(_eddystoneUid), &b) == BLE_ADV_FMT_EDDYSTONE_UID);
+    assert(memcmp(b.id, _uuid, BLE_ADV_ID_LEN) == 0);
+    assert(b.major == 0 && b.minor == 0 && b.txPwr == -18 - 41);
+
+    assert(bleAdv_parseBeacon(_eddystoneUrl, sizeof(_eddystoneUrl), &b) == BLE_ADV_FMT_EDDYSTONE_URL);
+    assert(b.id == NULL && b.txPwr == -21 - 41);
+
+    assert(bleAdv_parseBeacon(_eddystoneTlm, sizeof(_eddystoneTlm), &b) == BLE_ADV_FMT_EDDYSTONE_TLM);
+    assert(b.id == NULL);
+
+    assert(bleAdv_parseBeacon(_other, sizeof(_other), &b) == BLE_ADV_FMT_NONE);
+
+    assert(strcmp(bleAdv_fmtNames[BLE_ADV_FMT_EDDYSTONE_UID], "eddystoneUid") == 0);
+
+    printf("ble_adv_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @brief tests parsing "set" control messages
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <sdkconfig.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+#include "ctrl_set.h"
+
+static char _text[CONFIG_BLESCAN_IPC_TO_BLE_MSG_SIZE];
+
+static char const *
+_parse(char const * const text, ctrlSet_t * const set)
+{
+    snprintf(_text, sizeof(_text), "%s", text);
+    return ctrlSet_parse(_text, set);
+}
+
+int
+main(void)
+{
+    ctrlSet_t set;
+
+    // everything at once, the filter takes the rest
+    assert(_parse("set id=r-42 mode=scan int=100 window=60 fmt=both filter=deny bda=f0:08; allow major=1-9", &set) == NULL);
+    assert(strcmp(set.id, "r-42") == 0);
+    assert(strcmp(set.mode, "scan") == 0);
+    assert(set.intMs == 100 && set.windowMs == 60);
+    assert(set.scanFmt == (IPC_SCAN_FMT_JSON | IPC_SCAN_FMT_BIN));
+    assert(set.filterLen == strlen("deny bda=f0:08; allow major=1-9"));
+    assert(strncmp(set.filter, "deny bda=f0:08; allow major=1-9", set.filterLen) == 0);
+    assert(set.scanIntMs == 0 && !set.scanType && !set.policy && !set.dup && set.flushMs == -1);
+
+    // scan parameters, names are left to the caller
+    assert(_parse("set scan=passive scanint=200 window=30 policy=all dup=on flush=0", &set) == NULL);
+    assert(strcmp(set.scanType, "passive") == 0 && strcmp(set.policy, "all") == 0 && strcmp(set.dup, "on") == 0);
+    assert(set.scanIntMs == 200 && set.windowMs == 30 && set.flushMs == 0);
+    assert(_parse("set flush=5000", &set) == NULL && set.flushMs == 5000 && set.rotateMs == -1);
+    assert(_parse("set rotate=250", &set) == NULL && set.rotateMs == 250);
+    assert(_parse("set probe=time probeint=200", &set) == NULL && strcmp(set.probe, "time") == 0 && set.probeMs == 200);
+
+    // all optional, in any order, with extra spaces
+    assert(_parse("set", &set) == NULL && set.id[0] == '\0' && !set.mode && !set.intMs && !set.windowMs && !set.scanFmt && !set.filter);
+    assert(_parse("set  fmt=bin   id=7 ", &set) == NULL && set.scanFmt == IPC_SCAN_FMT_BIN && strcmp(set.id, "7") == 0 && !set.mode);
+    assert(_parse("set filter=", &set) == NULL && set.filter && set.filterLen == 0);  // clears the rules
+
+    // reports the key that doesn't parse
+    assert(strcmp(_parse("setting", &set), "set") == 0);
+    assert(strcmp(_parse("set id=12345678901234567", &set), "id") == 0);
+    assert(strcmp(_parse("set id=\"x\"", &set), "id") == 0);
+    assert(strcmp(_parse("set id=", &set), "id") == 0);
+    assert(strcmp(_parse("set mode=", &set), "mode") == 0);
+    assert(strcmp(_parse("set int=39", &set), "int") == 0);
+    assert(strcmp(_parse("set int=10241", &set), "int") == 0);
+    assert(strcmp(_parse("set int=100ms", &set), "int") == 0);
+    assert(strcmp(_parse("set window=2", &set), "window") == 0);
+    assert(strcmp(_parse("set fmt=xml", &set), "fmt") == 0);
+    assert(strcmp(_parse("set scanint=1", &set), "scanint") == 0);
+    assert(strcmp(_parse("set scan=", &set), "scan") == 0);
+    assert(strcmp(_parse("set policy=", &set), "policy") == 0);
+    assert(strcmp(_parse("set dup=", &set), "dup") == 0);
+    assert(strcmp(_parse("set flush=-1", &set), "flush") == 0);
+    assert(strcmp(_parse("set flush=3600001", &set), "flush") == 0);
+    assert(strcmp(_parse("set rotate=x", &set), "rotate") == 0);
+    assert(strcmp(_parse("set probeint=1", &set), "probeint") == 0);
+    assert(strcmp(_parse("set id=1 interval=100", &set), "key") == 0);
+    assert(strcmp(_parse("set id=1 mode", &set), "key") == 0);
+
+    // the ID is known for the acknowledgement, wherever the error is
+    assert(strcmp(_parse("set int=5 id=abc", &set), "int") == 0 && strcmp(set.id, "abc") == 0);
+    assert(strcmp(_parse("set bogus=1 fmt=xml id=r-7", &set), "key") == 0 && strcmp(set.id, "r-7") == 0);
+
+    // limits
+    assert(_parse("set int=40 window=3", &set) == NULL && set.intMs == 40 && set.windowMs == 3);
+    assert(_parse("set int=10240 window=10240", &set) == NULL && set.intMs == 10240 && set.windowMs == 10240);
+
+    printf("ctrl_set_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,195 @@
+/**
+ * @brief tests probe advertisements and the sequence gap and latency accounting
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <sdkconfig.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "histo.h"
+#include "probe.h"
+
+#define MSEC (1000LL)
+#define WALL (1666000000LL * 1000000LL)  // some Unix time [usec]
+
+static probe_t _tbl;
+static probe_report_t _reports[PROBE_LEN + 1];
+static uint _reportCnt;
+
+static void
+_emit(probe_report_t const * const report, void * const priv)
+{
+    assert(_reportCnt < ARRAY_SIZE(_reports));
+    _reports[_reportCnt] = *report;
+    _reports[_reportCnt].latency = NULL;  // only valid during the call
+    _reportCnt++;
+}
+
+static uint8_t const *
+_bda(uint const nr)
+{
+    static uint8_t bda[6] = { 0x5A, 0x1D, 0x00, 0x00 };
+    bda[4] = nr >> 8;
+    bda[5] = nr;
+    return bda;
+}
+
+// the advertisement as the advertiser builds it, received `latencyMs` later
+
+static void
+_rx(uint const nr, probe_mode_t const mode, uint16_t const seq, int64_t const txWall, int const latencyMs)
+{
+    esp_ble_ibeacon_t ident = {};
+    ident.ibeacon_vendor.major = ENDIAN_CHANGE_U16(7);
+    esp_ble_ibeacon_t payload;
+    probe_payload(&payload, &ident, mode, seq, txWall);
+    int64_t const rxWall = txWall < 0 ? -1 : txWall + latencyMs * MSEC;
+    probe_update(&_tbl, _bda(nr), ENDIAN_CHANGE_U16(payload.ibeacon_vendor.major), ENDIAN_CHANGE_U16(payload.ibeacon_vendor.minor),
+                 rxWall, rxWall);
+}
+
+static probe_report_t const *
+_flush(int64_t const time)
+{
+    _reportCnt = 0;
+    probe_flush(&_tbl, time);
+    return _reportCnt ? &_reports[0] : NULL;
+}
+
+static void
+_testPayload(void)
+{
+    esp_ble_ibeacon_t ident = {};
+    ident.ibeacon_vendor.major = ENDIAN_CHANGE_U16(7);
+    ident.ibeacon_vendor.minor = ENDIAN_CHANGE_U16(9);
+    ident.ibeacon_vendor.measured_power = -59;
+    esp_ble_ibeacon_t payload;
+
+    // the sequence number replaces the minor, the identity keeps its major and power
+    probe_payload(&payload, &ident, PROBE_MODE_seq, 0x8123, WALL);
+    assert(memcmp(payload.ibeacon_vendor.proximity_uuid, probe_uuid, sizeof(probe_uuid)) == 0);
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.major) == 7);
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.minor) == 0x0123);
+    assert(payload.ibeacon_vendor.measured_power == -59);
+
+    // the time goes in the major, once synced
+    probe_payload(&payload, &ident, PROBE_MODE_time, 5, WALL + 25 * MSEC);
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.major) == (uint16_t)((WALL + 25 * MSEC) / PROBE_TIME_UNIT_US));
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.minor) == (PROBE_FLAG_TIME | 5));
+    probe_payload(&payload, &ident, PROBE_MODE_time, 5, -1);
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.major) == 7);
+    assert(ENDIAN_CHANGE_U16(payload.ibeacon_vendor.minor) == 5);
+}
+
+static void
+_testGaps(void)
+{
+    probe_init(&_tbl, _emit, NULL, 0);
+
+    // 20 sequence numbers, 3 copies each, but for 4..6 and 10 that weren't heard
+    for (uint16_t seq = 0; seq < 20; seq++) {
+        for (uint copy = 0; copy < 3 && !(seq >= 4 && seq <= 6) && seq != 10; copy++) {
+            _rx(1, PROBE_MODE_seq, seq, -1, 0);
+        }
+    }
+    probe_report_t const * report = _flush(10000 * MSEC);
+    assert(report && _reportCnt == 1);
+    assert(memcmp(report->bda, _bda(1), sizeof(report->bda)) == 0);
+    assert(report->windowMs == 10000);
+    assert(report->rx == 16 && report->lost == 4 && report->gaps == 2 && report->maxGap == 3);
+    assert(report->copies == 32 && report->restarts == 0);
+
+    // gaps are counted across windows and across the wrap of the sequence number
+    _rx(1, PROBE_MODE_seq, 21, -1, 0);
+    _rx(1, PROBE_MODE_seq, 16000, -1, 0);
+    _rx(1, PROBE_MODE_seq, 32000, -1, 0);
+    _rx(1, PROBE_MODE_seq, PROBE_SEQ_MASK, -1, 0);
+    report = _flush(20000 * MSEC);
+    assert(report->rx == 4 && report->lost == 1 + 15978 + 15999 + 766 && report->gaps == 4 && report->restarts == 0);
+    _rx(1, PROBE_MODE_seq, 0, -1, 0);
+    _rx(1, PROBE_MODE_seq, 2, -1, 0);
+    report = _flush(30000 * MSEC);
+    assert(report->rx == 2 && report->lost == 1 && report->gaps == 1 && report->restarts == 0);
+
+    // going back is a restart, not a gap
+    _rx(1, PROBE_MODE_seq, 1000, -1, 0);
+    _rx(1, PROBE_MODE_seq, 3, -1, 0);
+    _rx(1, PROBE_MODE_seq, 4, -1, 0);
+    report = _flush(40000 * MSEC);
+    assert(report->rx == 3 && report->restarts == 1 && report->lost == 997);
+
+    // an advertiser not heard for a window is reported no more, and forgotten
+    assert(_flush(50000 * MSEC) == NULL);
+    assert(_flush(60000 * MSEC) == NULL);
+    _rx(1, PROBE_MODE_seq, 100, -1, 0);
+    report = _flush(70000 * MSEC);
+    assert(report->rx == 1 && report->lost == 0);
+}
+
+static void
+_testLatency(void)
+{
+    probe_init(&_tbl, _emit, NULL, 0);
+
+    // only the first copy counts, the time has 10 msec resolution, taken as the middle of the unit
+    for (uint16_t seq = 0; seq < 100; seq++) {
+        int64_t const tx = WALL + seq * 200 * MSEC + (seq % 10) * MSEC;
+        _rx(1, PROBE_MODE_time, seq, tx, 35);
+        _rx(1, PROBE_MODE_time, seq, tx, 75);
+    }
+    // .. also when the time in the major wraps between sending and receiving
+    int64_t const wrap = ((WALL / PROBE_TIME_UNIT_US) | 0xFFFF) * PROBE_TIME_UNIT_US;  // the last unit before the wrap
+    _rx(1, PROBE_MODE_time, 100, wrap, 35);
+
+    probe_update(&_tbl, _bda(1), 0, PROBE_FLAG_TIME | 101, 0, -1);  // not synced
+    histo_t const * const latency = &_tbl.latency[0];
+    assert(latency->cnt == 101);
+    assert(histo_percentile(latency, 50) >= 30 * MSEC && histo_percentile(latency, 50) <= 40 * MSEC * 9 / 8);
+    assert(latency->max >= 35 * MSEC && latency->max < 40 * MSEC);
+
+    // a receiver whose clock is behind
+    _rx(1, PROBE_MODE_time, 102, WALL, -50);
+
+    // a latency shorter than half a unit may come out negative, that's not a skewed clock
+    _rx(1, PROBE_MODE_time, 103, WALL, 2);
+    assert(latency->cnt == 102 && latency->max < 40 * MSEC);
+
+    probe_report_t const * const report = _flush(10000 * MSEC);
+    assert(report->skewed == 1 && report->rx == 104 && report->copies == 100 && report->restarts == 0);
+}
+
+static void
+_testEviction(void)
+{
+    probe_init(&_tbl, _emit, NULL, 0);
+
+    for (uint nr = 0; nr <= PROBE_LEN; nr++) {
+        probe_update(&_tbl, _bda(nr), 0, 1, nr * MSEC, -1);
+    }
+    assert(_tbl.evictions == 1);  // advertiser 0 made room
+    _flush(10000 * MSEC);
+    assert(_reportCnt == PROBE_LEN);
+    for (uint ii = 0; ii < _reportCnt; ii++) {
+        assert(memcmp(_reports[ii].bda, _bda(0), sizeof(_reports[ii].bda)) != 0);
+    }
+}
+
+int
+main(void)
+{
+    _testPayload();
+    _testGaps();
+    _testLatency();
+    _testEviction();
+
+    printf("probe_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @brief tests the allow/deny rules of the early-reject scan filter
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <sdkconfig.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_bt_defs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "scan_filter.h"
+
+static uint8_t const _uuidA[16] = { 0xfd, 0xa5, 0x06, 0x93, 0xa4, 0xe2, 0x4f, 0xb1, 0xaf, 0xcf, 0xc6, 0xeb, 0x07, 0x64, 0x78, 0x25 };
+static uint8_t const _uuidB[16] = { 0xe2, 0xc5, 0x6d, 0xb5, 0xdf, 0xfb, 0x48, 0xd2, 0xb0, 0x60, 0xd0, 0xf5, 0xa7, 0x10, 0x96, 0xe0 };
+
+static uint8_t const _bdaF008[ESP_BD_ADDR_LEN] = { 0xf0, 0x08, 0xd1, 0x00, 0x00, 0x01 };
+static uint8_t const _bdaF009[ESP_BD_ADDR_LEN] = { 0xf0, 0x09, 0xd1, 0x00, 0x00, 0x01 };
+
+static esp_err_t
+_load(char const * const text)
+{
+    return scanFilter_load(text, strlen(text));
+}
+
+static bool
+_accept(uint8_t const * const bda, uint8_t const * const uuid, uint16_t const major, uint16_t const minor)
+{
+    esp_ble_ibeacon_vendor_t vendor = {
+        .major = ENDIAN_CHANGE_U16(major),  // big endian, as in the advertisement
+        .minor = ENDIAN_CHANGE_U16(minor),
+        .measured_power = -59,
+    };
+    memcpy(vendor.proximity_uuid, uuid, sizeof(vendor.proximity_uuid));
+    return scanFilter_accept(bda, &vendor);
+}
+
+static char const *
+_describe(void)
+{
+    static char buf[512];
+    scanFilter_describe(buf, sizeof(buf));
+    return buf;
+}
+
+static void
+_testNoRules(void)
+{
+    assert(_load("clear") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));
+    assert(strstr(_describe(), "\"miss\": 0, \"reject\": 0, \"rules\": [ ] }"));  // not even counted
+}
+
+static void
+_testFirstMatch(void)
+{
+    // both match f0:08:d1:.., the first decides
+    assert(_load("deny bda=f0:08; allow bda=f0:08:d1") == ESP_OK);
+    assert(!_accept(_bdaF008, _uuidA, 1, 1));
+    assert(!_accept(_bdaF009, _uuidA, 1, 1));  // there is an allow rule, so no match rejects
+
+    assert(_load("allow bda=f0:08:d1; deny bda=f0:08") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));
+}
+
+static void
+_testRejectWhenAllowExists(void)
+{
+    assert(_load("deny major=7") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));  // only deny rules, no match accepts
+    assert(!_accept(_bdaF008, _uuidA, 7, 1));
+
+    assert(_load("deny major=7; allow uuid=fda50693a4e24fb1afcfc6eb07647825") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));
+    assert(!_accept(_bdaF008, _uuidB, 1, 1));
+    assert(!_accept(_bdaF008, _uuidA, 7, 1));
+}
+
+static void
+_testBdaPrefix(void)
+{
+    // the prefix is compared under a mask, whatever the length, with or without colons
+    assert(_load("allow bda=f0") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1) && _accept(_bdaF009, _uuidA, 1, 1));
+
+    assert(_load("allow bda=f008") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1) && !_accept(_bdaF009, _uuidA, 1, 1));
+
+    assert(_load("allow bda=f0:08:d1:00:00:01") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));
+    uint8_t const other[ESP_BD_ADDR_LEN] = { 0xf0, 0x08, 0xd1, 0x00, 0x00, 0x02 };
+    assert(!_accept(other, _uuidA, 1, 1));
+}
+
+static void
+_testUuid(void)
+{
+    assert(_load("allow uuid=fda50693-a4e2-4fb1-afcf-c6eb07647825") == ESP_OK);  // dashed
+    assert(_accept(_bdaF008, _uuidA, 1, 1) && !_accept(_bdaF008, _uuidB, 1, 1));
+    assert(strstr(_describe(), "\"rule\": \"allow uuid=fda50693a4e24fb1afcfc6eb07647825\""));
+
+    assert(_load("allow uuid=FDA50693A4E24FB1AFCFC6EB07647825") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 1, 1));
+}
+
+static void
+_testRanges(void)
+{
+    assert(_load("allow major=100-199 minor=5") == ESP_OK);
+    assert(!_accept(_bdaF008, _uuidA, 99, 5));
+    assert(_accept(_bdaF008, _uuidA, 100, 5));
+    assert(_accept(_bdaF008, _uuidA, 199, 5));
+    assert(!_accept(_bdaF008, _uuidA, 200, 5));
+    assert(!_accept(_bdaF008, _uuidA, 150, 6));
+    assert(strstr(_describe(), "\"rule\": \"allow major=100-199 minor=5-5\""));
+
+    assert(_load("allow major=0-65535") == ESP_OK);
+    assert(_accept(_bdaF008, _uuidA, 0, 1) && _accept(_bdaF008, _uuidA, 65535, 1));
+}
+
+static void
+_testBadRules(void)
+{
+    assert(_load("deny major=7") == ESP_OK);
+
+    // nothing changes when any rule can't be parsed
+    char const * const bad[] = {
+        "permit major=7",
+        "deny major=7; allow major=",
+        "allow major=9-8",
+        "allow major=65536",
+        "allow minor=1-x",
+        "allow uuid=fda50693a4e24fb1afcfc6eb076478",        // short
+        "allow uuid=fda50693a4e24fb1afcfc6eb0764782500",    // long
+        "allow uuid=fda50693a4e24fb1afcfc6eb0764782g",
+        "allow bda=",
+        "allow bda=f0:0",
+        "allow bda=f0:08:d1:00:00:01:02",
+        "allow rssi=-70",
+    };
+    for (uint ii = 0; ii < ARRAY_SIZE(bad); ii++) {
+        assert(_load(bad[ii]) != ESP_OK);
+        assert(strstr(_describe(), "\"rules\": [ { \"rule\": \"deny major=7-7\", \"hit\": 0 } ] }"));
+    }
+    assert(_accept(_bdaF008, _uuidA, 1, 1) && !_accept(_bdaF008, _uuidA, 7, 1));
+
+    // too many rules
+    char many[CONFIG_BLESCAN_FILTER_MAX_RULES * 16 + 16] = "";
+    for (uint ii = 0; ii <= CONFIG_BLESCAN_FILTER_MAX_RULES; ii++) {
+        snprintf(many + strlen(many), sizeof(many) - strlen(many), "deny minor=%u;", ii);
+    }
+    assert(_load(many) == ESP_ERR_INVALID_SIZE);
+    assert(!_accept(_bdaF008, _uuidA, 7, 1));
+}
+
+static void
+_testCounters(void)
+{
+    assert(_load("deny major=7; allow major=1-9") == ESP_OK);
+    assert(strstr(_describe(), "\"miss\": 0, \"reject\": 0,"));
+
+    assert(!_accept(_bdaF008, _uuidA, 7, 1));   // hit on the deny, rejected
+    assert(_accept(_bdaF008, _uuidA, 1, 1));    // hit on the allow
+    assert(_accept(_bdaF008, _uuidA, 2, 1));
+    assert(!_accept(_bdaF008, _uuidA, 10, 1));  // miss, rejected as there is an allow rule
+    assert(strstr(_describe(), "{ \"miss\": 1, \"reject\": 2, \"rules\": [ "
+                               "{ \"rule\": \"deny major=7-7\", \"hit\": 1 }, "
+                               "{ \"rule\": \"allow major=1-9\", \"hit\": 2 } ] }"));
+
+    // replacing the rules resets the counters
+    assert(_load("deny major=7") == ESP_OK);
+    assert(strstr(_describe(), "{ \"miss\": 0, \"reject\": 0, \"rules\": [ { \"rule\": \"deny major=7-7\", \"hit\": 0 } ] }"));
+    assert(_accept(_bdaF008, _uuidA, 10, 1));   // miss, accepted as there are only deny rules
+    assert(strstr(_describe(), "{ \"miss\": 1, \"reject\": 0,"));
+}
+
+int
+main(void)
+{
+    scanFilter_init();  // nothing stored yet, accepts everything
+
+    _testNoRules();
+    _testFirstMatch();
+    _testRejectWhenAllowExists();
+    _testBdaPrefix();
+    _testUuid();
+    _testRanges();
+    _testBadRules();
+    _testCounters();
+
+    printf("scan_filter_test: OK\n");
+    return 0;
+}
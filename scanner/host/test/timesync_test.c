@@ -0,0 +1,77 @@
+/**
+ * @brief tests converting esp_timer time to wall-clock time, and the drift estimate from successive syncs
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "timesync.h"
+
+#define SEC (1000000LL)
+#define WALL0 (1700000000LL * SEC)
+
+static bool
+_near(double const a, double const b)
+{
+    return fabs(a - b) < 0.01;
+}
+
+// the drift correction is truncated to whole usec
+static bool
+_nearUs(int64_t const a, int64_t const b)
+{
+    return llabs(a - b) <= 1;
+}
+
+int
+main(void)
+{
+    int64_t wall;
+    timeSync_stats_t stats;
+
+    // nothing to convert with before the first sync
+    assert(!timeSync_toWall(5 * SEC, &wall));
+    assert(!timeSync_toLocal(WALL0, &wall));
+    timeSync_stats(&stats);
+    assert(!stats.synced && stats.syncs == 0);
+
+    // first sync, no drift known yet
+    timeSync_update(10 * SEC, WALL0);
+    assert(timeSync_toWall(11 * SEC, &wall) && wall == WALL0 + SEC);
+    assert(timeSync_toWall(9 * SEC, &wall) && wall == WALL0 - SEC);  // before the sync
+    timeSync_stats(&stats);
+    assert(stats.synced && stats.syncs == 1 && stats.lastSync == 10 * SEC && stats.offsetUs == 0);
+
+    // 100 sec later the local clock is 10 msec slow, that's +100 ppm
+    timeSync_update(110 * SEC, WALL0 + 100 * SEC + 10000);
+    timeSync_stats(&stats);
+    assert(stats.syncs == 2 && stats.offsetUs == 10000 && _near(stats.driftPpm, 100));
+    assert(timeSync_toWall(120 * SEC, &wall) && _nearUs(wall, WALL0 + 110 * SEC + 10000 + 1000));
+    int64_t local;
+    assert(timeSync_toLocal(wall, &local) && _nearUs(local, 120 * SEC));
+
+    // +50 ppm over the next 100 sec, averaged with the earlier estimate
+    timeSync_update(210 * SEC, WALL0 + 200 * SEC + 10000 + 5000);
+    timeSync_stats(&stats);
+    assert(_nearUs(stats.offsetUs, -5000) && _near(stats.driftPpm, 75));
+
+    // too short an interval to tell drift from jitter, the estimate stays
+    timeSync_update(211 * SEC, WALL0 + 201 * SEC + 15000 + 200);
+    timeSync_stats(&stats);
+    assert(_nearUs(stats.offsetUs, 200 - 75) && _near(stats.driftPpm, 75));
+
+    // the server's clock was stepped, ignored for the estimate
+    timeSync_update(311 * SEC, WALL0 + 302 * SEC);
+    timeSync_stats(&stats);
+    assert(stats.syncs == 5 && _near(stats.driftPpm, 75));
+    assert(timeSync_toWall(311 * SEC, &wall) && wall == WALL0 + 302 * SEC);
+
+    printf("timesync_test: OK\n");
+    return 0;
+}
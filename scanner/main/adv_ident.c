@@ -0,0 +1,256 @@
+/**
+ * @brief adv_ident, table of iBeacon identities to advertise in turn
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "adv_ident.h"
+
+static char const * const TAG = "adv_ident";
+
+#define ADV_IDENT_NVS_KEY "ident"
+#define ADV_IDENT_VERSION (1)  // bump when advIdentTbl_t changes
+
+extern esp_ble_ibeacon_vendor_t vendor_config;
+
+// as stored in NVS, the payloads are rebuilt from it
+
+typedef struct advIdentTbl_t {
+    uint16_t                 version;
+    uint16_t                 cnt;
+    esp_ble_ibeacon_vendor_t ident[ADV_IDENT_MAX];
+} advIdentTbl_t;
+
+static struct {
+    advIdentTbl_t     tbl;
+    esp_ble_ibeacon_t payload[ADV_IDENT_MAX];  // what goes on the air, in advertisement order
+} _ident = {};
+
+static esp_err_t
+_build(advIdentTbl_t const * const tbl)
+{
+    static esp_ble_ibeacon_t payload[ADV_IDENT_MAX];  // so that nothing changes on error
+    for (uint ii = 0; ii < tbl->cnt; ii++) {
+        esp_ble_ibeacon_vendor_t vendor = tbl->ident[ii];
+        esp_err_t const err = esp_ble_config_ibeacon_data(&vendor, &payload[ii]);
+        if (err != ESP_OK) {
+            return err;  // a zero UUID
+        }
+    }
+    memcpy(_ident.payload, payload, tbl->cnt * sizeof(*payload));
+    _ident.tbl = *tbl;
+    return ESP_OK;
+}
+
+esp_err_t
+advIdent_init(void)
+{
+    static advIdentTbl_t tbl;  // too large for the stack
+    size_t len = sizeof(tbl);
+    nvs_handle_t nvs_handle;
+
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs_handle, ADV_IDENT_NVS_KEY, &tbl, &len);
+        nvs_close(nvs_handle);
+    }
+    if (err == ESP_OK && (len != sizeof(tbl) || tbl.version != ADV_IDENT_VERSION || tbl.cnt == 0 || tbl.cnt > ADV_IDENT_MAX)) {
+        ESP_LOGW(TAG, "ignoring stored identities");
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK && (err = _build(&tbl)) == ESP_OK) {
+        ESP_LOGI(TAG, "%u identities", tbl.cnt);
+        return ESP_OK;
+    }
+    tbl = (advIdentTbl_t) {
+        .version = ADV_IDENT_VERSION,
+        .cnt = 1,
+        .ident = { vendor_config },
+    };
+    _build(&tbl);
+    return err;
+}
+
+uint
+advIdent_count(void)
+{
+    return _ident.tbl.cnt;
+}
+
+esp_ble_ibeacon_t const *
+advIdent_payload(uint const nr)
+{
+    return &_ident.payload[nr % _ident.tbl.cnt];
+}
+
+/*
+ * Parses one identity:  uuid=HEX32 major=N minor=N [power=DBM]
+ * where the power is the measured RSSI at 1 m, as in the built-in identity when omitted.
+ */
+
+static bool
+_parseU16(char const * const str, uint16_t * const value)
+{
+    char * end;
+    unsigned long const n = strtoul(str, &end, 10);
+    if (end == str || *end || n > 0xFFFF) {
+        return false;
+    }
+    *value = n;
+    return true;
+}
+
+static bool
+_parseIdent(char * const text, esp_ble_ibeacon_vendor_t * const ident)
+{
+    bool hasUuid = false, hasMajor = false, hasMinor = false;
+    uint16_t major, minor;
+
+    *ident = (esp_ble_ibeacon_vendor_t) {
+        .measured_power = vendor_config.measured_power,
+    };
+    char * save;
+    for (char const * tok = strtok_r(text, " \t", &save); tok; tok = strtok_r(NULL, " \t", &save)) {
+        if (strncmp(tok, "uuid=", 5) == 0) {
+            char const * hex = tok + 5;
+            for (uint ii = 0; ii < sizeof(ident->proximity_uuid); ii++) {
+                if (*hex == '-') {
+                    hex++;  // allow the dashed notation
+                }
+                unsigned int byte;
+                if (!isxdigit((int)hex[0]) || !isxdigit((int)hex[1]) || sscanf(hex, "%2x", &byte) != 1) {
+                    return false;
+                }
+                ident->proximity_uuid[ii] = byte;
+                hex += 2;
+            }
+            if (*hex) {
+                return false;
+            }
+            hasUuid = true;
+        } else if (strncmp(tok, "major=", 6) == 0) {
+            hasMajor = _parseU16(tok + 6, &major);
+            if (!hasMajor) {
+                return false;
+            }
+        } else if (strncmp(tok, "minor=", 6) == 0) {
+            hasMinor = _parseU16(tok + 6, &minor);
+            if (!hasMinor) {
+                return false;
+            }
+        } else if (strncmp(tok, "power=", 6) == 0) {
+            char * end;
+            long const dbm = strtol(tok + 6, &end, 10);
+            if (end == tok + 6 || *end || dbm < INT8_MIN || dbm > 0) {
+                return false;
+            }
+            ident->measured_power = dbm;
+        } else {
+            return false;
+        }
+    }
+    if (!hasUuid || !hasMajor || !hasMinor) {
+        return false;
+    }
+    ident->major = ENDIAN_CHANGE_U16(major);
+    ident->minor = ENDIAN_CHANGE_U16(minor);
+    return true;
+}
+
+/*
+ * Replaces the identities with those in `text`, separated by ';' or newlines, or with
+ * `append` adds to them.  Nothing changes when an identity can't be parsed or they don't
+ * all fit.  An empty `text` or "clear" returns to the built-in identity.
+ */
+
+esp_err_t
+advIdent_load(char const * const text, size_t const text_len, bool const append)
+{
+    char * const copy = strndup(text, text_len);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    static advIdentTbl_t tbl;  // too large for the stack
+    tbl = (advIdentTbl_t) {
+        .version = ADV_IDENT_VERSION,
+    };
+    if (append) {
+        tbl = _ident.tbl;
+    }
+    esp_err_t err = ESP_OK;
+    char * save;
+    for (char * line = strtok_r(copy, ";\n", &save); line; line = strtok_r(NULL, ";\n", &save)) {
+        while (isspace((int)*line)) {
+            line++;
+        }
+        if (*line == '\0' || strcmp(line, "clear") == 0) {
+            continue;
+        }
+        if (tbl.cnt == ADV_IDENT_MAX) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if (!_parseIdent(line, &tbl.ident[tbl.cnt])) {
+            ESP_LOGW(TAG, "can't parse identity %u", tbl.cnt + 1);
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        tbl.cnt++;
+    }
+    free(copy);
+    if (err != ESP_OK) {
+        return err;
+    }
+    nvs_handle_t nvs_handle;
+    if (tbl.cnt == 0) {  // back to the built-in identity
+        if ((err = nvs_open("storage", NVS_READWRITE, &nvs_handle)) == ESP_OK) {
+            if ((err = nvs_erase_key(nvs_handle, ADV_IDENT_NVS_KEY)) == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND) {
+                err = nvs_commit(nvs_handle);
+            }
+            nvs_close(nvs_handle);
+        }
+        advIdent_init();  // can't find them, so falls back
+        return err;
+    }
+    if ((err = _build(&tbl)) != ESP_OK) {
+        return err;
+    }
+    if ((err = nvs_open("storage", NVS_READWRITE, &nvs_handle)) == ESP_OK) {
+        if ((err = nvs_set_blob(nvs_handle, ADV_IDENT_NVS_KEY, &tbl, sizeof(tbl))) == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "can't store identities (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
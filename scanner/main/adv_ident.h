@@ -0,0 +1,15 @@
+#pragma once
+
+/*
+ * Identities that ADV mode rotates through, so that one board stands in for many beacons.
+ * Each identity's advertisement is built once, when the table is loaded, so rotating only
+ * hands the controller another prebuilt payload.  The table is kept in NVS; without one,
+ * the single built-in `vendor_config` identity is advertised.  Relies on esp_ibeacon_api.h.
+ */
+
+#define ADV_IDENT_MAX (CONFIG_BLESCAN_ADV_IDENT_MAX)
+
+esp_err_t advIdent_init(void);
+uint advIdent_count(void);
+esp_ble_ibeacon_t const * advIdent_payload(uint const nr);
+esp_err_t advIdent_load(char const * const text, size_t const text_len, bool const append);
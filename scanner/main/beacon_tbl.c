@@ -0,0 +1,188 @@
+/**
+ * @brief bounded per-beacon aggregation table with windowed RSSI statistics
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+#include "beacon_tbl.h"
+
+#define MASK (BEACON_TBL_LEN - 1)
+_Static_assert((BEACON_TBL_LEN & MASK) == 0, "BLESCAN_SUMMARY_TABLE_LEN must be a power of 2");
+
+uint32_t
+beaconKey_hash(beaconKey_t const * const key)
+{
+    uint8_t const * const p = (uint8_t const *)key;
+    uint32_t hash = 2166136261U;  // FNV-1a
+    for (uint ii = 0; ii < sizeof(*key); ii++) {
+        hash = (hash ^ p[ii]) * 16777619U;
+    }
+    return hash ? hash : 1;
+}
+
+static bool
+_emit(beaconTbl_t const * const tbl, uint const ii)
+{
+    beaconSummary_t const summary = {
+        .key = tbl->key[ii],
+        .cnt = tbl->cnt[ii],
+        .rssiMin = tbl->rssiMin[ii],
+        .rssiMax = tbl->rssiMax[ii],
+        .rssiAvg = tbl->rssiSum[ii] / tbl->cnt[ii],
+        .txPwr = tbl->txPwr[ii],
+        .first = tbl->first[ii],
+        .last = tbl->last[ii],
+    };
+    return tbl->emit(&summary, tbl->priv);
+}
+
+static void
+_move(beaconTbl_t * const tbl, uint const dst, uint const src)
+{
+    tbl->hash[dst] = tbl->hash[src];
+    tbl->key[dst] = tbl->key[src];
+    tbl->cnt[dst] = tbl->cnt[src];
+    tbl->rssiMin[dst] = tbl->rssiMin[src];
+    tbl->rssiMax[dst] = tbl->rssiMax[src];
+    tbl->txPwr[dst] = tbl->txPwr[src];
+    tbl->rssiSum[dst] = tbl->rssiSum[src];
+    tbl->first[dst] = tbl->first[src];
+    tbl->last[dst] = tbl->last[src];
+}
+
+/*
+ * Backward-shift deletion, so linear probing needs no tombstones.  An entry further along the
+ * probe sequence moves into the hole, when the hole lies between its home slot and itself.
+ */
+
+static void
+_remove(beaconTbl_t * const tbl, uint hole)
+{
+    for (uint jj = (hole + 1) & MASK; tbl->hash[jj]; jj = (jj + 1) & MASK) {
+        uint const home = tbl->hash[jj] & MASK;
+        if (((jj - home) & MASK) >= ((jj - hole) & MASK)) {
+            _move(tbl, hole, jj);
+            hole = jj;
+        }
+    }
+    tbl->hash[hole] = 0;
+    tbl->used--;
+}
+
+static void
+_evictLru(beaconTbl_t * const tbl)
+{
+    uint lru = BEACON_TBL_LEN;
+    for (uint ii = 0; ii < BEACON_TBL_LEN; ii++) {
+        if (tbl->hash[ii] && (lru == BEACON_TBL_LEN || tbl->last[ii] < tbl->last[lru])) {
+            lru = ii;
+        }
+    }
+    if (!_emit(tbl, lru)) {
+        tbl->dropped++;  // there is no room to keep it
+    }
+    _remove(tbl, lru);
+    tbl->evictions++;
+}
+
+void
+beaconTbl_init(beaconTbl_t * const tbl, beaconTbl_emit_t const emit, void * const priv)
+{
+    memset(tbl->hash, 0, sizeof(tbl->hash));
+    tbl->used = 0;
+    tbl->evictions = 0;
+    tbl->dropped = 0;
+    tbl->emit = emit;
+    tbl->priv = priv;
+}
+
+void
+beaconTbl_update(beaconTbl_t * const tbl, beaconKey_t const * const key, int8_t const rssi, int8_t const txPwr, int64_t const time)
+{
+    uint32_t const hash = beaconKey_hash(key);
+    uint ii = hash & MASK;
+
+    for (; tbl->hash[ii]; ii = (ii + 1) & MASK) {
+        if (tbl->hash[ii] == hash && memcmp(&tbl->key[ii], key, sizeof(*key)) == 0) {
+            if (tbl->cnt[ii] == UINT16_MAX) {
+                break;  // don't let the sum overflow, start a new summary
+            }
+            tbl->cnt[ii]++;
+            tbl->rssiMin[ii] = MIN(tbl->rssiMin[ii], rssi);
+            tbl->rssiMax[ii] = MAX(tbl->rssiMax[ii], rssi);
+            tbl->rssiSum[ii] += rssi;
+            tbl->txPwr[ii] = txPwr;
+            tbl->last[ii] = time;
+            return;
+        }
+    }
+    if (tbl->hash[ii]) {  // counter saturated
+        if (!_emit(tbl, ii)) {
+            tbl->dropped++;
+        }
+        _remove(tbl, ii);
+        beaconTbl_update(tbl, key, rssi, txPwr, time);
+        return;
+    }
+    if (tbl->used >= BEACON_TBL_MAX_USED) {
+        _evictLru(tbl);
+        beaconTbl_update(tbl, key, rssi, txPwr, time);  // eviction may have shifted the probe sequence
+        return;
+    }
+    tbl->hash[ii] = hash;
+    tbl->key[ii] = *key;
+    tbl->cnt[ii] = 1;
+    tbl->rssiMin[ii] = rssi;
+    tbl->rssiMax[ii] = rssi;
+    tbl->rssiSum[ii] = rssi;
+    tbl->txPwr[ii] = txPwr;
+    tbl->first[ii] = time;
+    tbl->last[ii] = time;
+    tbl->used++;
+}
+
+/*
+ * Emits and removes the summary of each beacon first seen before `end`, the end of the window.
+ * Returns false when `emit` couldn't take one; the caller then calls again later with the same
+ * `end`, and the remaining summaries include what came in meanwhile.  Removal shifts entries
+ * back, possibly around the end of the table, so it keeps going until a pass finds nothing due.
+ */
+
+bool
+beaconTbl_flush(beaconTbl_t * const tbl, int64_t const end)
+{
+    for (bool removed = tbl->used; removed;) {
+        removed = false;
+        for (uint ii = 0; ii < BEACON_TBL_LEN; ii++) {
+            while (tbl->hash[ii] && tbl->first[ii] < end) {  // the entry shifted in is due as well
+                if (!_emit(tbl, ii)) {
+                    return false;
+                }
+                _remove(tbl, ii);
+                removed = true;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * Bounded per-beacon aggregation table.  Open addressing with linear probing, laid out as
+ * struct-of-arrays so that probing and LRU eviction only touch the arrays they need.
+ */
+
+#define BEACON_TBL_LEN (CONFIG_BLESCAN_SUMMARY_TABLE_LEN)
+#define BEACON_TBL_MAX_USED (BEACON_TBL_LEN * 3 / 4)  // keeps probe sequences short
+
+typedef struct beaconKey_t {
+    uint8_t  bda[6];
+    uint8_t  uuid[16];
+    uint16_t major;
+    uint16_t minor;
+} PACK8 beaconKey_t;
+
+typedef struct beaconSummary_t {
+    beaconKey_t key;
+    uint        cnt;      // advertisements received in this window
+    int8_t      rssiMin;
+    int8_t      rssiMax;
+    int8_t      rssiAvg;
+    int8_t      txPwr;
+    int64_t     first;    // [usec]
+    int64_t     last;     // [usec]
+} beaconSummary_t;
+
+// returns false when the summary couldn't be taken, at the end of a window it is offered again later
+
+typedef bool (* beaconTbl_emit_t)(beaconSummary_t const * const summary, void * const priv);
+
+typedef struct beaconTbl_t {
+    uint32_t    hash[BEACON_TBL_LEN];  // 0 marks an empty slot
+    beaconKey_t key[BEACON_TBL_LEN];
+    uint16_t    cnt[BEACON_TBL_LEN];
+    int8_t      rssiMin[BEACON_TBL_LEN];
+    int8_t      rssiMax[BEACON_TBL_LEN];
+    int8_t      txPwr[BEACON_TBL_LEN];
+    int32_t     rssiSum[BEACON_TBL_LEN];
+    int64_t     first[BEACON_TBL_LEN];
+    int64_t     last[BEACON_TBL_LEN];  // also used to find the least recently used entry
+    uint        used;
+    uint        evictions;             // entries emitted early to make room
+    uint        dropped;               // .. or because their count saturated, that `emit` couldn't take
+    beaconTbl_emit_t emit;
+    void *      priv;
+} beaconTbl_t;
+
+uint32_t beaconKey_hash(beaconKey_t const * const key);  // never 0
+void beaconTbl_init(beaconTbl_t * const tbl, beaconTbl_emit_t const emit, void * const priv);
+void beaconTbl_update(beaconTbl_t * const tbl, beaconKey_t const * const key, int8_t const rssi, int8_t const txPwr, int64_t const time);
+bool beaconTbl_flush(beaconTbl_t * const tbl, int64_t const end);
@@ -0,0 +1,133 @@
+/**
+ * @brief per-beacon RSSI smoothing and change-triggered reporting
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+#include "beacon_tbl.h"
+#include "beacon_track.h"
+
+char const * const beaconTrack_filterNames[BEACON_TRACK_FILTER_COUNT] = {
+#define XX(num, name) [num] = #name,
+  BEACON_TRACK_FILTER_MAP(XX)
+#undef XX
+};
+
+#define EMA_ALPHA (CONFIG_BLESCAN_TRACK_EMA_PCT / 100.0f)
+#define KALMAN_Q (CONFIG_BLESCAN_TRACK_KALMAN_Q / 100.0f)  // process noise, how fast the RSSI may wander [dB^2/s]
+#define KALMAN_R ((float)CONFIG_BLESCAN_TRACK_KALMAN_R)    // measurement noise [dB^2]
+#define PATH_LOSS (CONFIG_BLESCAN_TRACK_PATH_LOSS / 10.0f) // path loss exponent, 2 in free space
+
+static uint
+_find(beaconTrack_t const * const tbl, uint32_t const hash, beaconKey_t const * const key)
+{
+    for (uint ii = 0; ii < BEACON_TRACK_LEN; ii++) {
+        if (tbl->hash[ii] == hash && memcmp(&tbl->key[ii], key, sizeof(*key)) == 0) {
+            return ii;
+        }
+    }
+    return BEACON_TRACK_LEN;
+}
+
+// returns an empty slot, after forgetting the least recently seen beacon when there is none
+
+static uint
+_claim(beaconTrack_t * const tbl)
+{
+    uint lru = 0;
+    for (uint ii = 0; ii < BEACON_TRACK_LEN; ii++) {
+        if (tbl->hash[ii] == 0) {
+            return ii;
+        }
+        if (tbl->last[ii] < tbl->last[lru]) {
+            lru = ii;
+        }
+    }
+    tbl->evictions++;
+    tbl->used--;
+    return lru;
+}
+
+static void
+_filter(beaconTrack_t * const tbl, uint const ii, beaconTrack_filter_t const filter, int8_t const rssi, int64_t const time)
+{
+    switch (filter) {
+        case BEACON_TRACK_FILTER_ema:
+            tbl->rssi[ii] += EMA_ALPHA * (rssi - tbl->rssi[ii]);
+            break;
+        case BEACON_TRACK_FILTER_kalman: {
+            float const dt = (time - tbl->last[ii]) / 1e6f;
+            float const var = tbl->var[ii] + KALMAN_Q * dt;  // predict, the RSSI is expected to stay put
+            float const gain = var / (var + KALMAN_R);
+            tbl->rssi[ii] += gain * (rssi - tbl->rssi[ii]);
+            tbl->var[ii] = (1.0f - gain) * var;
+            break;
+        }
+        default:
+            tbl->rssi[ii] = rssi;
+            break;
+    }
+}
+
+void
+beaconTrack_init(beaconTrack_t * const tbl)
+{
+    memset(tbl->hash, 0, sizeof(tbl->hash));
+    tbl->used = 0;
+    tbl->evictions = 0;
+}
+
+// smooths `rssi` for the beacon, and returns true when the scan result should be reported
+
+bool
+beaconTrack_update(beaconTrack_t * const tbl, beaconTrack_cfg_t const * const cfg, beaconKey_t const * const key,
+                   int8_t const rssi, int8_t const txPwr, int64_t const time, beaconTrack_est_t * const est)
+{
+    uint32_t const hash = beaconKey_hash(key);
+    uint ii = _find(tbl, hash, key);
+    bool report;
+
+    if (ii == BEACON_TRACK_LEN) {  // first seen, or forgotten
+        ii = _claim(tbl);
+        tbl->hash[ii] = hash;
+        tbl->key[ii] = *key;
+        tbl->rssi[ii] = rssi;
+        tbl->var[ii] = KALMAN_R;
+        tbl->used++;
+        report = true;
+    } else {
+        _filter(tbl, ii, cfg->filter, rssi, time);
+        report = fabsf(tbl->rssi[ii] - tbl->reported[ii]) >= cfg->hystDb ||
+                 time - tbl->lastReport[ii] >= (int64_t)cfg->silenceMs * 1000;
+    }
+    tbl->last[ii] = time;
+    if (report) {
+        tbl->reported[ii] = tbl->rssi[ii];
+        tbl->lastReport[ii] = time;
+    }
+    est->rssi = tbl->rssi[ii];
+    est->distance = txPwr ? powf(10.0f, (txPwr - est->rssi) / (10.0f * PATH_LOSS)) : -1.0f;
+    return report;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * Per-beacon RSSI smoothing for change-triggered reporting.  Each beacon's RSSI is smoothed
+ * with an EMA or a 1-D Kalman filter, and a scan result is only reported when the smoothed
+ * value moved at least the hysteresis away from what was last reported, or when the beacon
+ * wasn't reported for the maximum silence interval.  Relies on beaconKey_t from beacon_tbl.h.
+ */
+
+#define BEACON_TRACK_LEN (CONFIG_BLESCAN_TRACK_TABLE_LEN)
+
+#define BEACON_TRACK_FILTER_MAP(XX) \
+  XX(0, off) \
+  XX(1, ema) \
+  XX(2, kalman)
+
+typedef enum beaconTrack_filter_t {
+#define XX(num, name) BEACON_TRACK_FILTER_##name = num,
+  BEACON_TRACK_FILTER_MAP(XX)
+#undef XX
+  BEACON_TRACK_FILTER_COUNT
+} beaconTrack_filter_t;
+
+extern char const * const beaconTrack_filterNames[BEACON_TRACK_FILTER_COUNT];
+
+typedef struct beaconTrack_cfg_t {
+    beaconTrack_filter_t filter;
+    uint                 hystDb;     // report when the smoothed RSSI moved this far from the last report [dB]
+    uint                 silenceMs;  // .. or when the beacon wasn't reported for this long [msec]
+} beaconTrack_cfg_t;
+
+typedef struct beaconTrack_est_t {
+    float rssi;      // smoothed [dBm]
+    float distance;  // from the measured power at 1 m [m], negative when the beacon doesn't advertise it
+} beaconTrack_est_t;
+
+// small enough for a linear scan over the hashes, so there is no probing to undo on eviction
+
+typedef struct beaconTrack_t {
+    uint32_t    hash[BEACON_TRACK_LEN];  // 0 marks an empty slot
+    beaconKey_t key[BEACON_TRACK_LEN];
+    float       rssi[BEACON_TRACK_LEN];      // filter state [dBm]
+    float       var[BEACON_TRACK_LEN];       // .. Kalman estimate variance [dB^2]
+    float       reported[BEACON_TRACK_LEN];  // smoothed RSSI at the last report [dBm]
+    int64_t     lastReport[BEACON_TRACK_LEN];
+    int64_t     last[BEACON_TRACK_LEN];      // also used to find the least recently used entry
+    uint        used;
+    uint        evictions;                   // beacons forgotten to make room
+} beaconTrack_t;
+
+void beaconTrack_init(beaconTrack_t * const tbl);
+bool beaconTrack_update(beaconTrack_t * const tbl, beaconTrack_cfg_t const * const cfg, beaconKey_t const * const key,
+                        int8_t const rssi, int8_t const txPwr, int64_t const time, beaconTrack_est_t * const est);
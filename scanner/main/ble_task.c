@@ -19,8 +19,11 @@
  */
 
 #include <sdkconfig.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <esp_bt.h>
 #include <esp_bt_defs.h>
 #include <esp_bt_device.h>
@@ -31,33 +34,64 @@
 #include <esp_gattc_api.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
 
 #include "esp_ibeacon_api.h"
 #include "ipc.h"
+#include "adv_ident.h"
+#include "ctrl_set.h"
+#include "devname.h"
+#include "histo.h"
+#include "probe.h"
+#include "scan_filter.h"
+#include "scan_task.h"
+#include "timesync.h"
 #include "ble_task.h"
 
 static char const * const TAG = "ble_task";
 static ipc_t * _ipc = NULL;
+static TaskHandle_t _bleTask = NULL;
+
+/*
+ * GAP commands complete asynchronously: the GAP callback notifies ble_task with the bit
+ * of the command that completed, or BLE_EVENT_FAILED.  A mode change is a plan of such
+ * steps that ble_task works through between control messages.  A step that fails or times
+ * out is retried, and when it keeps failing the plan is given up.  Parameters that the
+ * controller already has are not sent again.
+ */
+
+#define BLESTEP_MAP(XX) \
+  XX(0, SCAN_PARAMS) \
+  XX(1, SCAN_START) \
+  XX(2, SCAN_STOP) \
+  XX(3, ADV_DATA) \
+  XX(4, ADV_START) \
+  XX(5, ADV_STOP)
 
-static EventGroupHandle_t ble_event_group = NULL;
 typedef enum {
-	BLE_EVENT_SCAN_PARAM_SET_COMPLETE = BIT0,
-	BLE_EVENT_SCAN_START_COMPLETE = BIT1,
-	BLE_EVENT_SCAN_STOP_COMPLETE = BIT2,
-	BLE_EVENT_ADV_DATA_RAW_SET_COMPLETE = BIT3,
-	BLE_EVENT_ADV_START_COMPLETE = BIT4,
-	BLE_EVENT_ADV_STOP_COMPLETE = BIT5
-} bleEvent_t;
-
-// ESP32 can only do one function at a time (SCAN || ADVERTISE)
+#define XX(num, name) BLESTEP_##name = num,
+  BLESTEP_MAP(XX)
+#undef XX
+} bleStep_t;
+
+static const char * const _bleSteps[] = {
+#define XX(num, name) #name,
+  BLESTEP_MAP(XX)
+#undef XX
+};
+
+#define BLE_EVENT(step) (1UL << (step))  // notification bit for a completed step
+#define BLE_EVENT_FAILED (1UL << 31)
+
+// ESP32 can only do one function at a time (SCAN || ADVERTISE), MIX alternates between them
 #define BLEMODE_MAP(XX) \
   XX(0, IDLE) \
   XX(1, SCAN) \
-  XX(2, ADV)
+  XX(2, ADV) \
+  XX(3, MIX)
 
 typedef enum {
 #define XX(num, name) BLEMODE_##name = num,
@@ -71,72 +105,163 @@ static const char * const _bleModes[] = {
 #undef XX
 };
 
-extern esp_ble_ibeacon_vendor_t vendor_config;
+// names of the scan parameters, indexed by their ESP-IDF value
 
-void
-sendToBle(ipc_to_ble_typ_t const dataType, char const * const data, size_t const data_len, ipc_t const * const ipc)
-{
-    ipc_to_ble_msg_t msg = {
-        .dataType = dataType,
-        .data = strndup(data, data_len)
-    };
-    assert(msg.data);
-    if (xQueueSendToBack(ipc->toBleQ, &msg, 0) != pdPASS) {
-        ESP_LOGE(TAG, "toBleQ full");
-        free(msg.data);
-    }
-}
+static char const * const _scanTypes[] = {
+    [BLE_SCAN_TYPE_PASSIVE] = "passive",
+    [BLE_SCAN_TYPE_ACTIVE] = "active",
+};
 
-static char *
-_bda2str(uint8_t const * const bda, char * const str) {
+static char const * const _scanPolicies[] = {
+    [BLE_SCAN_FILTER_ALLOW_ALL] = "all",
+    [BLE_SCAN_FILTER_ALLOW_ONLY_WLST] = "wlist",
+    [BLE_SCAN_FILTER_ALLOW_UND_RPA_DIR] = "rpa",
+    [BLE_SCAN_FILTER_ALLOW_WLIST_RPA_DIR] = "wlist_rpa",
+};
 
-    for (uint ii = 0, len = 0; ii < ESP_BD_ADDR_LEN; ii++) {
-        len += sprintf(str + len, "%02x", bda[ii]);
-        if (ii < ESP_BD_ADDR_LEN - 1) {
-            str[len++] = ':';
-        }
-    }
-    return str;
-}
+static char const * const _scanDups[] = {
+    [BLE_SCAN_DUPLICATE_DISABLE] = "off",
+    [BLE_SCAN_DUPLICATE_ENABLE] = "on",
+};
+
+/*
+ * In MIX mode, ble_task itself switches the radio between ADV and SCAN slots.  A cycle is
+ * one ADV slot followed by one SCAN slot, each randomly lengthened or shortened by up to the
+ * jitter, so that nodes that started in step drift apart and get to hear each other.
+ */
+
+static struct {
+    bleMode_t mode;        // as requested by control messages
+    bleMode_t radio;       // what the radio is doing, ADV or SCAN during a MIX slot
+    int64_t   since;       // when the time in that mode was last accounted for [usec]
+    uint16_t  advIntMax;   // requested advertisement interval [n * 0.625 msec]
+    uint16_t  advIntSet;   // .. as the radio advertises with, 0 if never
+    struct {
+        uint    cur;        // identity to advertise, see adv_ident.h
+        int     set;        // .. the one the controller has, -1 if none
+        uint    rotateMs;   // advertise each identity this long [msec], 0 sticks to one
+        int64_t rotateAt;   // [usec]
+        uint    rotations;
+    } ident;
+    struct {
+        uint8_t  mode;      // probe_mode_t
+        uint     periodMs;  // advertise each sequence number this long [msec]
+        uint16_t seq;       // next sequence number to advertise
+        int64_t  nextAt;    // [usec]
+    } probe;
+    struct {
+        uint8_t  type;      // esp_ble_scan_type_t
+        uint8_t  policy;    // esp_ble_scan_filter_t
+        uint8_t  dup;       // esp_ble_scan_duplicate_t
+        uint16_t window;    // [n * 0.625 msec], 0 follows the advertisement interval
+        uint16_t interval;  // [n * 0.625 msec], 0 is the window plus 20 msec
+        uint     flushMs;   // with duplicate filtering, restart scanning this often [msec], 0 never
+        int64_t  flushAt;   // [usec]
+        bool     flush;     // the next plan restarts scanning, even when the parameters didn't change
+        uint     flushes;
+    } scan;
+    esp_ble_scan_params_t scanSet;  // what the controller has, scan_window 0 if never
+    struct {
+        uint    cycleMs;   // ADV slot plus SCAN slot [msec]
+        uint    advPct;    // share of the cycle spent advertising [%]
+        uint    jitterMs;  // [msec]
+        int     slotMs;    // length of the slot being switched to [msec]
+        int64_t slotEnd;   // [usec]
+    } mix;
+} _ble = {
+    .mode = BLEMODE_IDLE,
+    .radio = BLEMODE_IDLE,
+    .advIntMax = (40 << 4) / 10,  // 40 msec
+    .ident = {
+        .set = -1,
+        .rotateMs = CONFIG_BLESCAN_ADV_ROTATE_MSEC,
+    },
+    .probe = {
+        .mode = PROBE_MODE_off,
+        .periodMs = CONFIG_BLESCAN_PROBE_PERIOD_MSEC,
+    },
+    .scan = {
+#ifdef CONFIG_BLESCAN_SCAN_PASSIVE
+        .type = BLE_SCAN_TYPE_PASSIVE,
+#else
+        .type = BLE_SCAN_TYPE_ACTIVE,
+#endif
+        .policy = BLE_SCAN_FILTER_ALLOW_ALL,
+#ifdef CONFIG_BLESCAN_SCAN_DUPLICATES
+        .dup = BLE_SCAN_DUPLICATE_ENABLE,
+#else
+        .dup = BLE_SCAN_DUPLICATE_DISABLE,
+#endif
+        .interval = (CONFIG_BLESCAN_SCAN_INTERVAL_MSEC << 4) / 10,
+        .flushMs = CONFIG_BLESCAN_SCAN_DUP_FLUSH_MSEC,
+    },
+    .mix = {
+        .cycleMs = CONFIG_BLESCAN_MIX_CYCLE_MSEC,
+        .advPct = CONFIG_BLESCAN_MIX_ADV_PCT,
+        .jitterMs = CONFIG_BLESCAN_MIX_JITTER_MSEC,
+    },
+};
+
+static struct {
+    bleStep_t step[4];
+    uint      cnt;       // 0 when idle
+    uint      cur;
+    uint      tries;     // of the current step
+    int64_t   deadline;  // for the current step [usec]
+    int64_t   start;     // [usec]
+    bool      fromRadio; // the plan stops what the radio was doing, rather than only changing its data
+    bool      respond;   // a control message waits for the outcome
+} _plan = {};
+
+/*
+ * "at T CMD" runs CMD at Unix time T [msec], so that a fleet switches in step.  T is
+ * converted to esp_timer time using the SNTP sync, and a one-shot esp_timer hands the
+ * command back to ble_task through its queue, which wakes it right away.  ble_task also waits
+ * for T itself, so the command still runs when the queue was full.  The message carries the
+ * generation of the command it was sent for, so that one still queued from a replaced command
+ * doesn't run the new one early.  Only commands that ble_task runs itself are accepted, those
+ * handled by mqtt_task would never reach it.
+ */
+
+#define BLE_AT_ECHO_LEN (32)  // of CMD in the response while pending
+
+static struct {
+    esp_timer_handle_t timer;
+    int64_t            time;     // requested Unix time [msec]
+    int64_t            local;    // .. as esp_timer_get_time() [usec]
+    _Atomic uint       gen;      // bumped for each new command, the due message must match
+    bool               pending;
+    bool               report;   // the next response reports how late CMD started
+    int                errUs;    // [usec], negative when early
+    char               cmd[CONFIG_BLESCAN_IPC_TO_BLE_MSG_SIZE];
+} _at = {};
+
+/*
+ * The GAP callback rate with the current scan parameters, and with those before, is reported
+ * in each response, so that the effect of changing one shows.  The rate is per second spent
+ * scanning, so MIX's duty cycle doesn't skew it.
+ */
+
+static struct {
+    uint     advRx;   // _ipc->dev.count.advRx when the scan parameters last changed
+    uint64_t scanUs;  // _ipc->dev.radio.scanUs ..
+    int      before;  // GAP callbacks per second with the scan parameters before, -1 if unknown
+} _rate = {
+    .before = -1,
+};
+
+// a "set" control message waits for its acknowledgement, see ctrl_set.h
+
+static struct {
+    bool    pending;
+    int64_t start;  // when it was received [usec]
+    char    id[CTRL_SET_ID_LEN + 1];
+} _set = {};
 
 static void
-_bda2devName(uint8_t const * const bda, char * const name, size_t name_len) {
-	typedef struct {
-		uint8_t const bda[ESP_BD_ADDR_LEN];
-		char const * const name;
-	} PACK8 knownBrd_t;
-	static knownBrd_t knownBrds[] = {
-        { {0x30, 0xAE, 0xA4, 0xCC, 0x24, 0x6A}, "esp32-1" },
-        { {0x30, 0xAE, 0xA4, 0xCC, 0x32, 0x4E}, "esp32-2" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x82, 0x8A}, "esp32-3" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x7F, 0x22}, "esp32-4" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0x82}, "esp32-5" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0xAA}, "esp32-6" },
-        { {0x24, 0x0A, 0xC4, 0xEB, 0x36, 0x8A}, "esp32-7" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x93, 0x1E}, "esp32-8" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0xB2}, "esp32-9" },
-        { {0xAC, 0x67, 0xB2, 0x53, 0x7B, 0x3A}, "esp32-10" },
-        { {0x8c, 0xaa, 0xb5, 0x85, 0x0a, 0x7e}, "esp32-11" },
-        { {0x8c, 0xaa, 0xb5, 0x86, 0x2b, 0xa2}, "esp32-12" },
-        { {0x8c, 0xaa, 0xb5, 0x86, 0x22, 0xc2}, "esp32-13" },
-        { {0x8c, 0xaa, 0xb5, 0x85, 0x43, 0x42}, "esp32-14" },
-        { {0x8c, 0xaa, 0xb5, 0x85, 0x6d, 0x06}, "esp32-15" },
-        { {0x8c, 0xaa, 0xb5, 0x85, 0x05, 0xf2}, "esp32-16" },
-        { {0x8c, 0xaa, 0xb5, 0x84, 0xe9, 0x76}, "esp32-17" },
-        { {0x8c, 0xaa, 0xb5, 0x86, 0x2d, 0x5a}, "esp32-18" },
-        { {0x8c, 0xaa, 0xb5, 0x84, 0xec, 0xc6}, "esp32-19" },
-        { {0x8c, 0xaa, 0xb5, 0x86, 0x08, 0x46}, "esp32-20" },
-        { {0x30, 0xae, 0xa4, 0xcc, 0x45, 0x06}, "esp32-wrover-1" },
-        { {0x30, 0xae, 0xa4, 0xcc, 0x42, 0x7a}, "esp32-wrover-2" }
-	};
-	for (uint ii=0; ii < ARRAY_SIZE(knownBrds); ii++) {
-		if (memcmp(bda, knownBrds[ii].bda, ESP_BD_ADDR_LEN) == 0) {
-			strncpy(name, knownBrds[ii].name, name_len);
-			return;
-		}
-	}
-	snprintf(name, name_len, "esp32_%02x%02x",
-			 bda[ESP_BD_ADDR_LEN-2], bda[ESP_BD_ADDR_LEN-1]);
+_notify(uint32_t const bits)
+{
+    xTaskNotify(_bleTask, bits, eSetBits);
 }
 
 static void
@@ -147,67 +272,48 @@ _bleGapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param) {
 	switch (event) {
         case ESP_GAP_BLE_ADV_START_COMPLETE_EVT:
             if ((err = param->adv_start_cmpl.status) == ESP_BT_STATUS_SUCCESS) {
-                xEventGroupSetBits(ble_event_group, BLE_EVENT_ADV_START_COMPLETE);
+                _notify(BLE_EVENT(BLESTEP_ADV_START));
             } else {
                 ESP_LOGE(TAG, "Adv start failed: %s", esp_err_to_name(err));
+                _notify(BLE_EVENT_FAILED);
             }
             break;
         case ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT:
-            xEventGroupSetBits(ble_event_group, BLE_EVENT_ADV_DATA_RAW_SET_COMPLETE);
+            _notify(BLE_EVENT(BLESTEP_ADV_DATA));
             break;
         case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
             if ((err = param->adv_stop_cmpl.status) == ESP_BT_STATUS_SUCCESS) {
-                xEventGroupSetBits(ble_event_group, BLE_EVENT_ADV_STOP_COMPLETE);
+                _notify(BLE_EVENT(BLESTEP_ADV_STOP));
             } else {
                 ESP_LOGE(TAG, "Adv stop failed: %s", esp_err_to_name(err));
+                _notify(BLE_EVENT_FAILED);
             }
             break;
 
         case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
-            xEventGroupSetBits(ble_event_group, BLE_EVENT_SCAN_PARAM_SET_COMPLETE);
+            _notify(BLE_EVENT(BLESTEP_SCAN_PARAMS));
             break;
         case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
             if ((err = param->scan_start_cmpl.status) == ESP_BT_STATUS_SUCCESS) {
-                xEventGroupSetBits(ble_event_group, BLE_EVENT_SCAN_START_COMPLETE);
+                _notify(BLE_EVENT(BLESTEP_SCAN_START));
             } else {
                 ESP_LOGE(TAG, "Scan start failed: %s", esp_err_to_name(err));
+                _notify(BLE_EVENT_FAILED);
             }
             break;
         case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
             if ((err = param->scan_stop_cmpl.status) == ESP_BT_STATUS_SUCCESS) {
-                xEventGroupSetBits(ble_event_group, BLE_EVENT_SCAN_STOP_COMPLETE);
+                _notify(BLE_EVENT(BLESTEP_SCAN_STOP));
             } else {
                 ESP_LOGE(TAG, "Scan stop failed: %s", esp_err_to_name(err));
+                _notify(BLE_EVENT_FAILED);
             }
             break;
 
-        case ESP_GAP_BLE_SCAN_RESULT_EVT: {
-            esp_ble_gap_cb_param_t * const scan_result = (esp_ble_gap_cb_param_t *)param;
-
-            if (scan_result->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT &&
-                esp_ble_is_ibeacon_packet(scan_result->scan_rst.ble_adv, scan_result->scan_rst.adv_data_len)) {
-
-                // format iBeacon scan result as JSON
-
-                esp_ble_ibeacon_t const * const ibeacon_data = (esp_ble_ibeacon_t *)(scan_result->scan_rst.ble_adv);
-
-                uint len = 0;
-                char payload[256];
-                char devName[BLE_DEVNAME_LEN];
-                _bda2devName(scan_result->scan_rst.bda, devName, BLE_DEVNAME_LEN);
-
-                len += sprintf(payload + len, "{ \"name\": \"%s\"", devName);
-
-                len += sprintf(payload + len, ", \"address\": \"");
-                for (uint ii = 0; ii < ESP_BD_ADDR_LEN; ii++) {
-                    len += sprintf(payload + len, "%02x%c", scan_result->scan_rst.bda[ii], (ii < ESP_BD_ADDR_LEN - 1) ? ':' : '"');
-                }
-                len += sprintf(payload + len, ", \"txPwr\": %d", ibeacon_data->ibeacon_vendor.measured_power);
-                len += sprintf(payload + len, ", \"RSSI\": %d }", scan_result->scan_rst.rssi);
+        case ESP_GAP_BLE_SCAN_RESULT_EVT:
+            sendToScan(param, _ipc);  // hands a raw copy to scan_task
+            break;
 
-                sendToMqtt(IPC_TO_MQTT_MSGTYPE_SCAN, payload, _ipc);
-            }
-        }
         default:
             break;
 	}
@@ -222,81 +328,74 @@ _initIbeacon(void) {
 }
 
 static void
-_bleStartScan(uint16_t const scan_window) {
-
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_SCAN_PARAM_SET_COMPLETE);
-	{
-        static esp_ble_scan_params_t ble_scan_params = {
-            .scan_type = BLE_SCAN_TYPE_ACTIVE,
-            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-            .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
-            .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE
-        };
-        ble_scan_params.scan_interval = scan_window + 0x20; // time between start of scans [n * 0.625 msec]
-        ble_scan_params.scan_window = scan_window;          // scan duration               [n * 0.625 msec]
-		ESP_ERROR_CHECK(esp_ble_gap_set_scan_params(&ble_scan_params));
-	}
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_SCAN_PARAM_SET_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_SCAN_START_COMPLETE);
-    {
-        uint32_t duration = 0;  // [sec], 0 means scan permanently
-        ESP_ERROR_CHECK(esp_ble_gap_start_scanning(duration));
-    }
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_SCAN_START_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-	//ESP_LOGI(TAG, "STARTED scanning");
-}
-
-static void
-_bleStopScan(void) {
-
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_SCAN_STOP_COMPLETE);
-    {
-        ESP_ERROR_CHECK(esp_ble_gap_stop_scanning());
-    }
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_SCAN_STOP_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-	//ESP_LOGI(TAG, "STOPPED scanning");
+_scanParams(esp_ble_scan_params_t * const params)
+{
+    uint16_t const window = _ble.scan.window ?: _ble.advIntMax + 0x04;
+    *params = (esp_ble_scan_params_t) {
+        .scan_type = _ble.scan.type,
+        .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+        .scan_filter_policy = _ble.scan.policy,
+        .scan_window = window,                                          // scan duration               [n * 0.625 msec]
+        .scan_interval = MAX(_ble.scan.interval ?: window + 0x20, window),  // time between start of scans [n * 0.625 msec]
+        .scan_duplicate = _ble.scan.dup,
+    };
 }
 
-static void
-_bleStartAdv(uint16_t const adv_int_max) {
-
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_ADV_DATA_RAW_SET_COMPLETE);
-	{
-		esp_ble_ibeacon_t ibeacon_adv_data;
-		ESP_ERROR_CHECK(esp_ble_config_ibeacon_data(&vendor_config, &ibeacon_adv_data));
-        ESP_ERROR_CHECK(esp_ble_gap_config_adv_data_raw((uint8_t *) &ibeacon_adv_data, sizeof(ibeacon_adv_data)));
-	}
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_ADV_DATA_RAW_SET_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_ADV_START_COMPLETE);
-    {
-        static esp_ble_adv_params_t ble_adv_params = {
-            .adv_type = ADV_TYPE_NONCONN_IND,
-            .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
-            .channel_map = ADV_CHNL_ALL,
-            .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
-        };
-
-        ble_adv_params.adv_int_min = adv_int_max >> 1; // minimum advertisement interval [n * 0.625 msec]
-        ble_adv_params.adv_int_max = adv_int_max;      // maximim advertisement interval [n * 0.625 msec]
-        ESP_LOGI(TAG, "%s adv_int: 0x%04X .. 0x%04X", __FUNCTION__, ble_adv_params.adv_int_min, ble_adv_params.adv_int_max);
+static bool
+_scanStale(void)
+{
+    esp_ble_scan_params_t want;
+    _scanParams(&want);
+    esp_ble_scan_params_t const * const set = &_ble.scanSet;
 
-        ESP_ERROR_CHECK(esp_ble_gap_start_advertising(&ble_adv_params));
-    }
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_ADV_START_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-	ESP_LOGI(TAG, "STARTED advertising");
+    return want.scan_type != set->scan_type || want.scan_filter_policy != set->scan_filter_policy ||
+           want.scan_window != set->scan_window || want.scan_interval != set->scan_interval ||
+           want.scan_duplicate != set->scan_duplicate;
 }
 
-static void
-_bleStopAdv(void) {
+// hands a step to the GAP, its completion arrives as a notification
 
-	xEventGroupClearBits(ble_event_group, BLE_EVENT_ADV_STOP_COMPLETE);
-    {
-        ESP_ERROR_CHECK(esp_ble_gap_stop_advertising());
+static esp_err_t
+_issue(bleStep_t const step)
+{
+    switch (step) {
+        case BLESTEP_SCAN_PARAMS: {
+            static esp_ble_scan_params_t ble_scan_params;
+            _scanParams(&ble_scan_params);
+            return esp_ble_gap_set_scan_params(&ble_scan_params);
+        }
+        case BLESTEP_SCAN_START: {
+            uint32_t duration = 0;  // [sec], 0 means scan permanently
+            return esp_ble_gap_start_scanning(duration);
+        }
+        case BLESTEP_SCAN_STOP:
+            return esp_ble_gap_stop_scanning();
+        case BLESTEP_ADV_DATA:  // prebuilt, the GAP makes its own copy
+            if (_ble.probe.mode != PROBE_MODE_off) {  // stamped as late as possible
+                static esp_ble_ibeacon_t payload;
+                int64_t wall;
+                if (!timeSync_toWall(esp_timer_get_time(), &wall)) {
+                    wall = -1;
+                }
+                probe_payload(&payload, advIdent_payload(_ble.ident.cur), _ble.probe.mode, _ble.probe.seq, wall);
+                return esp_ble_gap_config_adv_data_raw((uint8_t *) &payload, sizeof(payload));
+            }
+            return esp_ble_gap_config_adv_data_raw((uint8_t *) advIdent_payload(_ble.ident.cur), sizeof(esp_ble_ibeacon_t));
+        case BLESTEP_ADV_START: {
+            static esp_ble_adv_params_t ble_adv_params = {
+                .adv_type = ADV_TYPE_NONCONN_IND,
+                .own_addr_type = BLE_ADDR_TYPE_PUBLIC,
+                .channel_map = ADV_CHNL_ALL,
+                .adv_filter_policy = ADV_FILTER_ALLOW_SCAN_ANY_CON_ANY,
+            };
+            ble_adv_params.adv_int_min = _ble.advIntMax >> 1; // minimum advertisement interval [n * 0.625 msec]
+            ble_adv_params.adv_int_max = _ble.advIntMax;      // maximim advertisement interval [n * 0.625 msec]
+            return esp_ble_gap_start_advertising(&ble_adv_params);
+        }
+        case BLESTEP_ADV_STOP:
+            return esp_ble_gap_stop_advertising();
     }
-	xEventGroupWaitBits(ble_event_group, BLE_EVENT_ADV_STOP_COMPLETE, pdFALSE, pdFALSE, portMAX_DELAY);
-	ESP_LOGI(TAG, "STOPPED advertising");
+    return ESP_ERR_INVALID_ARG;
 }
 
 static int
@@ -305,6 +404,17 @@ _bleMode_nr(char const * const bleMode_str)
     ELEM_POS(_bleModes, bleMode_str);
 }
 
+static int
+_name_nr(char const * const names[], uint const names_len, char const * const name)
+{
+    for (uint ii = 0; ii < names_len; ii++) {
+        if (names[ii] && strcasecmp(name, names[ii]) == 0) {
+            return ii;
+        }
+    }
+    return -1;
+}
+
 const char *
 _bleMode_str(bleMode_t const blemode)
 {
@@ -325,29 +435,586 @@ _splitArgs(char * data, char * args[], uint const args_len) {
     return ii;
 }
 
-static bleMode_t
-_changeBleMode(bleMode_t const current, bleMode_t const new, uint16_t const adv_int_max) 
+// adds the time since the last call to the current radio mode
+
+static void
+_accountRadio(int64_t const now)
+{
+    ipc_radio_t * const radio = &_ipc->dev.radio;
+
+    switch (_ble.radio) {
+        case BLEMODE_SCAN: radio->scanUs += now - _ble.since; break;
+        case BLEMODE_ADV: radio->advUs += now - _ble.since; break;
+        default: break;
+    }
+    _ble.since = now;
+}
+
+// GAP callbacks per second spent scanning since the scan parameters last changed, -1 if unknown
+
+static int
+_cbRate(void)
+{
+    uint64_t const us = _ipc->dev.radio.scanUs - _rate.scanUs;
+    return us ? (int)((uint64_t)(_ipc->dev.count.advRx - _rate.advRx) * 1000000 / us) : -1;
+}
+
+// appends to `buf` without going past `size`; once truncated, `*len` stays at the end of the text
+
+static void
+_append(char * const buf, size_t const size, int * const len, char const * const fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int const n = vsnprintf(buf + *len, size - *len, fmt, args);
+    va_end(args);
+    *len = MIN(*len + MAX(n, 0), (int)size - 1);
+}
+
+static void
+_respond(uint const switchUs, char const * const error)
+{
+    esp_ble_scan_params_t scan;
+    _scanParams(&scan);
+    _accountRadio(esp_timer_get_time());  // so the rate includes the current slot
+
+    char payload[CONFIG_BLESCAN_IPC_TO_MQTT_MSG_SIZE];  // longer doesn't fit in a message anyway
+    size_t const room = sizeof(payload) - sizeof(" } }") + 1;  // so that the object can always be closed
+    int len = 0;
+    _append(payload, room, &len,
+            "{ \"response\": { \"mode\": \"%s\", \"interval\": %u, \"switchUs\": %u"
+            ", \"scan\": { \"type\": \"%s\", \"window\": %u, \"interval\": %u, \"policy\": \"%s\", \"dup\": \"%s\", \"flush\": %u, \"flushes\": %u, \"cbPerSec\": %d, \"before\": %d }",
+            _bleMode_str(_ble.mode), (_ble.advIntMax * 10) >> 4, switchUs,
+            _scanTypes[scan.scan_type], (scan.scan_window * 10) >> 4, (scan.scan_interval * 10) >> 4,
+            _scanPolicies[scan.scan_filter_policy], _scanDups[scan.scan_duplicate], _ble.scan.flushMs, _ble.scan.flushes,
+            _cbRate(), _rate.before);
+    _append(payload, room, &len,
+            ", \"ident\": { \"count\": %u, \"max\": %u, \"cur\": %u, \"rotate\": %u, \"rotations\": %u }",
+            advIdent_count(), ADV_IDENT_MAX, _ble.ident.cur, _ble.ident.rotateMs, _ble.ident.rotations);
+    _append(payload, room, &len,
+            ", \"probe\": { \"mode\": \"%s\", \"int\": %u, \"seq\": %u }",
+            probe_modeNames[_ble.probe.mode], _ble.probe.periodMs, _ble.probe.seq);
+    if (_set.pending) {
+        _append(payload, room, &len, ", \"id\": \"%s\", \"applyUs\": %u",
+                _set.id, (uint)(esp_timer_get_time() - _set.start));
+        _set.pending = false;
+    }
+    if (error) {
+        _append(payload, room, &len, ", \"error\": \"%s\"", error);
+    }
+    if (_ble.mode == BLEMODE_MIX) {
+        _append(payload, room, &len,
+                ", \"mix\": { \"cycle\": %u, \"adv\": %u, \"jitter\": %u }",
+                _ble.mix.cycleMs, _ble.mix.advPct, _ble.mix.jitterMs);
+    }
+    if (_at.report) {
+        _append(payload, room, &len,
+                ", \"at\": { \"time\": %" PRId64 ", \"errUs\": %d }", _at.time, _at.errUs);
+        _at.report = false;
+    } else if (_at.pending) {  // the start of the command is enough to recognize it
+        _append(payload, room, &len,
+                ", \"at\": { \"time\": %" PRId64 ", \"pending\": \"%.*s\" }", _at.time, BLE_AT_ECHO_LEN, _at.cmd);
+    }
+    _append(payload, sizeof(payload), &len, " } }");
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, _ipc);
+}
+
+static void
+_issueStep(void)
+{
+    bleStep_t const step = _plan.step[_plan.cur];
+
+    xTaskNotifyWait(0, UINT32_MAX, NULL, 0);  // forget late completions of earlier tries
+    _plan.deadline = esp_timer_get_time() + CONFIG_BLESCAN_GAP_TIMEOUT_MSEC * 1000LL;
+    _plan.tries++;
+    esp_err_t const err = _issue(step);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: %s", _bleSteps[step], esp_err_to_name(err));
+        _plan.deadline = 0;  // handled as a timeout
+    }
+}
+
+static void
+_planDone(char const * const error)
+{
+    int64_t const end = esp_timer_get_time();
+    uint const us = end - _plan.start;
+
+    if (_plan.fromRadio && _ble.radio != BLEMODE_IDLE) {  // overhead of going from one to the other
+        ipc_radio_t * const radio = &_ipc->dev.radio;
+        radio->switches++;
+        radio->switchTotUs += us;
+        radio->switchMaxUs = MAX(radio->switchMaxUs, us);
+    }
+    if (_ble.mode == BLEMODE_MIX) {  // the slot starts once the radio switched
+        _ble.mix.slotEnd = end + (int64_t)_ble.mix.slotMs * 1000;
+    }
+    if (_plan.respond) {
+        _respond(us, error);
+    }
+    _plan.cnt = 0;
+}
+
+// notes what the radio is doing now that a step completed
+
+static void
+_stepDone(bleStep_t const step)
+{
+    int64_t const now = esp_timer_get_time();
+
+    switch (step) {
+        case BLESTEP_SCAN_PARAMS:  // starts measuring the callback rate anew, the radio isn't scanning
+            _scanParams(&_ble.scanSet);
+            _rate.before = _cbRate();
+            _rate.advRx = _ipc->dev.count.advRx;
+            _rate.scanUs = _ipc->dev.radio.scanUs;
+            break;
+        case BLESTEP_ADV_DATA:
+            _ble.ident.set = _ble.ident.cur;
+            _ble.ident.rotateAt = now + _ble.ident.rotateMs * 1000LL;
+            if (_ble.probe.mode != PROBE_MODE_off) {
+                _ble.probe.seq = (_ble.probe.seq + 1) & PROBE_SEQ_MASK;
+                _ble.probe.nextAt = now + _ble.probe.periodMs * 1000LL;
+            }
+            break;
+        case BLESTEP_SCAN_START:
+            _accountRadio(now);
+            _ble.radio = BLEMODE_SCAN;
+            _ble.scan.flush = false;
+            _ble.scan.flushAt = now + _ble.scan.flushMs * 1000LL;
+            break;
+        case BLESTEP_ADV_START: _accountRadio(now); _ble.radio = BLEMODE_ADV; _ble.advIntSet = _ble.advIntMax; break;
+        case BLESTEP_SCAN_STOP:
+        case BLESTEP_ADV_STOP: _accountRadio(now); _ble.radio = BLEMODE_IDLE; break;
+    }
+    if (++_plan.cur == _plan.cnt) {
+        _planDone(NULL);
+        return;
+    }
+    _plan.tries = 0;
+    _issueStep();
+}
+
+static void
+_stepFailed(void)
+{
+    bleStep_t const step = _plan.step[_plan.cur];
+    ipc_radio_t * const radio = &_ipc->dev.radio;
+
+    if (_plan.tries <= CONFIG_BLESCAN_GAP_RETRIES) {
+        ESP_LOGW(TAG, "%s failed, retrying", _bleSteps[step]);
+        radio->gapRetry++;
+        _issueStep();
+        return;
+    }
+    ESP_LOGE(TAG, "%s failed, giving up on %s", _bleSteps[step], _bleMode_str(_ble.mode));
+    radio->gapFail++;
+    if (_ble.mode != BLEMODE_MIX) {  // MIX plans again at the end of the slot
+        _ble.mode = _ble.radio;  // so that the response tells, and the next command plans from there
+    }
+    _planDone(_bleSteps[step]);
+}
+
+// handles the notification bits received while a step is in progress
+
+static void
+_planEvent(uint32_t const bits, int64_t const now)
 {
-    ESP_LOGW(TAG, "%s -> %s", _bleMode_str(current), _bleMode_str(new));
+    bleStep_t const step = _plan.step[_plan.cur];
 
-    if (new != current) {
+    if (bits & BLE_EVENT(step)) {
+        _stepDone(step);
+    } else if ((bits & BLE_EVENT_FAILED) || now >= _plan.deadline) {
+        _stepFailed();
+    }
+}
+
+/*
+ * In probe mode, ADV hands the controller the next sequence number every probe period, without
+ * stopping.  Probing takes the place of rotating, so that the sequence numbers come at a steady
+ * pace; MIX advertises the next sequence number at the first ADV slot after the period.
+ */
 
-        switch(new) {
-            case BLEMODE_IDLE:
-                if (current == BLEMODE_SCAN) _bleStopScan();
-                if (current == BLEMODE_ADV) _bleStopAdv();
-                break;
-            case BLEMODE_SCAN:
-                if (current == BLEMODE_ADV) _bleStopAdv();
-                _bleStartScan(adv_int_max + 0x04);
-                break;
-            case BLEMODE_ADV:
-                if (current == BLEMODE_SCAN) _bleStopScan();
-                _bleStartAdv(adv_int_max);
-                break;
+static bool
+_probeDue(int64_t const now)
+{
+    return _ble.probe.mode != PROBE_MODE_off && now >= _ble.probe.nextAt;
+}
+
+static bool
+_probing(void)
+{
+    return _ble.mode == BLEMODE_ADV && _ble.radio == BLEMODE_ADV && _ble.probe.mode != PROBE_MODE_off;
+}
+
+// plans the steps to get the radio to `target`, only stopping what needs to be stopped and
+// configuring what the controller doesn't have yet
+
+static void
+_planRadio(bleMode_t const target, bool const respond)
+{
+    bool const scanStale = _scanStale();
+    bool const scanRestart = scanStale || _ble.scan.flush;
+    bool const advStale = _ble.advIntSet != _ble.advIntMax;
+    bool const advDataStale = _ble.ident.set != (int)_ble.ident.cur || _probeDue(esp_timer_get_time());
+
+    _plan.cnt = 0;
+    if (_ble.radio == BLEMODE_SCAN && (target != BLEMODE_SCAN || scanRestart)) {
+        _plan.step[_plan.cnt++] = BLESTEP_SCAN_STOP;
+    }
+    if (_ble.radio == BLEMODE_ADV && (target != BLEMODE_ADV || advStale)) {
+        _plan.step[_plan.cnt++] = BLESTEP_ADV_STOP;
+    }
+    if (target == BLEMODE_SCAN && (_ble.radio != BLEMODE_SCAN || scanRestart)) {
+        if (scanStale) {
+            _plan.step[_plan.cnt++] = BLESTEP_SCAN_PARAMS;
+        }
+        _plan.step[_plan.cnt++] = BLESTEP_SCAN_START;
+    }
+    if (target == BLEMODE_ADV) {  // the data can change while advertising
+        if (advDataStale) {
+            _plan.step[_plan.cnt++] = BLESTEP_ADV_DATA;
         }
+        if (_ble.radio != BLEMODE_ADV || advStale) {
+            _plan.step[_plan.cnt++] = BLESTEP_ADV_START;
+        }
+    }
+    _plan.cur = 0;
+    _plan.tries = 0;
+    _plan.start = esp_timer_get_time();
+    _plan.fromRadio = _plan.cnt && (_plan.step[0] == BLESTEP_SCAN_STOP || _plan.step[0] == BLESTEP_ADV_STOP);
+    _plan.respond = respond;
+
+    if (_plan.cnt == 0) {
+        _planDone(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "%s -> %s in %u steps", _bleMode_str(_ble.radio), _bleMode_str(target), _plan.cnt);
+    _issueStep();
+}
+
+/*
+ * With more than one identity, ADV mode hands the controller the next prebuilt advertisement
+ * every rotation period, without stopping.  MIX moves on to the next identity at the first
+ * ADV slot after the period.
+ */
+
+static bool
+_identDue(int64_t const now)
+{
+    return _ble.ident.rotateMs && advIdent_count() > 1 && now >= _ble.ident.rotateAt;
+}
+
+static void
+_nextIdent(void)
+{
+    _ble.ident.cur = (_ble.ident.cur + 1) % advIdent_count();
+    _ble.ident.rotations++;
+}
+
+// switches to the next MIX slot, the slot length only counts time spent in the new mode
+
+static void
+_mixNextSlot(bool const respond)
+{
+    bleMode_t next = (_ble.radio == BLEMODE_ADV) ? BLEMODE_SCAN : BLEMODE_ADV;
+    if (_ble.mix.advPct == 0) next = BLEMODE_SCAN;
+    if (_ble.mix.advPct == 100) next = BLEMODE_ADV;
+
+    uint const pct = (next == BLEMODE_ADV) ? _ble.mix.advPct : 100 - _ble.mix.advPct;
+    int slotMs = _ble.mix.cycleMs * pct / 100;
+    if (_ble.mix.jitterMs) {
+        slotMs += (int)(esp_random() % (2 * _ble.mix.jitterMs + 1)) - (int)_ble.mix.jitterMs;
+    }
+    _ble.mix.slotMs = MAX(slotMs, 0);
+    if (next == BLEMODE_ADV && _identDue(esp_timer_get_time())) {
+        _nextIdent();
+    }
+    _planRadio(next, respond);
+}
+
+// with duplicate filtering, the controller passes on each advertiser once until scanning
+// restarts, so SCAN restarts it periodically; MIX does so at every SCAN slot anyway
+
+static bool
+_flushing(void)
+{
+    return _ble.mode == BLEMODE_SCAN && _ble.radio == BLEMODE_SCAN &&
+           _ble.scan.dup == BLE_SCAN_DUPLICATE_ENABLE && _ble.scan.flushMs;
+}
+
+static bool
+_rotating(void)
+{
+    return _ble.mode == BLEMODE_ADV && _ble.radio == BLEMODE_ADV && _ble.ident.rotateMs && advIdent_count() > 1 &&
+           _ble.probe.mode == PROBE_MODE_off;
+}
+
+static void
+_changeBleMode(bleMode_t const new, bool const respond)
+{
+    ESP_LOGW(TAG, "%s -> %s", _bleMode_str(_ble.mode), _bleMode_str(new));
+
+    _ble.mode = new;
+    if (new == BLEMODE_MIX) {
+        _mixNextSlot(respond);
+    } else {
+        _planRadio(new, respond);
+    }
+}
+
+// "mix [CYCLE_MSEC [ADV_PCT [JITTER_MSEC]]]", omitted values are kept
+
+static void
+_mixCtrl(char * const args[], uint const argc)
+{
+    if (argc >= 2) {
+        _ble.mix.cycleMs = MAX(MIN(atoi(args[1]), 600000), 100);
+    }
+    if (argc >= 3) {
+        _ble.mix.advPct = MAX(MIN(atoi(args[2]), 100), 0);
     }
-    return new;
+    if (argc >= 4) {
+        _ble.mix.jitterMs = MAX(atoi(args[3]), 0);
+    }
+    // no slot may go negative, or the duty ratio would be off on average
+    uint const shortestMs = _ble.mix.cycleMs * MIN(_ble.mix.advPct, 100 - _ble.mix.advPct) / 100;
+    _ble.mix.jitterMs = MIN(_ble.mix.jitterMs, shortestMs);
+}
+
+static void
+_atExpired(void * const arg)
+{
+    char gen[12];
+    int const len = snprintf(gen, sizeof(gen), "%u", atomic_load(&_at.gen));
+    sendToBle(IPC_TO_BLE_TYP_AT, gen, len, _ipc);
+}
+
+// whether ble_task runs `cmd` itself, as opposed to mqtt_task
+
+static bool
+_atRunnable(char const * const cmd)
+{
+    char word[8];
+    size_t const len = strcspn(cmd, " ");
+    if (len >= sizeof(word)) {
+        return false;
+    }
+    memcpy(word, cmd, len);
+    word[len] = '\0';
+    return strcmp(word, "set") == 0 || strcmp(word, "ident") == 0 || strcmp(word, "ident+") == 0 ||
+           strcmp(word, "int") == 0 || _bleMode_nr(word) >= 0;
+}
+
+// "at UNIX_MSEC CMD", replaces an earlier one that is still pending
+
+static void
+_atCtrl(char const * const data)
+{
+    char * cmd;
+    long long const time = strtoll(data + 2, &cmd, 10);
+    while (*cmd == ' ') {
+        cmd++;
+    }
+    if (cmd == data + 2 || *cmd == '\0') {
+        _respond(0, "at: usage");
+        return;
+    }
+    if (!_atRunnable(cmd)) {
+        _respond(0, "at: unsupported command");
+        return;
+    }
+    int64_t local;
+    if (!timeSync_toLocal(time * 1000, &local)) {
+        _respond(0, "at: clock not synced");
+        return;
+    }
+    esp_timer_stop(_at.timer);
+    atomic_fetch_add(&_at.gen, 1);
+    _at.time = time;
+    _at.local = local;
+    _at.pending = true;
+    snprintf(_at.cmd, sizeof(_at.cmd), "%s", cmd);
+
+    int64_t const delay = local - esp_timer_get_time();
+    ESP_LOGI(TAG, "\"%s\" in %lld msec", _at.cmd, (long long)delay / 1000);
+    if (delay > 0) {
+        esp_timer_start_once(_at.timer, delay);
+    } else {
+        _atExpired(NULL);  // already due, the error tells how late
+    }
+    _respond(0, NULL);
+}
+
+// "set id=ID mode=MODE int=MSEC window=MSEC scanint=MSEC scan=TYPE policy=POLICY dup=on|off
+// flush=MSEC fmt=FMT filter=RULES", all checked before any is applied, then the radio goes to
+// the new mode and settings in one plan
+
+static void
+_setCtrl(char * const data)
+{
+    _set.start = esp_timer_get_time();
+    _set.pending = true;
+
+    ctrlSet_t set;
+    char const * bad = ctrlSet_parse(data, &set);
+    snprintf(_set.id, sizeof(_set.id), "%s", set.id);
+
+    int mode = _ble.mode;
+    int type = _ble.scan.type;
+    int policy = _ble.scan.policy;
+    int dup = _ble.scan.dup;
+    int probe = _ble.probe.mode;
+    if (!bad && set.mode && (mode = _bleMode_nr(set.mode)) < 0) {
+        bad = "mode";
+    }
+    if (!bad && set.scanType && (type = _name_nr(_scanTypes, ARRAY_SIZE(_scanTypes), set.scanType)) < 0) {
+        bad = "scan";
+    }
+    if (!bad && set.policy && (policy = _name_nr(_scanPolicies, ARRAY_SIZE(_scanPolicies), set.policy)) < 0) {
+        bad = "policy";
+    }
+    if (!bad && set.dup && (dup = _name_nr(_scanDups, ARRAY_SIZE(_scanDups), set.dup)) < 0) {
+        bad = "dup";
+    }
+    if (!bad && set.probe && (probe = _name_nr(probe_modeNames, PROBE_MODE_COUNT, set.probe)) < 0) {
+        bad = "probe";
+    }
+    if (!bad && set.filter) {  // replaced last, as it can't be undone
+        esp_err_t const err = scanFilter_load(set.filter, set.filterLen);
+        if (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE || err == ESP_ERR_NO_MEM) {  // else only storing it failed
+            bad = "filter";
+        }
+    }
+    if (bad) {
+        char error[24];
+        snprintf(error, sizeof(error), "set: %s", bad);
+        _respond(0, error);
+        return;
+    }
+    if (set.scanFmt) {
+        _ipc->cfg.scanFmt = set.scanFmt;
+    }
+    if (set.intMs) {
+        _ble.advIntMax = (set.intMs << 4) / 10;
+    }
+    if (set.windowMs) {
+        _ble.scan.window = (set.windowMs << 4) / 10;
+    }
+    if (set.scanIntMs) {
+        _ble.scan.interval = (set.scanIntMs << 4) / 10;
+    }
+    if (set.flushMs >= 0) {
+        _ble.scan.flushMs = set.flushMs;
+        _ble.scan.flushAt = esp_timer_get_time() + set.flushMs * 1000LL;
+    }
+    if (set.rotateMs >= 0) {
+        _ble.ident.rotateMs = set.rotateMs;
+        _ble.ident.rotateAt = esp_timer_get_time() + set.rotateMs * 1000LL;
+    }
+    if (set.probeMs) {
+        _ble.probe.periodMs = set.probeMs;
+    }
+    if (probe != _ble.probe.mode) {  // starts with the next sequence number, or goes back to the identity
+        _ble.probe.mode = probe;
+        _ble.probe.nextAt = 0;
+        _ble.ident.set = -1;
+    }
+    _ble.scan.type = type;
+    _ble.scan.policy = policy;
+    _ble.scan.dup = dup;
+    if (mode != _ble.mode) {
+        _changeBleMode(mode, true);
+    } else if (_ble.mode == BLEMODE_MIX) {  // starts a new slot, rather than waiting for the next
+        _mixNextSlot(true);
+    } else {
+        _planRadio(_ble.mode, true);  // only restarts what the new settings affect
+    }
+}
+
+// "ident[+] uuid=HEX32 major=N minor=N [power=DBM]; ..", replaces or adds to the identities
+
+static void
+_identCtrl(char const * const data)
+{
+    bool const append = data[5] == '+';
+    char const * const text = data + (append ? 6 : 5);
+
+    esp_err_t err = ESP_OK;
+    if (*text) {
+        err = advIdent_load(text, strlen(text), append);
+    }
+    if (err == ESP_ERR_INVALID_ARG || err == ESP_ERR_INVALID_SIZE || err == ESP_ERR_NO_MEM) {
+        char error[48];
+        snprintf(error, sizeof(error), "ident: %s", esp_err_to_name(err));
+        _respond(0, error);
+        return;
+    }
+    _ble.ident.cur %= advIdent_count();
+    _ble.ident.set = -1;  // the payload at that position may have changed
+    if (_ble.radio == BLEMODE_ADV) {
+        _planRadio(BLEMODE_ADV, true);  // only hands over the new data
+        return;
+    }
+    _respond(0, err == ESP_OK ? NULL : "ident: not stored");
+}
+
+static void
+_ctrl(char * const data)
+{
+    if (strncmp(data, "at ", 3) == 0) {
+        _atCtrl(data);
+        return;
+    }
+    if (strncmp(data, "set", 3) == 0 && (data[3] == ' ' || data[3] == '\0')) {
+        _setCtrl(data);
+        return;
+    }
+    if (strncmp(data, "ident", 5) == 0 && (data[5] == ' ' || data[5] == '+' || data[5] == '\0')) {
+        _identCtrl(data);
+        return;
+    }
+
+    char * args[4];
+    uint8_t argc = _splitArgs(data, args, ARRAY_SIZE(args));
+
+    if (argc == 0) {
+        return;
+    }
+    if (strcmp(args[0], "int") == 0 ) {
+        if (argc >= 2) {
+            uint16_t const msec_min = 40;  // 20 msec * 2, because use adv_int_max/2
+            uint16_t const msec_max = 10240;
+            uint16_t const msec = MAX( MIN(atoi(args[1]), msec_max), msec_min);  // limits imposed by ESP-IDF
+            _ble.advIntMax = (msec << 4) / 10;  // args[1] in msec
+
+            if (_ble.mode != BLEMODE_MIX) {  // MIX picks it up at the next slot
+                _planRadio(_ble.mode, true);
+                return;
+            }
+        }
+    } else {
+        if (strcmp(args[0], "mix") == 0) {
+            _mixCtrl(args, argc);
+        }
+        bleMode_t const newBleMode = _bleMode_nr(args[0]);
+        if ((int)newBleMode >= 0 && newBleMode != _ble.mode) {
+            _changeBleMode(newBleMode, true);
+            return;
+        }
+    }
+    _respond(0, NULL);
+}
+
+// runs the "at" command, `now` tells how late
+
+static void
+_atRun(int64_t const now)
+{
+    _at.pending = false;
+    _at.errUs = now - _at.local;
+    _at.report = true;
+    _ctrl(_at.cmd);
 }
 
 void
@@ -355,6 +1022,7 @@ ble_task(void * ipc_void) {
 
     ESP_LOGI(TAG, "starting ..");
 	_ipc = ipc_void;
+    _bleTask = xTaskGetCurrentTaskHandle();  // for the GAP callback to notify
 
 	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 	esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
@@ -363,55 +1031,86 @@ ble_task(void * ipc_void) {
 	_initIbeacon();
 
     uint8_t const * const bda = esp_bt_dev_get_address();
-    _bda2str(bda, _ipc->dev.bda);
-	_bda2devName(bda, _ipc->dev.name, BLE_DEVNAME_LEN);
+    bda2str(bda, _ipc->dev.bda);
+	bda2devName(bda, _ipc->dev.name, BLE_DEVNAME_LEN);
 
     sendToMqtt(IPC_TO_MQTT_IPC_DEV_AVAILABLE, _ipc->dev.name, _ipc);
 
-	ble_event_group = xEventGroupCreate();  // for event handler to signal completion
+    esp_timer_create_args_t const atTimerArgs = {
+        .callback = _atExpired,
+        .name = "ble_at",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&atTimerArgs, &_at.timer));
 
-    uint16_t adv_int_max = (40 << 4) / 10;  // 40 msec  [n * 0.625 msec]
-    bleMode_t bleMode = _changeBleMode(BLEMODE_IDLE, BLEMODE_ADV, adv_int_max);
+    advIdent_init();  // the built-in identity when none are stored
+    _changeBleMode(BLEMODE_ADV, false);
 
 	while (1) {
-		ipc_to_ble_msg_t msg;
-		if (xQueueReceive(_ipc->toBleQ, &msg, (TickType_t)(1000L / portTICK_PERIOD_MS)) == pdPASS) {
-
-            switch(msg.dataType) {
-
-                case IPC_TO_BLE_TYP_CTRL: {
-
-                    char * args[3];
-                    uint8_t argc = _splitArgs(msg.data, args, ARRAY_SIZE(args));
-
-                    if (strcmp(args[0], "int") == 0 ) {
-                        if (argc >= 2) {
-                            uint16_t const msec_min = 40;  // 20 msec * 2, because use adv_int_max/2
-                            uint16_t const msec_max = 10240;
-                            uint16_t const msec = MAX( MIN(atoi(args[1]), msec_max), msec_min);  // limits imposed by ESP-IDF
-                            adv_int_max = (msec << 4) / 10;
-
-                            bleMode_t const orgBleMode = bleMode;  // args[1] in msec
-                            bleMode = _changeBleMode(bleMode, BLEMODE_IDLE, adv_int_max);
-                            bleMode = _changeBleMode(bleMode, orgBleMode, adv_int_max);
-                        }
-                    } else {
+        if (_plan.cnt) {  // waiting for a GAP step, control messages wait their turn
+            int64_t const left = _plan.deadline - esp_timer_get_time();
+            uint const waitMs = (uint)MAX(left, 0) / 1000;
+            uint32_t bits = 0;
+            xTaskNotifyWait(0, UINT32_MAX, &bits, (waitMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+            _planEvent(bits, esp_timer_get_time());
+            continue;
+        }
+        uint waitMs = 1000;
+        if (_ble.mode == BLEMODE_MIX) {
+            int64_t const left = _ble.mix.slotEnd - esp_timer_get_time();
+            waitMs = MIN((uint)MAX(left, 0) / 1000, waitMs);
+        }
+        if (_flushing()) {
+            int64_t const left = _ble.scan.flushAt - esp_timer_get_time();
+            waitMs = MIN((uint)MAX(left, 0) / 1000, waitMs);
+        }
+        if (_rotating()) {
+            int64_t const left = _ble.ident.rotateAt - esp_timer_get_time();
+            waitMs = MIN((uint)MAX(left, 0) / 1000, waitMs);
+        }
+        if (_probing()) {
+            int64_t const left = _ble.probe.nextAt - esp_timer_get_time();
+            waitMs = MIN((uint)MAX(left, 0) / 1000, waitMs);
+        }
+        if (_at.pending) {  // in case _atExpired found toBleQ full
+            int64_t const left = _at.local - esp_timer_get_time();
+            waitMs = (uint)MIN((MAX(left, 0) + 999) / 1000, (int64_t)waitMs);  // may be hours away
+        }
+        TickType_t const waitTicks = (waitMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;  // rounded up, so it doesn't spin
+		ipc_to_ble_msg_t * const msg = ipc_receive(_ipc->toBleQ, waitTicks);
+		if (msg) {
 
-                        bleMode_t const newBleMode = _bleMode_nr(args[0]);
-                        if ((int)newBleMode >= 0) {
-                            bleMode = _changeBleMode(bleMode, newBleMode, adv_int_max);
-                        }
+            switch(msg->dataType) {
+                case IPC_TO_BLE_TYP_CTRL:
+                    _ctrl(msg->data);
+                    break;
+                case IPC_TO_BLE_TYP_AT: {
+                    // one from a replaced command, or from its timer firing while it was replaced, is early
+                    int64_t const now = esp_timer_get_time();
+                    if (_at.pending && strtoul(msg->data, NULL, 10) == atomic_load(&_at.gen) && now >= _at.local) {
+                        _atRun(now);
                     }
-                    char * payload;
-                    assert(asprintf(&payload,
-                                    "{ \"response\": { \"mode\": \"%s\", \"interval\": %u } }",
-                                    _bleMode_str(bleMode), (adv_int_max * 10) >> 4 ));
-                    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, _ipc);
-                    free(payload);
                     break;
                 }
             }
-            free(msg.data);
+            ipc_release(_ipc->toBleQ, msg);
+            continue;
 		}
+        int64_t const now = esp_timer_get_time();
+        if (_at.pending && now >= _at.local) {
+            _atRun(now);
+        } else if (_ble.mode == BLEMODE_MIX && now >= _ble.mix.slotEnd) {
+            _mixNextSlot(false);
+        } else if (_flushing() && now >= _ble.scan.flushAt) {
+            _ble.scan.flush = true;
+            _ble.scan.flushes++;
+            _planRadio(BLEMODE_SCAN, false);
+        } else if (_rotating() && _identDue(now)) {
+            _nextIdent();
+            _planRadio(BLEMODE_ADV, false);
+        } else if (_probing() && _probeDue(now)) {
+            _planRadio(BLEMODE_ADV, false);
+        } else {
+            _accountRadio(now);  // so stats include the current slot
+        }
 	}
 }
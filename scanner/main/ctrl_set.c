@@ -0,0 +1,207 @@
+/**
+ * @brief ctrl_set, parses "set" control messages that change several settings at once
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+#include "ctrl_set.h"
+
+// the limits ESP-IDF imposes, the interval is halved for adv_int_min
+
+#define CTRL_SET_INT_MIN_MSEC (40)
+#define CTRL_SET_INT_MAX_MSEC (10240)
+#define CTRL_SET_WINDOW_MIN_MSEC (3)
+#define CTRL_SET_WINDOW_MAX_MSEC (10240)
+#define CTRL_SET_FLUSH_MAX_MSEC (3600000)
+
+// points `*val` past "KEY=" when `token` starts with it
+
+static bool
+_isKey(char * const token, char const * const key, char ** const val)
+{
+    size_t const len = strlen(key);
+    if (strncmp(token, key, len) != 0 || token[len] != '=') {
+        return false;
+    }
+    *val = token + len + 1;
+    return true;
+}
+
+static bool
+_parseMs(char const * const val, uint const min, uint const max, uint * const ms)
+{
+    char * end;
+    unsigned long const n = strtoul(val, &end, 10);
+    if (end == val || *end != '\0' || n < min || n > max) {
+        return false;
+    }
+    *ms = n;
+    return true;
+}
+
+static bool
+_parseName(char * const val, char const ** const name)
+{
+    if (*val == '\0') {
+        return false;
+    }
+    *name = val;
+    return true;
+}
+
+static bool
+_parseId(char const * const val, char * const id)
+{
+    size_t const len = strlen(val);
+    if (len == 0 || len > CTRL_SET_ID_LEN) {
+        return false;
+    }
+    for (size_t ii = 0; ii < len; ii++) {
+        if (!isalnum((int)val[ii]) && !strchr("-_.:", val[ii])) {
+            return false;  // it ends up in JSON unescaped
+        }
+    }
+    memcpy(id, val, len + 1);
+    return true;
+}
+
+static bool
+_parseFmt(char const * const val, uint * const scanFmt)
+{
+    for (uint ii = 0; ii < ARRAY_SIZE(ipc_scanFmtNames); ii++) {
+        if (ipc_scanFmtNames[ii] && strcmp(val, ipc_scanFmtNames[ii]) == 0) {
+            *scanFmt = ii;
+            return true;
+        }
+    }
+    return false;
+}
+
+// parses one KEY=VALUE token into `set`, returns NULL or the key that didn't parse
+
+static char const *
+_parseKey(char * const p, ctrlSet_t * const set)
+{
+    char * val;
+    if (_isKey(p, "id", &val)) {
+        if (!_parseId(val, set->id)) {
+            return "id";
+        }
+    } else if (_isKey(p, "mode", &val)) {
+        if (!_parseName(val, &set->mode)) {
+            return "mode";
+        }
+    } else if (_isKey(p, "int", &val)) {
+        if (!_parseMs(val, CTRL_SET_INT_MIN_MSEC, CTRL_SET_INT_MAX_MSEC, &set->intMs)) {
+            return "int";
+        }
+    } else if (_isKey(p, "window", &val)) {
+        if (!_parseMs(val, CTRL_SET_WINDOW_MIN_MSEC, CTRL_SET_WINDOW_MAX_MSEC, &set->windowMs)) {
+            return "window";
+        }
+    } else if (_isKey(p, "scanint", &val)) {
+        if (!_parseMs(val, CTRL_SET_WINDOW_MIN_MSEC, CTRL_SET_WINDOW_MAX_MSEC, &set->scanIntMs)) {
+            return "scanint";
+        }
+    } else if (_isKey(p, "scan", &val)) {
+        if (!_parseName(val, &set->scanType)) {
+            return "scan";
+        }
+    } else if (_isKey(p, "policy", &val)) {
+        if (!_parseName(val, &set->policy)) {
+            return "policy";
+        }
+    } else if (_isKey(p, "dup", &val)) {
+        if (!_parseName(val, &set->dup)) {
+            return "dup";
+        }
+    } else if (_isKey(p, "flush", &val)) {
+        uint ms;
+        if (!_parseMs(val, 0, CTRL_SET_FLUSH_MAX_MSEC, &ms)) {
+            return "flush";
+        }
+        set->flushMs = ms;
+    } else if (_isKey(p, "rotate", &val)) {
+        uint ms;
+        if (!_parseMs(val, 0, CTRL_SET_FLUSH_MAX_MSEC, &ms)) {
+            return "rotate";
+        }
+        set->rotateMs = ms;
+    } else if (_isKey(p, "probeint", &val)) {
+        if (!_parseMs(val, CTRL_SET_INT_MIN_MSEC, CTRL_SET_FLUSH_MAX_MSEC, &set->probeMs)) {
+            return "probeint";
+        }
+    } else if (_isKey(p, "probe", &val)) {
+        if (!_parseName(val, &set->probe)) {
+            return "probe";
+        }
+    } else if (_isKey(p, "fmt", &val)) {
+        if (!_parseFmt(val, &set->scanFmt)) {
+            return "fmt";
+        }
+    } else {
+        return "key";
+    }
+    return NULL;
+}
+
+char const *
+ctrlSet_parse(char * const text, ctrlSet_t * const set)
+{
+    *set = (ctrlSet_t) {
+        .flushMs = -1,
+        .rotateMs = -1,
+    };
+
+    if (strncmp(text, "set", 3) != 0 || (text[3] != ' ' && text[3] != '\0')) {
+        return "set";
+    }
+    char const * bad = NULL;
+    char * p = text + 3;
+    while (*p) {
+        while (*p == ' ') {
+            p++;
+        }
+        char * val;
+        if (*p == '\0') {
+            break;
+        }
+        if (_isKey(p, "filter", &val)) {  // the rest of the message
+            set->filter = val;
+            set->filterLen = strlen(val);
+            break;
+        }
+        char * const end = p + strcspn(p, " ");
+        bool const last = *end == '\0';
+        *end = '\0';
+
+        char const * const err = _parseKey(p, set);
+        if (err && !bad) {
+            bad = err;  // keeps going, so the acknowledgement still has the ID
+        }
+        p = last ? end : end + 1;
+    }
+    return bad;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/*
+ * "set" control messages change several settings at once, so that the radio is reconfigured
+ * only once and one acknowledgement, tagged with the request's ID, reports the outcome:
+ *   set id=ID mode=MODE int=MSEC window=MSEC scanint=MSEC scan=TYPE policy=POLICY dup=on|off
+ *       flush=MSEC rotate=MSEC probe=off|seq|time probeint=MSEC fmt=json|bin|both
+ *       filter=RULE; RULE ..
+ * Each key is optional.  Names are checked by whoever applies them.  The filter rules contain
+ * spaces, so `filter` comes last and takes the rest of the message.  Nothing is applied unless
+ * all of it parses.
+ */
+
+#define CTRL_SET_ID_LEN (16)
+
+typedef struct ctrlSet_t {
+    char         id[CTRL_SET_ID_LEN + 1];  // correlation ID, "" when not given
+    char const * mode;       // BLE mode name, NULL when not given
+    uint         intMs;      // advertisement interval [msec], 0 when not given
+    uint         windowMs;   // scan window [msec], 0 when not given
+    uint         scanIntMs;  // scan interval [msec], 0 when not given
+    char const * scanType;   // "active" or "passive", NULL when not given
+    char const * policy;     // scan filter policy name, NULL when not given
+    char const * dup;        // controller duplicate filtering, "on" or "off", NULL when not given
+    int          flushMs;    // how often to flush the controller's duplicate cache [msec], -1 when not given
+    int          rotateMs;   // how long to advertise each identity [msec], -1 when not given
+    char const * probe;      // probe mode name, see probe.h, NULL when not given
+    uint         probeMs;    // how long to advertise each probe sequence number [msec], 0 when not given
+    uint         scanFmt;    // IPC_SCAN_FMT_* bit mask, 0 when not given
+    char const * filter;     // scan filter rules, NULL when not given
+    size_t       filterLen;
+} ctrlSet_t;
+
+// returns NULL, or the first key that didn't parse, "key" when unknown; the keys after it are
+// still parsed, so that `id` is known for the acknowledgement; `set` points into `text`
+char const * ctrlSet_parse(char * const text, ctrlSet_t * const set);
@@ -0,0 +1,303 @@
+/**
+ * @brief map BLE device addresses to board names
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <esp_bt_defs.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+
+#include "ipc.h"
+#include "devname.h"
+
+static char const * const TAG = "devname";
+
+/*
+ * The names are kept in the "devnames" data partition as a header followed by fixed-width
+ * entries sorted by BDA.  The partition is memory mapped, so a lookup is a binary search
+ * through cached flash, without copying the table to RAM.  The header is written last, so
+ * an interrupted update reads as an empty partition and gets reseeded.
+ */
+
+#define DEVNAME_MAGIC (0x4E564544)  // "DEVN"
+#define DEVNAME_VERSION (1)
+#define DEVNAME_NAME_LEN (18)  // including terminating zero
+
+typedef struct devNameHdr_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entrySize;
+    uint32_t count;
+    uint32_t reserved;
+} devNameHdr_t;
+
+typedef struct devNameEntry_t {
+    uint8_t bda[ESP_BD_ADDR_LEN];
+    char    name[DEVNAME_NAME_LEN];
+} PACK8 devNameEntry_t;
+
+// boards that were named before the table was loadable, used to seed an empty partition
+
+static devNameEntry_t _builtin[] = {
+    { {0x30, 0xAE, 0xA4, 0xCC, 0x24, 0x6A}, "esp32-1" },
+    { {0x30, 0xAE, 0xA4, 0xCC, 0x32, 0x4E}, "esp32-2" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x82, 0x8A}, "esp32-3" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x7F, 0x22}, "esp32-4" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0x82}, "esp32-5" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0xAA}, "esp32-6" },
+    { {0x24, 0x0A, 0xC4, 0xEB, 0x36, 0x8A}, "esp32-7" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x93, 0x1E}, "esp32-8" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x84, 0xB2}, "esp32-9" },
+    { {0xAC, 0x67, 0xB2, 0x53, 0x7B, 0x3A}, "esp32-10" },
+    { {0x8c, 0xaa, 0xb5, 0x85, 0x0a, 0x7e}, "esp32-11" },
+    { {0x8c, 0xaa, 0xb5, 0x86, 0x2b, 0xa2}, "esp32-12" },
+    { {0x8c, 0xaa, 0xb5, 0x86, 0x22, 0xc2}, "esp32-13" },
+    { {0x8c, 0xaa, 0xb5, 0x85, 0x43, 0x42}, "esp32-14" },
+    { {0x8c, 0xaa, 0xb5, 0x85, 0x6d, 0x06}, "esp32-15" },
+    { {0x8c, 0xaa, 0xb5, 0x85, 0x05, 0xf2}, "esp32-16" },
+    { {0x8c, 0xaa, 0xb5, 0x84, 0xe9, 0x76}, "esp32-17" },
+    { {0x8c, 0xaa, 0xb5, 0x86, 0x2d, 0x5a}, "esp32-18" },
+    { {0x8c, 0xaa, 0xb5, 0x84, 0xec, 0xc6}, "esp32-19" },
+    { {0x8c, 0xaa, 0xb5, 0x86, 0x08, 0x46}, "esp32-20" },
+    { {0x30, 0xae, 0xa4, 0xcc, 0x45, 0x06}, "esp32-wrover-1" },
+    { {0x30, 0xae, 0xa4, 0xcc, 0x42, 0x7a}, "esp32-wrover-2" }
+};
+
+static struct {
+    SemaphoreHandle_t       mutex;    // held while looking up or replacing the table
+    esp_partition_t const * part;     // NULL when the partition table lacks "devnames"
+    spi_flash_mmap_handle_t mmapHandle;
+    bool                    mapped;   // mmapHandle is valid
+    devNameEntry_t const *  entries;  // sorted by bda
+    uint                    count;
+} _names = {};
+
+char *
+bda2str(uint8_t const * const bda, char * const str) {
+
+    for (uint ii = 0, len = 0; ii < ESP_BD_ADDR_LEN; ii++) {
+        len += sprintf(str + len, "%02x", bda[ii]);
+        if (ii < ESP_BD_ADDR_LEN - 1) {
+            str[len++] = ':';
+        }
+    }
+    return str;
+}
+
+static int
+_cmpEntry(void const * const a, void const * const b)
+{
+    return memcmp(((devNameEntry_t const *)a)->bda, ((devNameEntry_t const *)b)->bda, ESP_BD_ADDR_LEN);
+}
+
+static esp_err_t
+_map(void)
+{
+    void const * ptr;
+    esp_err_t const err = esp_partition_mmap(_names.part, 0, _names.part->size, SPI_FLASH_MMAP_DATA, &ptr, &_names.mmapHandle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    _names.mapped = true;
+    devNameHdr_t const * const hdr = ptr;
+    bool const valid = hdr->magic == DEVNAME_MAGIC && hdr->version == DEVNAME_VERSION &&
+                       hdr->entrySize == sizeof(devNameEntry_t) &&
+                       sizeof(*hdr) + hdr->count * sizeof(devNameEntry_t) <= _names.part->size;
+
+    _names.entries = (devNameEntry_t const *)(hdr + 1);
+    _names.count = valid ? hdr->count : 0;
+    return valid ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t
+_write(devNameEntry_t const * const entries, uint const count)
+{
+    devNameHdr_t const hdr = {
+        .magic = DEVNAME_MAGIC,
+        .version = DEVNAME_VERSION,
+        .entrySize = sizeof(devNameEntry_t),
+        .count = count,
+    };
+    size_t const entries_len = count * sizeof(devNameEntry_t);
+    size_t const erase_len = (sizeof(hdr) + entries_len + SPI_FLASH_SEC_SIZE - 1) & ~(SPI_FLASH_SEC_SIZE - 1);
+
+    if (_names.mapped) {  // not when mapping failed before
+        spi_flash_munmap(_names.mmapHandle);
+        _names.mapped = false;
+    }
+    _names.entries = NULL;
+    _names.count = 0;
+
+    esp_err_t err;
+    if ((err = esp_partition_erase_range(_names.part, 0, erase_len)) != ESP_OK ||
+        (err = esp_partition_write(_names.part, sizeof(hdr), entries, entries_len)) != ESP_OK ||
+        (err = esp_partition_write(_names.part, 0, &hdr, sizeof(hdr))) != ESP_OK) {
+
+        ESP_LOGE(TAG, "write failed (%s)", esp_err_to_name(err));
+    }
+    esp_err_t const mapErr = _map();
+    return err != ESP_OK ? err : mapErr;
+}
+
+esp_err_t
+devName_init(void)
+{
+    _names.mutex = xSemaphoreCreateMutex();
+    assert(_names.mutex);
+    qsort(_builtin, ARRAY_SIZE(_builtin), sizeof(*_builtin), _cmpEntry);
+
+    _names.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "devnames");
+    if (_names.part == NULL) {
+        ESP_LOGW(TAG, "no devnames partition, using built-in names");
+        _names.entries = _builtin;
+        _names.count = ARRAY_SIZE(_builtin);
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = _map();
+    if (err == ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "seeding devnames partition with built-in names");
+        err = _write(_builtin, ARRAY_SIZE(_builtin));
+    }
+    ESP_LOGI(TAG, "%u names", _names.count);
+    return err;
+}
+
+void
+bda2devName(uint8_t const * const bda, char * const name, size_t name_len) {
+
+    xSemaphoreTake(_names.mutex, portMAX_DELAY);
+    {
+        uint lo = 0, hi = _names.count;
+        while (lo < hi) {
+            uint const mid = (lo + hi) / 2;
+            int const cmp = memcmp(bda, _names.entries[mid].bda, ESP_BD_ADDR_LEN);
+            if (cmp == 0) {
+                snprintf(name, name_len, "%.*s", DEVNAME_NAME_LEN, _names.entries[mid].name);
+                xSemaphoreGive(_names.mutex);
+                return;
+            }
+            if (cmp < 0) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+    }
+    xSemaphoreGive(_names.mutex);
+	snprintf(name, name_len, "esp32_%02x%02x",
+			 bda[ESP_BD_ADDR_LEN-2], bda[ESP_BD_ADDR_LEN-1]);
+}
+
+uint
+devName_count(void)
+{
+    return _names.count;
+}
+
+uint
+devName_capacity(void)
+{
+    return _names.part ? (_names.part->size - sizeof(devNameHdr_t)) / sizeof(devNameEntry_t) : 0;
+}
+
+/*
+ * Replaces (or with `merge`, adds to) the table with whitespace separated "aa:bb:cc:dd:ee:ff=name"
+ * pairs from `text`.  On a duplicate address, the last one wins.
+ */
+
+typedef struct devNameSeq_t {
+    devNameEntry_t entry;
+    uint           seq;  // position in the input, to let later entries win
+} devNameSeq_t;
+
+static int
+_cmpSeq(void const * const a, void const * const b)
+{
+    int const cmp = _cmpEntry(a, b);
+    return cmp ? cmp : (int)((devNameSeq_t const *)a)->seq - (int)((devNameSeq_t const *)b)->seq;
+}
+
+esp_err_t
+devName_load(char const * const text, size_t const text_len, bool const merge)
+{
+    if (_names.part == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint const capacity = devName_capacity();
+    uint const oldCount = merge ? _names.count : 0;
+    devNameSeq_t * const seqs = malloc((oldCount + text_len / 14 + 1) * sizeof(devNameSeq_t));  // 14 = shortest pair + separator
+    if (seqs == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    uint count = 0;
+    for (; count < oldCount; count++) {
+        seqs[count] = (devNameSeq_t) { .entry = _names.entries[count], .seq = count };
+    }
+    char const * p = text;
+    char const * const end = text + text_len;
+    while (p < end) {
+        while (p < end && isspace((int)*p)) p++;
+        char const * const tok = p;
+        while (p < end && !isspace((int)*p)) p++;
+        if (p == tok) {
+            break;
+        }
+        char pair[ESP_BD_ADDR_LEN * 3 + DEVNAME_NAME_LEN + 1];
+        snprintf(pair, sizeof(pair), "%.*s", (int)(p - tok), tok);
+
+        devNameSeq_t * const s = seqs + count;
+        uint8_t * const b = s->entry.bda;
+        char fmt[48];
+        snprintf(fmt, sizeof(fmt), "%%hhx:%%hhx:%%hhx:%%hhx:%%hhx:%%hhx=%%%us", DEVNAME_NAME_LEN - 1);
+        memset(&s->entry, 0, sizeof(s->entry));
+        if (sscanf(pair, fmt, b, b + 1, b + 2, b + 3, b + 4, b + 5, s->entry.name) != 7) {
+            ESP_LOGW(TAG, "ignoring \"%s\"", pair);
+            continue;
+        }
+        s->seq = count++;
+    }
+    qsort(seqs, count, sizeof(*seqs), _cmpSeq);
+
+    // compact in place, keeping the last of each address
+    devNameEntry_t * const entries = (devNameEntry_t *)seqs;
+    uint unique = 0;
+    for (uint ii = 0; ii < count; ii++) {
+        if (ii + 1 < count && _cmpEntry(&seqs[ii], &seqs[ii + 1]) == 0) {
+            continue;
+        }
+        memmove(entries + unique++, &seqs[ii].entry, sizeof(devNameEntry_t));
+    }
+    esp_err_t err = ESP_ERR_INVALID_SIZE;
+    if (unique <= capacity) {
+        xSemaphoreTake(_names.mutex, portMAX_DELAY);
+        err = _write(entries, unique);
+        xSemaphoreGive(_names.mutex);
+    }
+    free(seqs);
+    ESP_LOGI(TAG, "%u names (%s)", _names.count, esp_err_to_name(err));
+    return err;
+}
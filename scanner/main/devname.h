@@ -0,0 +1,8 @@
+#pragma once
+
+esp_err_t devName_init(void);
+char * bda2str(uint8_t const * const bda, char * const str);
+void bda2devName(uint8_t const * const bda, char * const name, size_t name_len);
+uint devName_count(void);
+uint devName_capacity(void);
+esp_err_t devName_load(char const * const text, size_t const text_len, bool const merge);
@@ -0,0 +1,85 @@
+/**
+ * @brief fixed-size latency histogram with percentiles
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "histo.h"
+
+static uint
+_idx(uint32_t const value)
+{
+    if (value < HISTO_SUB) {
+        return value;  // values below HISTO_SUB get a bucket each
+    }
+    uint const msb = 31 - __builtin_clz(value);
+    uint const sub = (value >> (msb - HISTO_SUB_BITS)) & (HISTO_SUB - 1);
+    uint const idx = (msb - HISTO_SUB_BITS + 1) * HISTO_SUB + sub;
+    return idx < HISTO_LEN ? idx : HISTO_LEN - 1;
+}
+
+// largest value that maps to bucket `idx`
+
+static uint32_t
+_upper(uint const idx)
+{
+    if (idx < HISTO_SUB) {
+        return idx;
+    }
+    uint const msb = idx / HISTO_SUB + HISTO_SUB_BITS - 1;
+    uint const sub = idx % HISTO_SUB;
+    uint64_t const lower = ((uint64_t)(HISTO_SUB + sub)) << (msb - HISTO_SUB_BITS);
+    return (uint32_t)(lower + ((uint64_t)1 << (msb - HISTO_SUB_BITS)) - 1);
+}
+
+void
+histo_reset(histo_t * const histo)
+{
+    memset(histo, 0, sizeof(*histo));
+}
+
+void
+histo_add(histo_t * const histo, uint32_t const value)
+{
+    histo->bucket[_idx(value)]++;
+    histo->cnt++;
+    if (value > histo->max) {
+        histo->max = value;
+    }
+}
+
+uint32_t
+histo_percentile(histo_t const * const histo, uint const pct)
+{
+    if (histo->cnt == 0) {
+        return 0;
+    }
+    uint64_t const rank = ((uint64_t)histo->cnt * pct + 99) / 100;  // 1-based
+    uint64_t seen = 0;
+    for (uint ii = 0; ii < HISTO_LEN; ii++) {
+        seen += histo->bucket[ii];
+        if (seen >= rank) {
+            uint32_t const upper = _upper(ii);
+            return upper < histo->max ? upper : histo->max;
+        }
+    }
+    return histo->max;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Fixed-size latency histogram.  Each power of 2 is split in HISTO_SUB buckets, so a
+ * percentile is accurate to within 1/HISTO_SUB of its value.
+ */
+
+#define HISTO_SUB_BITS (3)
+#define HISTO_SUB (1 << HISTO_SUB_BITS)
+#define HISTO_OCTAVES (26)  // up to 2^26 usec, about 67 sec
+#define HISTO_LEN (HISTO_OCTAVES * HISTO_SUB)
+
+typedef struct histo_t {
+    uint32_t bucket[HISTO_LEN];
+    uint32_t cnt;
+    uint32_t max;
+} histo_t;
+
+void histo_reset(histo_t * const histo);
+void histo_add(histo_t * const histo, uint32_t const value);
+uint32_t histo_percentile(histo_t const * const histo, uint const pct);
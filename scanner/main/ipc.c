@@ -0,0 +1,170 @@
+/**
+ * @brief inter-task messaging using preallocated fixed-size slots
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "ipc.h"
+
+static char const * const TAG = "ipc";
+
+char const * const ipc_scanFmtNames[IPC_SCAN_FMT_BOTH + 1] = {
+    [IPC_SCAN_FMT_JSON] = "json",
+    [IPC_SCAN_FMT_BIN] = "bin",
+    [IPC_SCAN_FMT_BOTH] = "both",
+};
+
+static ipc_to_mqtt_msg_t _toMqttSlots[CONFIG_BLESCAN_IPC_TO_MQTT_DEPTH];
+static ipc_to_ble_msg_t _toBleSlots[CONFIG_BLESCAN_IPC_TO_BLE_DEPTH];
+static ipc_q_t _toMqttQ = {};
+static ipc_q_t _toBleQ = {};
+
+static void
+_initQ(ipc_q_t * const q, void * const slots, size_t const slot_size, uint const depth)
+{
+    q->depth = depth;
+    q->q = xQueueCreate(depth, sizeof(void *));
+    q->freeQ = xQueueCreate(depth, sizeof(void *));
+    assert(q->q && q->freeQ);
+
+    for (uint ii = 0; ii < depth; ii++) {
+        void * const slot = (uint8_t *)slots + ii * slot_size;
+        BaseType_t const res = xQueueSendToBack(q->freeQ, &slot, 0);
+        assert(res == pdPASS);
+    }
+}
+
+void
+ipc_init(ipc_t * const ipc)
+{
+    _initQ(&_toMqttQ, _toMqttSlots, sizeof(*_toMqttSlots), ARRAY_SIZE(_toMqttSlots));
+    _initQ(&_toBleQ, _toBleSlots, sizeof(*_toBleSlots), ARRAY_SIZE(_toBleSlots));
+    ipc->toMqttQ = &_toMqttQ;
+    ipc->toBleQ = &_toBleQ;
+}
+
+/*
+ * Returns a free slot, or NULL when all slots are in use.  Never blocks, so it is safe
+ * to call from callbacks.
+ */
+
+void *
+ipc_claim(ipc_q_t * const q)
+{
+    void * const slot = ipc_tryClaim(q);
+    if (slot == NULL) {
+        atomic_fetch_add_explicit(&q->drop, 1, memory_order_relaxed);
+    }
+    return slot;
+}
+
+// same, for callers that hold on to the message and try again later, so it isn't a drop
+
+void *
+ipc_tryClaim(ipc_q_t * const q)
+{
+    void * slot;
+    if (xQueueReceive(q->freeQ, &slot, 0) != pdPASS) {
+        return NULL;
+    }
+    return slot;
+}
+
+void
+ipc_send(ipc_q_t * const q, void * const slot)
+{
+    // can't fail, the queue holds as many entries as there are slots
+    BaseType_t const res = xQueueSendToBack(q->q, &slot, 0);
+    assert(res == pdPASS);
+
+    uint const waiting = uxQueueMessagesWaiting(q->q);
+    uint hwm = atomic_load_explicit(&q->hwm, memory_order_relaxed);
+    while (waiting > hwm && !atomic_compare_exchange_weak_explicit(&q->hwm, &hwm, waiting, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void *
+ipc_receive(ipc_q_t * const q, TickType_t const wait)
+{
+    void * slot;
+    if (xQueueReceive(q->q, &slot, wait) != pdPASS) {
+        return NULL;
+    }
+    return slot;
+}
+
+void
+ipc_release(ipc_q_t * const q, void * const slot)
+{
+    if (xQueueSendToBack(q->freeQ, &slot, 0) != pdPASS) {
+        ESP_LOGE(TAG, "slot released twice");
+    }
+}
+
+/*
+ * Convenience wrappers that copy a message into a free slot and send it.  When no slot is
+ * available, the message is dropped.
+ */
+
+void
+sendToBle(ipc_to_ble_typ_t const dataType, char const * const data, size_t const data_len, ipc_t const * const ipc)
+{
+    ipc_to_ble_msg_t * const msg = ipc_claim(ipc->toBleQ);
+    if (msg == NULL) {
+        ESP_LOGE(TAG, "toBleQ full");
+        return;
+    }
+    if (data_len >= sizeof(msg->data)) {
+        ESP_LOGE(TAG, "toBleQ msg too long (%u)", (uint)data_len);
+        ipc_release(ipc->toBleQ, msg);
+        return;
+    }
+    msg->dataType = dataType;
+    msg->dataLen = data_len;
+    memcpy(msg->data, data, data_len);
+    msg->data[data_len] = '\0';
+    ipc_send(ipc->toBleQ, msg);
+}
+
+void
+sendToMqtt(ipc_to_mqtt_typ_t const dataType, char const * const data, ipc_t const * const ipc)
+{
+    ipc_to_mqtt_msg_t * const msg = ipc_claim(ipc->toMqttQ);
+    if (msg == NULL) {
+        ESP_LOGE(TAG, "toMqttQ full");
+        return;
+    }
+    size_t const data_len = strlen(data);
+    if (data_len >= sizeof(msg->data)) {
+        ESP_LOGE(TAG, "toMqttQ msg too long (%u)", (uint)data_len);
+        ipc_release(ipc->toMqttQ, msg);
+        return;
+    }
+    msg->dataType = dataType;
+    msg->time = 0;
+    msg->dataLen = data_len;
+    memcpy(msg->data, data, data_len + 1);
+    ipc_send(ipc->toMqttQ, msg);
+}
@@ -32,47 +32,136 @@
 #define WIFI_DEVNAME_LEN (32)
 #define WIFI_DEVIPADDR_LEN (16)
 
+/*
+ * Messages between tasks travel in preallocated fixed-size slots.  The sender claims a free
+ * slot, fills it in place and sends it; the recipient releases it after use.  Neither side
+ * allocates memory.  When no slot is free, the message is dropped and counted.  Any task or
+ * callback may send, so the counters are atomic.
+ */
+
+typedef struct ipc_q_t {
+    QueueHandle_t q;      // claimed slots, in transit to the recipient
+    QueueHandle_t freeQ;  // slots available to be claimed
+    uint          depth;  // number of slots
+    _Atomic uint  hwm;    // high-water mark of slots in transit
+    _Atomic uint  drop;   // messages dropped because no slot was available
+} ipc_q_t;
+
+typedef struct ipc_count_t ipc_count_t;
+typedef struct ipc_radio_t ipc_radio_t;
+
 typedef struct ipc_t {
-    QueueHandle_t toBleQ;
-    QueueHandle_t toMqttQ;
+    ipc_q_t * toBleQ;
+    ipc_q_t * toMqttQ;
     struct dev {
         char bda[BLE_DEVMAC_LEN];
         char ipAddr[WIFI_DEVIPADDR_LEN];
         char name[WIFI_DEVNAME_LEN];
-        struct count {
+        volatile bool online;  // connected to the broker, scan results go to the scan log otherwise
+        struct ipc_count_t {
             uint wifiAuthErr;
             uint wifiConnect;
             uint mqttConnect;
-        } count;
+            uint advRx;         // scan results seen by the GAP callback
+            uint beaconRx;      // .. of which were beacons with an identity (iBeacon, AltBeacon, Eddystone-UID)
+            uint scanDrop;      // .. dropped because the scan ring was full
+            uint ringHwm;       // high-water mark of the scan ring
+            uint scanEnqueued;  // scan messages handed to the MQTT task
+            uint scanPublished; // scan results published (each record in a batch counts)
+            uint gapCbMaxUs;    // longest GAP callback for a scan result [usec]
+            uint64_t gapCbTotUs;  // sum of GAP callback durations for scan results [usec]
+            uint summaryEvict;  // beacons summarized early to make room in the table
+            uint summaryDrop;   // .. of which the summary found no free message slot
+            uint trackSuppressed;  // scan results not reported, as their beacon's smoothed RSSI hardly changed
+            uint trackEvict;    // beacons forgotten to make room in the tracking table
+            uint sampleSkip;    // scan results left out by 1-in-N sampling under backpressure
+            uint probeEvict;    // probe advertisers forgotten to make room, see probe.h
+        } count;  // each counter has a single writer
+        struct ipc_radio_t {
+            uint64_t advUs;        // time spent advertising [usec]
+            uint64_t scanUs;       // time spent scanning [usec]
+            uint     switches;     // switches between advertising and scanning
+            uint64_t switchTotUs;  // sum of the time the radio did neither while switching [usec]
+            uint     switchMaxUs;  // longest switch [usec]
+            uint     gapRetry;     // GAP commands retried after failing or timing out
+            uint     gapFail;      // .. and given up on
+        } radio;  // written by ble_task
     } dev;
+    struct cfg {
+        volatile uint scanFmt;    // IPC_SCAN_FMT_* bit mask, set by the "fmt" control message
+        volatile uint summaryMs;  // per-beacon summary window [msec], 0 reports each scan result
+        volatile uint trackFilter;  // beaconTrack_filter_t, set by the "track" control message, off reports each scan result
+        volatile uint trackDb;      // report when a beacon's smoothed RSSI moved this far [dB]
+        volatile uint trackMs;      // .. or when it wasn't reported for this long [msec]
+        volatile uint pressure;     // ipc_pressure_t, set by mqtt_task when the uplink can't keep up
+        volatile uint probeMs;      // probe report window [msec], set by the "probe" control message, 0 doesn't measure
+    } cfg;
 } ipc_t;
 
+// scan result wire formats, both can be enabled at the same time
+
+#define IPC_SCAN_FMT_JSON (0x01)  // published on the `scan` subtopic
+#define IPC_SCAN_FMT_BIN  (0x02)  // published on the `scanbin` subtopic, see blescan_wire.h
+#define IPC_SCAN_FMT_BOTH (IPC_SCAN_FMT_JSON | IPC_SCAN_FMT_BIN)
+
+extern char const * const ipc_scanFmtNames[IPC_SCAN_FMT_BOTH + 1];  // indexed by the bit mask
+
+// how scan_task reports, degraded by mqtt_task under backpressure
+
+#define IPC_PRESSURE_MAP(XX) \
+  XX(0, raw)      /* each scan result */ \
+  XX(1, sample)   /* 1 in BLESCAN_BACKPRESSURE_SAMPLE_N scan results */ \
+  XX(2, summary)  /* per-beacon summaries every BLESCAN_BACKPRESSURE_SUMMARY_MSEC, unless "summary" set a window */
+
+typedef enum ipc_pressure_t {
+#define XX(num, name) IPC_PRESSURE_##name = num,
+  IPC_PRESSURE_MAP(XX)
+#undef XX
+  IPC_PRESSURE_COUNT
+} ipc_pressure_t;
+
 // to MQTT
 
 typedef enum ipc_to_mqtt_typ_t {
     IPC_TO_MQTT_IPC_DEV_AVAILABLE,
     IPC_TO_MQTT_MSGTYPE_SCAN,
+    IPC_TO_MQTT_MSGTYPE_SCAN_BIN,
+    IPC_TO_MQTT_MSGTYPE_SUMMARY,
     IPC_TO_MQTT_MSGTYPE_RESTART,
     IPC_TO_MQTT_MSGTYPE_WHO,
     IPC_TO_MQTT_MSGTYPE_MODE,
-    IPC_TO_MQTT_MSGTYPE_DBG
+    IPC_TO_MQTT_MSGTYPE_DBG,
+    IPC_TO_MQTT_MSGTYPE_STATS,
+    IPC_TO_MQTT_MSGTYPE_PROBE,
+    IPC_TO_MQTT_MSGTYPE_SCAN_LOG,  // binary scan results for the scan log, not published
 } ipc_to_mqtt_typ_t;
 
 typedef struct ipc_to_mqtt_msg_t {
     ipc_to_mqtt_typ_t  dataType;
-    char *             data;  // must be freed by recipient
+    int64_t            time;  // esp_timer_get_time() in the GAP callback for scan results, else 0 [usec]
+    uint               dataLen;
+    char               data[CONFIG_BLESCAN_IPC_TO_MQTT_MSG_SIZE];
 } ipc_to_mqtt_msg_t;
 
 // to BLE
 
 typedef enum ipc_to_ble_typ_t {
-    IPC_TO_BLE_TYP_CTRL
+    IPC_TO_BLE_TYP_CTRL,
+    IPC_TO_BLE_TYP_AT,  // a control message scheduled with "at" is due
 } ipc_to_ble_typ_t;
 
 typedef struct ipc_to_ble_msg_t {
     ipc_to_ble_typ_t  dataType;
-    char *            data;  // must be freed by recipient
+    uint              dataLen;
+    char              data[CONFIG_BLESCAN_IPC_TO_BLE_MSG_SIZE];  // zero terminated
 } ipc_to_ble_msg_t;
 
+void ipc_init(ipc_t * const ipc);
+void * ipc_claim(ipc_q_t * const q);
+void * ipc_tryClaim(ipc_q_t * const q);
+void ipc_send(ipc_q_t * const q, void * const slot);
+void * ipc_receive(ipc_q_t * const q, TickType_t const wait);
+void ipc_release(ipc_q_t * const q, void * const slot);
+
 void sendToBle(ipc_to_ble_typ_t const dataType, char const * const data, size_t const data_len, ipc_t const * const ipc);
 void sendToMqtt(ipc_to_mqtt_typ_t const dataType, char const * const data, ipc_t const * const ipc);
\ No newline at end of file
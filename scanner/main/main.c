@@ -38,7 +38,16 @@
 #include <factory_reset_task.h>
 #include "ipc.h"
 #include "mqtt_task.h"
+#include "devname.h"
+#include "esp_ibeacon_api.h"
+#include "scan_filter.h"
+#include "blescan_wire.h"
+#include "scan_log.h"
+#include "beacon_tbl.h"
+#include "beacon_track.h"
+#include "timesync.h"
 #include "ble_task.h"
+#include "scan_task.h"
 
 static char const * const TAG = "main";
 
@@ -68,6 +77,7 @@ _wifi_connect_cb(void * const priv_void, esp_ip4_addr_t const * const ip)
 	//board_name(ipc->dev.name, WIFI_DEVNAME_LEN);
 
     ipc->dev.count.wifiConnect++;
+    timeSync_start();  // no-op once running
     return ESP_OK;
 }
 
@@ -81,6 +91,7 @@ _wifi_disconnect_cb(void * const priv_void, bool const auth_err)
         ipc->dev.count.wifiAuthErr++;
         // 2BD: should probably reprovision on repeated auth_err and return ESP_FAIL
     }
+    ipc->dev.online = false;  // don't wait for the MQTT keep-alive to notice
     ESP_LOGW(TAG, "Wifi disconnect connectCnt=%u, authErrCnt=%u", ipc->dev.count.wifiConnect, ipc->dev.count.wifiAuthErr);
     return ESP_OK;
 }
@@ -142,18 +153,38 @@ _connect2wifi(ipc_t * const ipc)
 void app_main() {
 
 	_init_nvs();
+    devName_init();  // falls back to built-in names on error
+    scanFilter_init();  // accepts everything on error
+    scanLog_init();     // scan results are lost while disconnected on error
 
     ESP_LOGI(TAG, "starting ..");
     xTaskCreate(&factory_reset_task, "factory_reset_task", 4096, NULL, 5, NULL);
 
-    static ipc_t ipc = {};
-    ipc.toBleQ = xQueueCreate(2, sizeof(ipc_to_ble_msg_t));
-    ipc.toMqttQ = xQueueCreate(2, sizeof(ipc_to_mqtt_msg_t));
-    assert(ipc.toBleQ && ipc.toMqttQ);
+    static ipc_t ipc = {
+        .cfg = {
+#if defined(CONFIG_BLESCAN_SCAN_FORMAT_BIN)
+            .scanFmt = IPC_SCAN_FMT_BIN,
+#elif defined(CONFIG_BLESCAN_SCAN_FORMAT_BOTH)
+            .scanFmt = IPC_SCAN_FMT_JSON | IPC_SCAN_FMT_BIN,
+#else
+            .scanFmt = IPC_SCAN_FMT_JSON,
+#endif
+            .summaryMs = CONFIG_BLESCAN_SUMMARY_WINDOW,
+#if defined(CONFIG_BLESCAN_TRACK_FILTER_EMA)
+            .trackFilter = BEACON_TRACK_FILTER_ema,
+#elif defined(CONFIG_BLESCAN_TRACK_FILTER_KALMAN)
+            .trackFilter = BEACON_TRACK_FILTER_kalman,
+#endif
+            .trackDb = CONFIG_BLESCAN_TRACK_HYST_DB,
+            .trackMs = CONFIG_BLESCAN_TRACK_SILENCE_MSEC,
+        },
+    };
+    ipc_init(&ipc);
 
     _connect2wifi(&ipc);
 
 	xTaskCreate(&ota_update_task, "ota_update_task", 2 * 4096, "scanner", 5, NULL);
+    xTaskCreate(&scan_task, "scan_task", 4096, &ipc, CONFIG_BLESCAN_SCAN_TASK_PRIORITY, NULL);
     xTaskCreate(&ble_task, "ble_task", 2 * 4096, &ipc, 5, NULL);
     xTaskCreate(&mqtt_task, "mqtt_task", 2 * 4096, &ipc, 5, NULL);
 }
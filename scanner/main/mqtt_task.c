@@ -19,6 +19,7 @@
   */
 
 #include <sdkconfig.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <esp_event.h>
@@ -31,10 +32,22 @@
 #include <freertos/task.h>
 #include <mqtt_client.h>
 #include <esp_ota_ops.h>
+#include <esp_timer.h>
 #include <nvs_flash.h>
 #include <nvs.h>
 
+#include "blescan_wire.h"
+#include "blescan_lz.h"
 #include "ipc.h"
+#include "histo.h"
+#include "devname.h"
+#include "esp_ibeacon_api.h"
+#include "scan_filter.h"
+#include "scan_log.h"
+#include "beacon_tbl.h"
+#include "beacon_track.h"
+#include "timesync.h"
+#include "outbox.h"
 #include "mqtt_task.h"
 
 static char const * const TAG = "mqtt_task";
@@ -44,25 +57,400 @@ typedef enum {
 	MQTT_EVENT_CONNECTED_BIT = BIT0
 } mqttEvent_t;
 
+// topics are fixed once the device name is known, and built once in _initTopics()
+
+#define MQTT_TOPIC_LEN (sizeof(CONFIG_BLESCAN_MQTT_DATA_TOPIC) + sizeof("/scanbin/") + WIFI_DEVNAME_LEN)
+
 static struct {
     char * ctrl;
     char * ctrlGroup;
+    char   data[MQTT_TOPIC_LEN];  // for message types without a subtopic
 } _topic;
 
+/*
+ * Subtopic and QoS per message type.  Scan data defaults to QoS 0, where a lost sample
+ * doesn't matter and esp-mqtt keeps no copy.  At QoS 1 or 2, scan data goes through the
+ * capped outbox (outbox.c).
+ */
+
+typedef struct subtopic_t {
+    ipc_to_mqtt_typ_t const type;
+    char const * const      name;
+    uint                    qos;  // set by the "qos" control message
+    char                    topic[MQTT_TOPIC_LEN];
+} subtopic_t;
+
+static subtopic_t _subtopics[] = {
+    { IPC_TO_MQTT_MSGTYPE_SCAN, "scan", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+    { IPC_TO_MQTT_MSGTYPE_SCAN_BIN, "scanbin", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+    { IPC_TO_MQTT_MSGTYPE_SUMMARY, "summary", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+    { IPC_TO_MQTT_MSGTYPE_RESTART, "restart", CONFIG_BLESCAN_MQTT_QOS_CTRL, "" },
+    { IPC_TO_MQTT_MSGTYPE_WHO, "who", CONFIG_BLESCAN_MQTT_QOS_CTRL, "" },
+    { IPC_TO_MQTT_MSGTYPE_MODE, "mode", CONFIG_BLESCAN_MQTT_QOS_CTRL, "" },
+    { IPC_TO_MQTT_MSGTYPE_DBG, "dbg", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+    { IPC_TO_MQTT_MSGTYPE_STATS, "stats", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+    { IPC_TO_MQTT_MSGTYPE_PROBE, "probe", CONFIG_BLESCAN_MQTT_QOS_DATA, "" },
+};
+
+/*
+ * In batch mode, scan results that arrive within a time window are combined into a single
+ * JSON array, so the broker sees one PUBLISH per window instead of one per advertisement.
+ * The batch is flushed early when the next record would exceed the byte budget.
+ */
+
+#define BATCH_FLUSH_MAP(XX) \
+  XX(0, window) \
+  XX(1, size) \
+  XX(2, ctrl) \
+  XX(3, clock)  /* binary records can't share a baseTime when the clock got synced or stepped back in between */
+
+typedef enum {
+#define XX(num, name) BATCH_FLUSH_##name = num,
+  BATCH_FLUSH_MAP(XX)
+#undef XX
+  BATCH_FLUSH_COUNT
+} batchFlush_t;
+
+static const char * const _batchFlushes[] = {
+#define XX(num, name) #name,
+  BATCH_FLUSH_MAP(XX)
+#undef XX
+};
+
+#define BATCH_MAX_RECS (CONFIG_BLESCAN_BATCH_MAX_BYTES / sizeof(blescan_wire_rec_t))
+
+typedef struct batch_t {
+    ipc_to_mqtt_typ_t const dataType;  // IPC_TO_MQTT_MSGTYPE_SCAN or .._SCAN_BIN
+    char       buf[CONFIG_BLESCAN_BATCH_MAX_BYTES];
+    uint       len;    // bytes used in `buf`
+    uint       cnt;    // scan results in `buf`
+    TickType_t start;  // when the first scan result was added
+    uint32_t   times[BATCH_MAX_RECS];  // GAP callback time of each scan result, for the latency histogram [usec]
+} batch_t;
+
+static struct {
+    volatile uint windowMs;  // requested window [msec], 0 publishes every scan result individually
+    volatile uint maxBytes;  // requested byte budget
+    uint       curWindowMs;  // window currently applied by mqtt_task
+    uint       curMaxBytes;
+    batch_t    json;         // JSON array of scan results
+    batch_t    bin;          // blescan_wire_hdr_t followed by blescan_wire_rec_t's
+    struct {
+        uint     flushes[BATCH_FLUSH_COUNT];
+        uint     records;    // scan results published in batches
+        uint64_t bytes;      // bytes published in batches
+        uint64_t limit;      // sum of the byte limit that applied to each, for the average fill
+    } stats;
+} _batch = {
+    .windowMs = CONFIG_BLESCAN_BATCH_WINDOW,
+    .maxBytes = CONFIG_BLESCAN_BATCH_MAX_BYTES,
+    .json = { .dataType = IPC_TO_MQTT_MSGTYPE_SCAN },
+    .bin = { .dataType = IPC_TO_MQTT_MSGTYPE_SCAN_BIN },
+};
+
+/*
+ * Periodic pipeline statistics on the `stats` subtopic.  The latency histogram covers the time
+ * from the GAP callback until the scan result is handed to the MQTT client, and restarts each period.
+ */
+
+static struct {
+    volatile uint periodSec;  // 0 disables
+    TickType_t    last;       // when the statistics were last published
+    histo_t       latency;    // [usec]
+} _stats = {
+    .periodSec = CONFIG_BLESCAN_STATS_PERIOD,
+};
+
+/*
+ * Scan results stored in the scan log while disconnected are replayed after reconnecting,
+ * one binary payload at a time, at no more than CONFIG_BLESCAN_SCANLOG_REPLAY_RATE records
+ * per second so that live scan results keep flowing.
+ */
+
+static struct {
+    TickType_t next;  // when the next payload may be published
+    uint8_t    buf[sizeof(blescan_wire_hdr_t) + CONFIG_BLESCAN_SCANLOG_REPLAY_BATCH * sizeof(blescan_wire_rec_t)];
+} _replay = {};
+
+/*
+ * Binary scan payloads can be published with their records compressed as one LZ4 block, and
+ * BLESCAN_WIRE_FLAG_LZ4 set in the header.  Repeat sightings of the same beacon within a batch
+ * compress well; a payload that doesn't get smaller is published as is.
+ */
+
+static struct {
+    volatile bool on;       // set by the "compress" control message
+    blescan_lz_t  lz;       // compressor's hash table
+    uint8_t       buf[sizeof(blescan_wire_hdr_t) + BLESCAN_LZ_BOUND(CONFIG_BLESCAN_BATCH_MAX_BYTES)];
+    struct {
+        uint64_t in;        // bytes offered for compression
+        uint64_t out;       // .. and what was published for them
+        uint64_t us;        // time spent compressing [usec]
+    } stats;
+} _compress = {
+#ifdef CONFIG_BLESCAN_COMPRESS
+    .on = true,
+#endif
+};
+
+/*
+ * Backpressure.  When toMqttQ or the outbox stays fuller than BLESCAN_BACKPRESSURE_HIGH_PCT, or
+ * scan results keep being dropped, for BLESCAN_BACKPRESSURE_HOLD_MSEC, scan_task is told to report
+ * less: first 1 in N scan results, then per-beacon summaries.  Once both stay below
+ * BLESCAN_BACKPRESSURE_LOW_PCT without drops for BLESCAN_BACKPRESSURE_RECOVER_MSEC, it steps back.
+ * The fill is averaged over time, in periods of BACKPRESSURE_PERIOD_MSEC, so that the burst of
+ * messages at the end of a summary window or batch, which is gone in no time, hardly counts.
+ */
+
+#define BACKPRESSURE_PERIOD_MSEC (250)
+
+static const char * const _pressures[] = {
+#define XX(num, name) #name,
+  IPC_PRESSURE_MAP(XX)
+#undef XX
+};
+
+static struct {
+    volatile bool on;       // set by the "backpressure" control message
+    int64_t       start;    // of the current period [usec]
+    int64_t       sampled;  // when the fill was last sampled [usec]
+    uint          fillPct;  // .. and what it was, the fuller of toMqttQ and the outbox
+    uint64_t      fillSum;  // fill weighted by how long it lasted, in this period [% usec]
+    uint          drops;    // drop counters summed, at the start of this period
+    int64_t       high;     // how long the pressure has been high [usec]
+    int64_t       low;      // .. or low
+    uint          transitions;
+} _pressure = {
+#ifdef CONFIG_BLESCAN_BACKPRESSURE
+    .on = true,
+#endif
+};
+
 static esp_mqtt_client_handle_t _connect2broker(ipc_t const * const ipc);  // forward decl
 
-void
-sendToMqtt(ipc_to_mqtt_typ_t const dataType, char const * const data, ipc_t const * const ipc)
+static void
+_batchCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    char args[32];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    uint windowMs, maxBytes;
+    int const argc = sscanf(args, "batch %u %u", &windowMs, &maxBytes);
+    if (argc >= 1) {
+        _batch.windowMs = MIN(windowMs, 60000U);
+    }
+    if (argc >= 2) {
+        _batch.maxBytes = MAX(MIN(maxBytes, sizeof(_batch.json.buf)), 64U);
+    }
+    uint flushes = 0;
+    for (uint ii = 0; ii < BATCH_FLUSH_COUNT; ii++) {
+        flushes += _batch.stats.flushes[ii];
+    }
+    char payload[256];
+    int len = snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"batch\": { \"window\": %u, \"bytes\": %u, \"batches\": %u, \"avgRecords\": %u, \"avgFill\": %u, \"flush\": {",
+             _batch.windowMs, _batch.maxBytes, flushes,
+             flushes ? _batch.stats.records / flushes : 0,
+             _batch.stats.limit ? (uint)(_batch.stats.bytes * 100 / _batch.stats.limit) : 0);  // [%]
+    for (uint ii = 0; ii < BATCH_FLUSH_COUNT; ii++) {
+        len += snprintf(payload + len, sizeof(payload) - len, "%s \"%s\": %u",
+                        ii ? "," : "", _batchFlushes[ii], _batch.stats.flushes[ii]);
+    }
+    snprintf(payload + len, sizeof(payload) - len, " } } } }");
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_fmtCtrl(char const * const data, int const data_len, ipc_t * const ipc)
+{
+    char args[16];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+    char const * const arg = strchr(args, ' ');
+
+    for (uint ii = 0; arg && ii < ARRAY_SIZE(ipc_scanFmtNames); ii++) {
+        if (ipc_scanFmtNames[ii] && strcmp(arg + 1, ipc_scanFmtNames[ii]) == 0) {
+            ipc->cfg.scanFmt = ii;
+        }
+    }
+    char payload[48];
+    snprintf(payload, sizeof(payload), "{ \"response\": { \"fmt\": \"%s\" } }", ELEM_AT(ipc_scanFmtNames, ipc->cfg.scanFmt, "?"));
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_compressCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    char args[16];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    if (strcmp(args, "compress on") == 0) {
+        _compress.on = true;
+    } else if (strcmp(args, "compress off") == 0) {
+        _compress.on = false;
+    }
+    char payload[128];
+    snprintf(payload, sizeof(payload), "{ \"response\": { \"compress\": { \"on\": %s, \"in\": %" PRIu64 ", \"out\": %" PRIu64 ", \"us\": %" PRIu64 " } } }",
+             _compress.on ? "true" : "false", _compress.stats.in, _compress.stats.out, _compress.stats.us);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_summaryCtrl(char const * const data, int const data_len, ipc_t * const ipc)
+{
+    char args[32];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    uint windowMs;
+    if (sscanf(args, "summary %u", &windowMs) == 1) {
+        ipc->cfg.summaryMs = MIN(windowMs, 3600000U);
+    }
+    char payload[128];
+    snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"summary\": { \"window\": %u, \"evictions\": %u, \"dropped\": %u } } }",
+             ipc->cfg.summaryMs, ipc->dev.count.summaryEvict, ipc->dev.count.summaryDrop);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_trackCtrl(char const * const data, int const data_len, ipc_t * const ipc)
+{
+    char args[48];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    char name[16];
+    uint hystDb, silenceMs;
+    int const n = sscanf(args, "track %15s %u %u", name, &hystDb, &silenceMs);
+    for (uint ii = 0; n >= 1 && ii < BEACON_TRACK_FILTER_COUNT; ii++) {
+        if (strcmp(name, beaconTrack_filterNames[ii]) == 0) {
+            if (n >= 2) {
+                ipc->cfg.trackDb = MIN(hystDb, 100U);
+            }
+            if (n >= 3) {
+                ipc->cfg.trackMs = MIN(silenceMs, 3600000U);
+            }
+            ipc->cfg.trackFilter = ii;
+        }
+    }
+    char payload[160];
+    snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"track\": { \"filter\": \"%s\", \"db\": %u, \"silence\": %u, \"suppressed\": %u, \"evictions\": %u } } }",
+             beaconTrack_filterNames[ipc->cfg.trackFilter], ipc->cfg.trackDb, ipc->cfg.trackMs,
+             ipc->dev.count.trackSuppressed, ipc->dev.count.trackEvict);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_namesCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    bool const merge = data_len >= 6 && data[5] == '+';
+    uint const cmd_len = merge ? 6 : 5;  // "names" or "names+"
+
+    esp_err_t err = ESP_OK;
+    if (data_len > cmd_len) {
+        err = devName_load(data + cmd_len, data_len - cmd_len, merge);
+    }
+    char payload[128];
+    snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"names\": { \"count\": %u, \"capacity\": %u, \"status\": \"%s\" } } }",
+             devName_count(), devName_capacity(), esp_err_to_name(err));
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_filterCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    uint const cmd_len = 6;  // "filter"
+
+    esp_err_t err = ESP_OK;
+    if (data_len > cmd_len) {
+        err = scanFilter_load(data + cmd_len, data_len - cmd_len);
+    }
+    char rules[CONFIG_BLESCAN_IPC_TO_MQTT_MSG_SIZE - 64];
+    scanFilter_describe(rules, sizeof(rules));
+    char payload[CONFIG_BLESCAN_IPC_TO_MQTT_MSG_SIZE];
+    snprintf(payload, sizeof(payload), "{ \"response\": { \"filter\": %s, \"status\": \"%s\" } }", rules, esp_err_to_name(err));
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_qosCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    char args[32];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    char name[16];
+    uint qos;
+    if (sscanf(args, "qos %15s %u", name, &qos) == 2) {
+        for (uint ii = 0; ii < ARRAY_SIZE(_subtopics); ii++) {
+            if (strcmp(name, _subtopics[ii].name) == 0) {
+                _subtopics[ii].qos = MIN(qos, 2U);
+            }
+        }
+    }
+    char payload[160];
+    int len = snprintf(payload, sizeof(payload), "{ \"response\": { \"qos\": {");
+    for (uint ii = 0; ii < ARRAY_SIZE(_subtopics); ii++) {
+        len += snprintf(payload + len, sizeof(payload) - len, "%s \"%s\": %u",
+                        ii ? "," : "", _subtopics[ii].name, _subtopics[ii].qos);
+    }
+    snprintf(payload + len, sizeof(payload) - len, " } } }");
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_backpressureCtrl(char const * const data, int const data_len, ipc_t * const ipc)
 {
-    ipc_to_mqtt_msg_t msg = {
-        .dataType = dataType,
-        .data = strdup(data)
-    };
-    assert(msg.data);
-    if (xQueueSendToBack(ipc->toMqttQ, &msg, 0) != pdPASS) {
-        ESP_LOGE(TAG, "toMqttQ full");
-        free(msg.data);
+    char args[24];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    if (strcmp(args, "backpressure on") == 0) {
+        _pressure.on = true;
+    } else if (strcmp(args, "backpressure off") == 0) {
+        _pressure.on = false;
+        ipc->cfg.pressure = IPC_PRESSURE_raw;
     }
+    char payload[128];
+    snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"backpressure\": { \"on\": %s, \"mode\": \"%s\", \"transitions\": %u, \"skipped\": %u } } }",
+             _pressure.on ? "true" : "false", _pressures[ipc->cfg.pressure], _pressure.transitions, ipc->dev.count.sampleSkip);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+// "probe on [MSEC]|off", scan_task measures reception of probe advertisements, see probe.h
+
+static void
+_probeCtrl(char const * const data, int const data_len, ipc_t * const ipc)
+{
+    char args[32];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    uint windowMs = CONFIG_BLESCAN_PROBE_REPORT_MSEC;
+    if (strncmp(args, "probe on", 8) == 0) {
+        sscanf(args, "probe on %u", &windowMs);
+        ipc->cfg.probeMs = MAX(MIN(windowMs, 3600000U), 100U);
+    } else if (strcmp(args, "probe off") == 0) {
+        ipc->cfg.probeMs = 0;
+    }
+    char payload[96];
+    snprintf(payload, sizeof(payload),
+             "{ \"response\": { \"probe\": { \"window\": %u, \"evictions\": %u } } }",
+             ipc->cfg.probeMs, ipc->dev.count.probeEvict);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
+}
+
+static void
+_statsCtrl(char const * const data, int const data_len, ipc_t const * const ipc)
+{
+    char args[32];
+    snprintf(args, sizeof(args), "%.*s", data_len, data);
+
+    uint periodSec;
+    if (sscanf(args, "stats %u", &periodSec) == 1) {
+        _stats.periodSec = MIN(periodSec, 86400U);
+    }
+    char payload[64];
+    snprintf(payload, sizeof(payload), "{ \"response\": { \"stats\": { \"period\": %u } } }", _stats.periodSec);
+    sendToMqtt(IPC_TO_MQTT_MSGTYPE_MODE, payload, ipc);
 }
 
 static esp_err_t
@@ -75,6 +463,7 @@ _mqtt_event_cb(esp_mqtt_event_handle_t event) {
         case MQTT_EVENT_DISCONNECTED:  // indicates that we got disconnected from the MQTT broker
 
             xEventGroupClearBits(_mqttEventGrp, MQTT_EVENT_CONNECTED_BIT);
+            ipc->dev.online = false;
             ESP_LOGW(TAG, "Broker disconnected");
         	// reconnect is part of the SDK
             break;
@@ -82,6 +471,7 @@ _mqtt_event_cb(esp_mqtt_event_handle_t event) {
         case MQTT_EVENT_CONNECTED:  // indicates that we're connected to the MQTT broker
 
             xEventGroupSetBits(_mqttEventGrp, MQTT_EVENT_CONNECTED_BIT);
+            ipc->dev.online = true;
             ipc->dev.count.mqttConnect++;
             ESP_LOGI(TAG, "Broker connected");
 
@@ -90,6 +480,11 @@ _mqtt_event_cb(esp_mqtt_event_handle_t event) {
             ESP_LOGI(TAG, "Subscribed to \"%s\", \"%s\"", _topic.ctrl, _topic.ctrlGroup);
             break;
 
+        case MQTT_EVENT_PUBLISHED:  // the broker acknowledged a QoS 1 or 2 message
+
+            outbox_acked(event->msg_id);
+            break;
+
         case MQTT_EVENT_DATA:  // indicates that data is received on the MQTT control topic
         
             if (event->topic && event->data_len == event->total_data_len) {  // quietly ignores chunked messaegs
@@ -109,18 +504,73 @@ _mqtt_event_cb(esp_mqtt_event_handle_t event) {
                     wifi_ap_record_t ap_info;
                     ESP_ERROR_CHECK(esp_wifi_sta_get_ap_info(&ap_info));
 
-                    char * payload;
-                    int const payload_len = asprintf(&payload,
-                        "{ \"ble\": {\"name\": \"%s\", \"address\": \"%s\"}, \"firmware\": { \"version\": \"%s.%s\", \"date\": \"%s %s\" }, \"wifi\": { \"connect\": %u, \"address\": \"%s\", \"SSID\": \"%s\", \"RSSI\": %d }, \"mqtt\": { \"connect\": %u }, \"mem\": { \"heap\": %u } }",
+                    ipc_to_mqtt_msg_t * const msg = ipc_claim(ipc->toMqttQ);
+                    if (msg == NULL) {
+                        ESP_LOGE(TAG, "toMqttQ full");
+                        break;
+                    }
+                    int const payload_len = snprintf(msg->data, sizeof(msg->data),
+                        "{ \"ble\": {\"name\": \"%s\", \"address\": \"%s\"}, \"firmware\": { \"version\": \"%s.%s\", \"date\": \"%s %s\" }, \"wifi\": { \"connect\": %u, \"address\": \"%s\", \"SSID\": \"%s\", \"RSSI\": %d }, \"mqtt\": { \"connect\": %u }, \"scan\": { \"adv\": %u, \"beacon\": %u, \"drop\": %u, \"gapCbUs\": { \"avg\": %u, \"max\": %u } }, \"ipc\": { \"toMqtt\": { \"depth\": %u, \"hwm\": %u, \"drop\": %u }, \"toBle\": { \"depth\": %u, \"hwm\": %u, \"drop\": %u } }, \"mem\": { \"heap\": %u } }",
                         ipc->dev.name, ipc->dev.bda,
                         running_app_info.project_name, running_app_info.version,
                         running_app_info.date, running_app_info.time,
                         ipc->dev.count.wifiConnect, ipc->dev.ipAddr, ap_info.ssid, ap_info.rssi,
-                        ipc->dev.count.mqttConnect, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+                        ipc->dev.count.mqttConnect,
+                        ipc->dev.count.advRx, ipc->dev.count.beaconRx, ipc->dev.count.scanDrop,
+                        ipc->dev.count.advRx ? (uint)(ipc->dev.count.gapCbTotUs / ipc->dev.count.advRx) : 0, ipc->dev.count.gapCbMaxUs,
+                        ipc->toMqttQ->depth, ipc->toMqttQ->hwm, ipc->toMqttQ->drop,
+                        ipc->toBleQ->depth, ipc->toBleQ->hwm, ipc->toBleQ->drop,
+                        (uint)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+
+                    assert(payload_len >= 0 && payload_len < sizeof(msg->data));
+                    msg->dataType = IPC_TO_MQTT_MSGTYPE_WHO;
+                    msg->time = 0;
+                    msg->dataLen = payload_len;
+                    ipc_send(ipc->toMqttQ, msg);
+
+                } else if (event->data_len >= 5 && strncmp("batch", event->data, 5) == 0) {
+
+                    _batchCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 3 && strncmp("fmt", event->data, 3) == 0) {
+
+                    _fmtCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 7 && strncmp("summary", event->data, 7) == 0) {
+
+                    _summaryCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 5 && strncmp("names", event->data, 5) == 0) {
+
+                    _namesCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 6 && strncmp("filter", event->data, 6) == 0) {
+
+                    _filterCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 5 && strncmp("stats", event->data, 5) == 0) {
+
+                    _statsCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 3 && strncmp("qos", event->data, 3) == 0) {
+
+                    _qosCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 12 && strncmp("backpressure", event->data, 12) == 0) {
+
+                    _backpressureCtrl(event->data, event->data_len, ipc);
 
-                    assert(payload_len >= 0);
-                    sendToMqtt(IPC_TO_MQTT_MSGTYPE_WHO, payload, ipc);
-                    free(payload);
+                } else if (event->data_len >= 5 && strncmp("track", event->data, 5) == 0) {
+
+                    _trackCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 5 && strncmp("probe", event->data, 5) == 0) {
+
+                    _probeCtrl(event->data, event->data_len, ipc);
+
+                } else if (event->data_len >= 8 && strncmp("compress", event->data, 8) == 0) {
+
+                    _compressCtrl(event->data, event->data_len, ipc);
 
                 } else {
                     sendToBle(IPC_TO_BLE_TYP_CTRL, event->data, event->data_len, ipc);
@@ -193,35 +643,375 @@ __attribute__((noreturn)) _delete_task()
     }
 }
 
-static char const *
+static subtopic_t const *
 _type2subtopic(ipc_to_mqtt_typ_t const type)
 {
-    struct mapping {
-        ipc_to_mqtt_typ_t const type;
-        char const * const subtopic;
-    } mapping[] = {
-        { IPC_TO_MQTT_MSGTYPE_SCAN, "scan" },
-        { IPC_TO_MQTT_MSGTYPE_RESTART, "restart" },
-        { IPC_TO_MQTT_MSGTYPE_WHO, "who" },
-        { IPC_TO_MQTT_MSGTYPE_MODE, "mode" },
-        { IPC_TO_MQTT_MSGTYPE_DBG, "dbg" },
-    };
-    for (uint ii = 0; ii < ARRAY_SIZE(mapping); ii++) {
-        if (type == mapping[ii].type) {
-            return mapping[ii].subtopic;
+    for (uint ii = 0; ii < ARRAY_SIZE(_subtopics); ii++) {
+        if (type == _subtopics[ii].type) {
+            return &_subtopics[ii];
         }
     }
     return NULL;
 }
 
+static void
+_initTopics(ipc_t const * const ipc)
+{
+    assert(asprintf(&_topic.ctrl, "%s/%s", CONFIG_BLESCAN_MQTT_CTRL_TOPIC, ipc->dev.name));
+    assert(asprintf(&_topic.ctrlGroup, "%s", CONFIG_BLESCAN_MQTT_CTRL_TOPIC));
+    snprintf(_topic.data, sizeof(_topic.data), "%s/%s", CONFIG_BLESCAN_MQTT_DATA_TOPIC, ipc->dev.name);
+    for (uint ii = 0; ii < ARRAY_SIZE(_subtopics); ii++) {
+        snprintf(_subtopics[ii].topic, sizeof(_subtopics[ii].topic), "%s/%s/%s",
+                 CONFIG_BLESCAN_MQTT_DATA_TOPIC, _subtopics[ii].name, ipc->dev.name);
+    }
+}
+
+// `data_len` is always given, so esp-mqtt doesn't have to strlen() the payload
+
+static int
+_publish(esp_mqtt_client_handle_t const client, ipc_to_mqtt_typ_t const dataType, char const * const data, uint const data_len)
+{
+    subtopic_t const * const subtopic = _type2subtopic(dataType);
+    char const * const topic = subtopic ? subtopic->topic : _topic.data;
+    return esp_mqtt_client_publish(client, topic, data, data_len, subtopic ? subtopic->qos : 1, 0);
+}
+
+typedef struct publishCtx_t {
+    esp_mqtt_client_handle_t client;
+    ipc_t *                  ipc;
+} publishCtx_t;
+
+static int
+_outboxPublish(ipc_to_mqtt_typ_t const dataType, char const * const data, uint const len, uint const recs, void * const priv)
+{
+    publishCtx_t const * const ctx = priv;
+    int const msgId = _publish(ctx->client, dataType, data, len);
+    if (msgId > 0) {
+        ctx->ipc->dev.count.scanPublished += recs;
+    }
+    return msgId;
+}
+
+// returns the binary payload `data` with its records compressed in _compress.buf, or `data` itself
+
+static char const *
+_compressBin(char const * const data, uint * const len)
+{
+    if (!_compress.on || *len <= sizeof(blescan_wire_hdr_t)) {
+        return data;
+    }
+    int64_t const start = esp_timer_get_time();
+    size_t const packedLen = blescan_lz_compress(&_compress.lz,
+        (uint8_t const *)data + sizeof(blescan_wire_hdr_t), *len - sizeof(blescan_wire_hdr_t),
+        _compress.buf + sizeof(blescan_wire_hdr_t), sizeof(_compress.buf) - sizeof(blescan_wire_hdr_t));
+    _compress.stats.us += esp_timer_get_time() - start;
+    _compress.stats.in += *len;
+
+    if (packedLen == 0 || packedLen + sizeof(blescan_wire_hdr_t) >= *len) {  // didn't fit, or didn't help
+        _compress.stats.out += *len;
+        return data;
+    }
+    memcpy(_compress.buf, data, sizeof(blescan_wire_hdr_t));
+    ((blescan_wire_hdr_t *)_compress.buf)->flags |= BLESCAN_WIRE_FLAG_LZ4;
+    *len = sizeof(blescan_wire_hdr_t) + packedLen;
+    _compress.stats.out += *len;
+    return (char const *)_compress.buf;
+}
+
+// publishes scan data holding `recs` scan results, through the outbox when it needs acknowledging;
+// returns false when they were neither published nor handed to the outbox, that counts its drops
+
+static bool
+_publishRecs(esp_mqtt_client_handle_t const client, ipc_to_mqtt_typ_t const dataType, char const * data, uint len, uint const recs, ipc_t * const ipc)
+{
+    if (dataType == IPC_TO_MQTT_MSGTYPE_SCAN_BIN) {
+        data = _compressBin(data, &len);
+    }
+    if (_type2subtopic(dataType)->qos) {
+        publishCtx_t ctx = { .client = client, .ipc = ipc };
+        outbox_put(dataType, data, len, recs, _outboxPublish, &ctx);
+        return true;
+    }
+    if (_publish(client, dataType, data, len) < 0) {  // QoS 0 messages have msg_id 0
+        return false;
+    }
+    ipc->dev.count.scanPublished += recs;
+    return true;
+}
+
+// the bytes a batch can hold with the current settings, binary ones also run into BATCH_MAX_RECS
+
+static uint
+_batchLimit(batch_t const * const batch)
+{
+    if (batch->dataType == IPC_TO_MQTT_MSGTYPE_SCAN) {
+        return _batch.curMaxBytes;
+    }
+    return MIN(_batch.curMaxBytes, sizeof(blescan_wire_hdr_t) + BATCH_MAX_RECS * sizeof(blescan_wire_rec_t));
+}
+
+static void
+_batchFlush(esp_mqtt_client_handle_t const client, batch_t * const batch, batchFlush_t const reason, ipc_t * const ipc)
+{
+    if (batch->cnt) {
+        if (batch->dataType == IPC_TO_MQTT_MSGTYPE_SCAN) {
+            memcpy(batch->buf + batch->len, " ]", 2);  // not zero terminated
+            batch->len += 2;
+        }
+        _publishRecs(client, batch->dataType, batch->buf, batch->len, batch->cnt, ipc);
+
+        uint32_t const now = esp_timer_get_time();
+        for (uint ii = 0; ii < batch->cnt; ii++) {
+            histo_add(&_stats.latency, now - batch->times[ii]);  // wraps correctly
+        }
+
+        _batch.stats.flushes[reason]++;
+        _batch.stats.records += batch->cnt;
+        _batch.stats.bytes += batch->len;
+        _batch.stats.limit += _batchLimit(batch);
+        batch->len = 0;
+        batch->cnt = 0;
+    }
+}
+
+static void
+_batchFlushAll(esp_mqtt_client_handle_t const client, batchFlush_t const reason, ipc_t * const ipc)
+{
+    _batchFlush(client, &_batch.json, reason, ipc);
+    _batchFlush(client, &_batch.bin, reason, ipc);
+}
+
+// JSON: wraps the scan result objects in "[ ", ", " .. " ]"
+
+static void
+_batchAddJson(batch_t * const batch, ipc_to_mqtt_msg_t const * const msg)
+{
+    if (batch->cnt == 0) {
+        memcpy(batch->buf, "[ ", 2);
+        batch->len = 2;
+    } else {
+        memcpy(batch->buf + batch->len, ", ", 2);
+        batch->len += 2;
+    }
+    memcpy(batch->buf + batch->len, msg->data, msg->dataLen);
+    batch->len += msg->dataLen;
+}
+
+// binary: records can only share the batch's baseTime when their time is of the same kind, and
+// no earlier, as the deltas are unsigned; an SNTP re-sync may have stepped the clock back
+
+static bool
+_batchRebasable(blescan_wire_hdr_t const * const batchHdr, blescan_wire_hdr_t const * const msgHdr)
+{
+    int64_t const delta = msgHdr->baseTime - batchHdr->baseTime;
+    return msgHdr->flags == batchHdr->flags && delta >= 0 && delta <= UINT32_MAX / 2;  // room for the records' own deltas
+}
+
+// binary: keeps the header of the first message, and rebases the time of the records that follow
+
+static void
+_batchAddBin(batch_t * const batch, ipc_to_mqtt_msg_t const * const msg)
+{
+    blescan_wire_hdr_t * const batchHdr = (blescan_wire_hdr_t *)batch->buf;
+    blescan_wire_hdr_t const * const msgHdr = (blescan_wire_hdr_t const *)msg->data;
+
+    if (batch->cnt == 0) {
+        memcpy(batch->buf, msg->data, msg->dataLen);
+        batch->len = msg->dataLen;
+        return;
+    }
+    uint const recsLen = msg->dataLen - sizeof(blescan_wire_hdr_t);
+    blescan_wire_rec_t * const rec = (blescan_wire_rec_t *)(batch->buf + batch->len);
+    memcpy(rec, msgHdr + 1, recsLen);
+    for (uint ii = 0; ii < msgHdr->count; ii++) {
+        rec[ii].timeDelta += msgHdr->baseTime - batchHdr->baseTime;
+    }
+    batchHdr->count += msgHdr->count;
+    batch->len += recsLen;
+}
+
+static void
+_publishScan(esp_mqtt_client_handle_t const client, ipc_to_mqtt_msg_t const * const msg, ipc_t * const ipc)
+{
+    _publishRecs(client, msg->dataType, msg->data, msg->dataLen, 1, ipc);
+    histo_add(&_stats.latency, esp_timer_get_time() - msg->time);
+}
+
+static void
+_batchAdd(esp_mqtt_client_handle_t const client, ipc_to_mqtt_msg_t const * const msg, ipc_t * const ipc)
+{
+    bool const isJson = msg->dataType == IPC_TO_MQTT_MSGTYPE_SCAN;
+    batch_t * const batch = isJson ? &_batch.json : &_batch.bin;
+    uint const overhead = isJson ? 4 : 0;  // JSON adds "[ " or ", " and " ]", binary drops its header
+
+    if (batch->cnt && (batch->len + msg->dataLen + overhead > _batch.curMaxBytes || batch->cnt == BATCH_MAX_RECS)) {
+        _batchFlush(client, batch, BATCH_FLUSH_size, ipc);
+    }
+    if (batch->cnt && !isJson && !_batchRebasable((blescan_wire_hdr_t const *)batch->buf, (blescan_wire_hdr_t const *)msg->data)) {
+        _batchFlush(client, batch, BATCH_FLUSH_clock, ipc);
+    }
+    if (msg->dataLen + overhead > _batch.curMaxBytes) {  // doesn't fit in an empty batch either
+        _publishScan(client, msg, ipc);
+        return;
+    }
+    if (batch->cnt == 0) {
+        batch->start = xTaskGetTickCount();
+    }
+    if (isJson) {
+        _batchAddJson(batch, msg);
+    } else {
+        _batchAddBin(batch, msg);
+    }
+    batch->times[batch->cnt++] = msg->time;
+}
+
+// appends the records of a IPC_TO_MQTT_MSGTYPE_SCAN_LOG message to the scan log
+
+static void
+_logScan(ipc_to_mqtt_msg_t const * const msg)
+{
+    blescan_wire_hdr_t const * const hdr = (blescan_wire_hdr_t const *)msg->data;
+    blescan_wire_rec_t const * const rec = (blescan_wire_rec_t const *)(hdr + 1);
+
+    for (uint ii = 0; ii < hdr->count; ii++) {
+        scanLog_append(&rec[ii], hdr->baseTime + rec[ii].timeDelta);
+    }
+}
+
+// the records stay in the scan log until published or handed to the outbox, so a broker that
+// goes away during the replay gets them later; the outbox caps what is sent unacknowledged
+
+static void
+_replayScanLog(esp_mqtt_client_handle_t const client, ipc_t * const ipc)
+{
+    uint const len = scanLog_peek(_replay.buf, sizeof(_replay.buf));
+    blescan_wire_hdr_t * const hdr = (blescan_wire_hdr_t *)_replay.buf;
+    uint const cnt = len ? hdr->count : 0;
+    if (cnt) {
+        int64_t wall;
+        if (!(hdr->flags & BLESCAN_WIRE_FLAG_PRIOR_BOOT) && timeSync_toWall(hdr->baseTime, &wall)) {
+            hdr->baseTime = wall;
+        } else {
+            hdr->flags |= BLESCAN_WIRE_FLAG_UPTIME;
+        }
+        if (!_publishRecs(client, IPC_TO_MQTT_MSGTYPE_SCAN_BIN, (char const *)_replay.buf, len, cnt, ipc)) {
+            _replay.next = xTaskGetTickCount() + 1000L / portTICK_PERIOD_MS;  // try again
+            return;
+        }
+    }
+    scanLog_consume();  // also skips records lost in a power failure
+    _replay.next = xTaskGetTickCount() + cnt * 1000L / CONFIG_BLESCAN_SCANLOG_REPLAY_RATE / portTICK_PERIOD_MS;
+}
+
+static void
+_publishStats(esp_mqtt_client_handle_t const client, ipc_t const * const ipc)
+{
+    ipc_count_t const * const count = &ipc->dev.count;
+    ipc_radio_t const * const radio = &ipc->dev.radio;
+    scanLog_stats_t const * const log = scanLog_stats();
+    outbox_stats_t const * const outbox = outbox_stats();
+    timeSync_stats_t clock;
+    timeSync_stats(&clock);
+    char payload[1280];
+    int const len = snprintf(payload, sizeof(payload),
+        "{ \"period\": %u, \"adv\": %u, \"beacon\": %u, \"enqueued\": %u, \"published\": %u, "
+        "\"drop\": { \"ring\": %u, \"toMqtt\": %u, \"toBle\": %u }, "
+        "\"hwm\": { \"ring\": %u, \"toMqtt\": %u, \"toBle\": %u }, "
+        "\"latencyUs\": { \"n\": %u, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u }, "
+        "\"gapCbUs\": { \"avg\": %u, \"max\": %u }, "
+        "\"log\": { \"pending\": %u, \"logged\": %u, \"replayed\": %u, \"lost\": %u, \"erases\": %u }, "
+        "\"clock\": { \"synced\": %s, \"syncs\": %u, \"ageSec\": %u, \"offsetUs\": %" PRId64 ", \"driftPpm\": %.2f }, "
+        "\"radio\": { \"advMs\": %" PRIu64 ", \"scanMs\": %" PRIu64 ", \"switches\": %u, \"switchUs\": { \"avg\": %u, \"max\": %u }, \"gap\": { \"retry\": %u, \"fail\": %u } }, "
+        "\"outbox\": { \"inflight\": %u, \"hwm\": %u, \"pending\": %u, \"queued\": %u, \"dropped\": %u, \"droppedRecs\": %u, \"expired\": %u }, "
+        "\"track\": { \"suppressed\": %u, \"evict\": %u }, "
+        "\"backpressure\": { \"mode\": \"%s\", \"transitions\": %u, \"skipped\": %u }, "
+        "\"compress\": { \"on\": %s, \"in\": %" PRIu64 ", \"out\": %" PRIu64 ", \"us\": %" PRIu64 " } }",
+        _stats.periodSec, count->advRx, count->beaconRx, count->scanEnqueued, count->scanPublished,
+        count->scanDrop, ipc->toMqttQ->drop, ipc->toBleQ->drop,
+        count->ringHwm, ipc->toMqttQ->hwm, ipc->toBleQ->hwm,
+        _stats.latency.cnt, histo_percentile(&_stats.latency, 50), histo_percentile(&_stats.latency, 90),
+        histo_percentile(&_stats.latency, 99), _stats.latency.max,
+        count->advRx ? (uint)(count->gapCbTotUs / count->advRx) : 0, count->gapCbMaxUs,
+        scanLog_pending(), log->logged, log->replayed, log->lost, log->erases,
+        clock.synced ? "true" : "false", clock.syncs, clock.synced ? (uint)((esp_timer_get_time() - clock.lastSync) / 1000000) : 0,
+        clock.offsetUs, clock.driftPpm,
+        radio->advUs / 1000, radio->scanUs / 1000, radio->switches,
+        radio->switches ? (uint)(radio->switchTotUs / radio->switches) : 0, radio->switchMaxUs,
+        radio->gapRetry, radio->gapFail,
+        outbox->inflight, outbox->inflightHwm, outbox->pending, outbox->queued, outbox->dropped, outbox->droppedRecs, outbox->expired,
+        count->trackSuppressed, count->trackEvict,
+        _pressures[ipc->cfg.pressure], _pressure.transitions, count->sampleSkip,
+        _compress.on ? "true" : "false", _compress.stats.in, _compress.stats.out, _compress.stats.us);
+
+    _publish(client, IPC_TO_MQTT_MSGTYPE_STATS, payload, MIN((uint)len, sizeof(payload) - 1));
+    histo_reset(&_stats.latency);
+}
+
+// steps the reporting mode of scan_task up or down, and announces it on the `mode` subtopic
+
+static void
+_backpressure(esp_mqtt_client_handle_t const client, ipc_t * const ipc)
+{
+    int64_t const now = esp_timer_get_time();
+    _pressure.fillSum += (uint64_t)_pressure.fillPct * (now - _pressure.sampled);
+    uint const queuePct = uxQueueMessagesWaiting(ipc->toMqttQ->q) * 100 / ipc->toMqttQ->depth;
+    uint const outboxPct = outbox_stats()->pending * 100 / CONFIG_BLESCAN_MQTT_OUTBOX_SIZE;
+    _pressure.fillPct = MAX(queuePct, outboxPct);
+    _pressure.sampled = now;
+
+    int64_t const elapsed = now - _pressure.start;
+    if (!_pressure.on) {
+        _pressure.fillSum = _pressure.high = _pressure.low = 0;
+        _pressure.start = now;
+        return;
+    }
+    if (elapsed < BACKPRESSURE_PERIOD_MSEC * 1000L) {
+        return;
+    }
+    uint const avgPct = _pressure.fillSum / elapsed;
+    // summaries waiting for a free slot at the end of a window aren't drops, or summary mode
+    // would keep itself from stepping back
+    uint const drops = ipc->dev.count.scanDrop + ipc->toMqttQ->drop + outbox_stats()->droppedRecs;
+    if (drops != _pressure.drops || avgPct >= CONFIG_BLESCAN_BACKPRESSURE_HIGH_PCT) {
+        _pressure.high += elapsed;
+        _pressure.low = 0;
+    } else if (avgPct <= CONFIG_BLESCAN_BACKPRESSURE_LOW_PCT) {
+        _pressure.low += elapsed;
+        _pressure.high = 0;
+    } else {
+        _pressure.high = _pressure.low = 0;
+    }
+    uint const from = ipc->cfg.pressure;
+    uint to = from;
+    if (_pressure.high >= CONFIG_BLESCAN_BACKPRESSURE_HOLD_MSEC * 1000L && from < IPC_PRESSURE_COUNT - 1) {
+        to = from + 1;
+    } else if (_pressure.low >= CONFIG_BLESCAN_BACKPRESSURE_RECOVER_MSEC * 1000L && from > IPC_PRESSURE_raw) {
+        to = from - 1;
+    }
+    if (to != from) {
+        ipc->cfg.pressure = to;
+        _pressure.high = _pressure.low = 0;
+        _pressure.transitions++;
+
+        char payload[160];  // published directly, as toMqttQ may well be full
+        int const len = snprintf(payload, sizeof(payload),
+            "{ \"backpressure\": { \"mode\": \"%s\", \"from\": \"%s\", \"fillPct\": %u, \"drops\": %u } }",
+            _pressures[to], _pressures[from], avgPct, drops - _pressure.drops);
+        _publish(client, IPC_TO_MQTT_MSGTYPE_MODE, payload, MIN((uint)len, sizeof(payload) - 1));
+        ESP_LOGW(TAG, "Backpressure, %s => %s", _pressures[from], _pressures[to]);
+    }
+    _pressure.drops = drops;
+    _pressure.fillSum = 0;
+    _pressure.start = now;
+}
+
 static void
 _wait4ipcDevAvail(ipc_t * ipc)
 {
     // ble sends a msg when ipc->dev is initialized
-    ipc_to_mqtt_msg_t msg;
-    assert(xQueueReceive(ipc->toMqttQ, &msg, (TickType_t)(1000L / portTICK_PERIOD_MS)) == pdPASS);
-    assert(msg.dataType == IPC_TO_MQTT_IPC_DEV_AVAILABLE);
-    free(msg.data);
+    ipc_to_mqtt_msg_t * const msg = ipc_receive(ipc->toMqttQ, (TickType_t)(1000L / portTICK_PERIOD_MS));
+    assert(msg && msg->dataType == IPC_TO_MQTT_IPC_DEV_AVAILABLE);
+    ipc_release(ipc->toMqttQ, msg);
 }
 
 void
@@ -231,8 +1021,7 @@ mqtt_task(void * ipc_void) {
 	ipc_t * ipc = ipc_void;
 
     _wait4ipcDevAvail(ipc);
-    assert(asprintf(&_topic.ctrl, "%s/%s", CONFIG_BLESCAN_MQTT_CTRL_TOPIC, ipc->dev.name));
-    assert(asprintf(&_topic.ctrlGroup, "%s", CONFIG_BLESCAN_MQTT_CTRL_TOPIC));
+    _initTopics(ipc);
 
     // event group indicates that we're connected to the MQTT broker
 
@@ -244,19 +1033,67 @@ mqtt_task(void * ipc_void) {
     }
 
 	while (1) {
-        ipc_to_mqtt_msg_t msg;
-		if (xQueueReceive(ipc->toMqttQ, &msg, (TickType_t)(1000L / portTICK_PERIOD_MS)) == pdPASS) {
+        TickType_t wait = (TickType_t)(1000L / portTICK_PERIOD_MS);
+        if (_stats.periodSec) {
+            TickType_t const elapsed = xTaskGetTickCount() - _stats.last;
+            TickType_t const period = _stats.periodSec * 1000L / portTICK_PERIOD_MS;
+            wait = MIN(wait, (elapsed < period) ? period - elapsed : 0);
+        }
+        if (outbox_stats()->pending) {
+            wait = MIN(wait, (TickType_t)(10 / portTICK_PERIOD_MS) ?: 1);  // for acknowledgements
+        }
+        // the replay waits while scan data waits in the outbox, rather than push out older data
+        bool const replay = ipc->dev.online && scanLog_pending() && outbox_stats()->pending == 0;
+        if (replay) {
+            TickType_t const now = xTaskGetTickCount();
+            wait = MIN(wait, (int32_t)(_replay.next - now) > 0 ? _replay.next - now : 0);
+        }
+        TickType_t const window = _batch.curWindowMs / portTICK_PERIOD_MS;
+        batch_t * const batches[] = { &_batch.json, &_batch.bin };
+        for (uint ii = 0; ii < ARRAY_SIZE(batches); ii++) {
+            if (batches[ii]->cnt) {
+                TickType_t const elapsed = xTaskGetTickCount() - batches[ii]->start;
+                wait = MIN(wait, (elapsed < window) ? window - elapsed : 0);
+            }
+        }
+		ipc_to_mqtt_msg_t * const msg = ipc_receive(ipc->toMqttQ, wait);
 
-            char * topic;
-            char const * const subtopic = _type2subtopic(msg.dataType);
-            if (subtopic) {
-                asprintf(&topic, "%s/%s/%s", CONFIG_BLESCAN_MQTT_DATA_TOPIC, subtopic, ipc->dev.name);
+        if (_batch.windowMs != _batch.curWindowMs || _batch.maxBytes != _batch.curMaxBytes) {
+            _batchFlushAll(client, BATCH_FLUSH_ctrl, ipc);
+            _batch.curWindowMs = _batch.windowMs;
+            _batch.curMaxBytes = _batch.maxBytes;
+        }
+		if (msg) {
+            bool const isScan = msg->dataType == IPC_TO_MQTT_MSGTYPE_SCAN || msg->dataType == IPC_TO_MQTT_MSGTYPE_SCAN_BIN;
+            if (msg->dataType == IPC_TO_MQTT_MSGTYPE_SCAN_LOG) {
+                _logScan(msg);
+            } else if (isScan && _batch.curWindowMs) {
+                _batchAdd(client, msg, ipc);
+            } else if (isScan) {
+                _publishScan(client, msg, ipc);
             } else {
-                asprintf(&topic, "%s/%s", CONFIG_BLESCAN_MQTT_DATA_TOPIC, ipc->dev.name);
+                _publish(client, msg->dataType, msg->data, msg->dataLen);
+            }
+            ipc_release(ipc->toMqttQ, msg);
+		} else {
+            scanLog_sync();  // idle, so write what is buffered
+        }
+        publishCtx_t ctx = { .client = client, .ipc = ipc };
+        outbox_poll(_outboxPublish, &ctx);
+
+        if (replay && ipc->dev.online && (int32_t)(xTaskGetTickCount() - _replay.next) >= 0) {
+            _replayScanLog(client, ipc);
+        }
+        for (uint ii = 0; ii < ARRAY_SIZE(batches); ii++) {
+            if (batches[ii]->cnt && xTaskGetTickCount() - batches[ii]->start >= window) {
+                _batchFlush(client, batches[ii], BATCH_FLUSH_window, ipc);
             }
-            esp_mqtt_client_publish(client, topic, msg.data, strlen(msg.data), 1, 0);
-            free(topic);
-            free(msg.data);
-		}
+        }
+        _backpressure(client, ipc);
+
+        if (_stats.periodSec && xTaskGetTickCount() - _stats.last >= _stats.periodSec * 1000L / portTICK_PERIOD_MS) {
+            _publishStats(client, ipc);
+            _stats.last = xTaskGetTickCount();
+        }
 	}
 }
\ No newline at end of file
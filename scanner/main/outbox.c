@@ -0,0 +1,212 @@
+/**
+ * @brief capped outbox for scan data published with QoS > 0
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+
+#include "ipc.h"
+#include "outbox.h"
+
+static char const * const TAG = "outbox";
+
+/*
+ * Messages in flight are remembered by msg_id until the MQTT event handler reports their
+ * acknowledgement.  The handler runs in the esp-mqtt task, with the client locked, so it
+ * only pushes the msg_id on a single-producer ring that mqtt_task drains in outbox_poll().
+ * Waiting messages are kept back-to-back, oldest first; taking one out moves the others
+ * down, which is cheap next to publishing it.
+ */
+
+#define OUTBOX_INFLIGHT_MSGS (32)
+#define OUTBOX_ACKS (32)  // power of 2
+
+typedef struct inflight_t {
+    int     msgId;
+    uint    len;
+    int64_t time;  // [usec]
+} inflight_t;
+
+typedef struct outboxHdr_t {
+    ipc_to_mqtt_typ_t dataType;
+    uint16_t          len;
+    uint16_t          recs;
+} outboxHdr_t;
+
+static struct {
+    inflight_t     inflight[OUTBOX_INFLIGHT_MSGS];
+    uint           inflightCnt;
+    struct {
+        int         msgId[OUTBOX_ACKS];
+        atomic_uint head;  // written by outbox_acked()
+        atomic_uint tail;  // written by outbox_poll()
+    } acks;
+    uint8_t        buf[CONFIG_BLESCAN_MQTT_OUTBOX_SIZE];  // waiting messages, each an outboxHdr_t and data
+    uint           used;
+    uint           cnt;
+    outbox_stats_t stats;
+} _outbox = {};
+
+static uint
+_entrySize(uint const len)
+{
+    return (sizeof(outboxHdr_t) + len + 3) & ~3U;
+}
+
+static bool
+_mayPublish(uint const len)
+{
+    return _outbox.inflightCnt < OUTBOX_INFLIGHT_MSGS &&
+           (_outbox.stats.inflight == 0 || _outbox.stats.inflight + len <= CONFIG_BLESCAN_MQTT_INFLIGHT_MAX);
+}
+
+static void
+_send(ipc_to_mqtt_typ_t const dataType, char const * const data, uint const len, uint const recs, outbox_publish_t const publish, void * const priv)
+{
+    int const msgId = publish(dataType, data, len, recs, priv);
+    if (msgId <= 0) {  // not stored by esp-mqtt either
+        _outbox.stats.dropped++;
+        _outbox.stats.droppedRecs += recs;
+        return;
+    }
+    _outbox.inflight[_outbox.inflightCnt++] = (inflight_t) {
+        .msgId = msgId,
+        .len = len,
+        .time = esp_timer_get_time(),
+    };
+    _outbox.stats.inflight += len;
+    _outbox.stats.inflightHwm = MAX(_outbox.stats.inflightHwm, _outbox.stats.inflight);
+}
+
+static void
+_remove(uint const entrySize)
+{
+    memmove(_outbox.buf, _outbox.buf + entrySize, _outbox.used - entrySize);
+    _outbox.used -= entrySize;
+    _outbox.cnt--;
+}
+
+static void
+_dropOldest(void)
+{
+    outboxHdr_t const * const hdr = (outboxHdr_t const *)_outbox.buf;
+    _outbox.stats.dropped++;
+    _outbox.stats.droppedRecs += hdr->recs;
+    _remove(_entrySize(hdr->len));
+}
+
+void
+outbox_put(ipc_to_mqtt_typ_t const dataType, char const * const data, uint const len, uint const recs, outbox_publish_t const publish, void * const priv)
+{
+    if (_outbox.cnt == 0 && _mayPublish(len)) {
+        _send(dataType, data, len, recs, publish, priv);
+        return;
+    }
+    uint const size = _entrySize(len);
+    if (size > sizeof(_outbox.buf)) {
+        ESP_LOGW(TAG, "message too long (%u)", len);
+        _outbox.stats.dropped++;
+        _outbox.stats.droppedRecs += recs;
+        return;
+    }
+    while (_outbox.used + size > sizeof(_outbox.buf)) {
+        _dropOldest();
+    }
+    outboxHdr_t * const hdr = (outboxHdr_t *)(_outbox.buf + _outbox.used);
+    *hdr = (outboxHdr_t) {
+        .dataType = dataType,
+        .len = len,
+        .recs = recs,
+    };
+    memcpy(hdr + 1, data, len);
+    _outbox.used += size;
+    _outbox.cnt++;
+    _outbox.stats.queued++;
+}
+
+// called by the MQTT event handler when the broker acknowledged `msgId`
+
+void
+outbox_acked(int const msgId)
+{
+    uint const head = atomic_load_explicit(&_outbox.acks.head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&_outbox.acks.tail, memory_order_acquire) == OUTBOX_ACKS) {
+        return;  // full, the message will expire instead
+    }
+    _outbox.acks.msgId[head % OUTBOX_ACKS] = msgId;
+    atomic_store_explicit(&_outbox.acks.head, head + 1, memory_order_release);
+}
+
+static void
+_forget(uint const ii)
+{
+    _outbox.stats.inflight -= _outbox.inflight[ii].len;
+    _outbox.inflight[ii] = _outbox.inflight[--_outbox.inflightCnt];
+}
+
+// processes acknowledgements, and publishes what waits as far as they allow
+
+void
+outbox_poll(outbox_publish_t const publish, void * const priv)
+{
+    uint const head = atomic_load_explicit(&_outbox.acks.head, memory_order_acquire);
+    uint tail = atomic_load_explicit(&_outbox.acks.tail, memory_order_relaxed);
+    for (; tail != head; tail++) {
+        int const msgId = _outbox.acks.msgId[tail % OUTBOX_ACKS];
+        for (uint ii = 0; ii < _outbox.inflightCnt; ii++) {
+            if (_outbox.inflight[ii].msgId == msgId) {
+                _forget(ii);
+                break;
+            }
+        }
+    }
+    atomic_store_explicit(&_outbox.acks.tail, tail, memory_order_release);
+
+    // esp-mqtt gives up on messages after a while without telling
+    int64_t const expired = esp_timer_get_time() - CONFIG_BLESCAN_MQTT_INFLIGHT_TIMEOUT_MSEC * 1000LL;
+    for (uint ii = 0; ii < _outbox.inflightCnt; ) {
+        if (_outbox.inflight[ii].time < expired) {
+            _outbox.stats.expired++;
+            _forget(ii);
+        } else {
+            ii++;
+        }
+    }
+
+    while (_outbox.cnt) {
+        outboxHdr_t const * const hdr = (outboxHdr_t const *)_outbox.buf;
+        if (!_mayPublish(hdr->len)) {
+            break;
+        }
+        _send(hdr->dataType, (char const *)(hdr + 1), hdr->len, hdr->recs, publish, priv);
+        _remove(_entrySize(hdr->len));
+    }
+}
+
+outbox_stats_t const *
+outbox_stats(void)
+{
+    _outbox.stats.pending = _outbox.used;
+    return &_outbox.stats;
+}
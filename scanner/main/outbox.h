@@ -0,0 +1,27 @@
+#pragma once
+
+/*
+ * Capped outbox for scan data published at QoS 1 or 2.  esp-mqtt holds on to such messages
+ * until the broker acknowledges them, without limit.  Here, only so many bytes are handed to
+ * esp-mqtt unacknowledged; the rest waits in a fixed buffer, from which the oldest scan data
+ * is discarded when newer data needs the room.
+ * Only used from mqtt_task, apart from outbox_acked().
+ */
+
+// hands a message to esp-mqtt, returns its msg_id or -1
+typedef int (* outbox_publish_t)(ipc_to_mqtt_typ_t const dataType, char const * const data, uint const len, uint const recs, void * const priv);
+
+typedef struct outbox_stats_t {
+    uint queued;       // messages that had to wait for acknowledgements
+    uint dropped;      // .. discarded to make room, oldest first
+    uint droppedRecs;  // scan records in those
+    uint expired;      // never acknowledged, and no longer counted as in flight
+    uint inflight;     // bytes handed to esp-mqtt and not yet acknowledged
+    uint inflightHwm;
+    uint pending;      // bytes waiting
+} outbox_stats_t;
+
+void outbox_put(ipc_to_mqtt_typ_t const dataType, char const * const data, uint const len, uint const recs, outbox_publish_t const publish, void * const priv);
+void outbox_acked(int const msgId);
+void outbox_poll(outbox_publish_t const publish, void * const priv);
+outbox_stats_t const * outbox_stats(void);
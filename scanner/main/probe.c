@@ -0,0 +1,199 @@
+/**
+ * @brief sequence-numbered probe advertisements and their reception statistics
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "histo.h"
+#include "probe.h"
+
+char const * const probe_modeNames[PROBE_MODE_COUNT] = {
+#define XX(num, name) [num] = #name,
+  PROBE_MODE_MAP(XX)
+#undef XX
+};
+
+uint8_t const probe_uuid[16] = { 'b', 'l', 'e', 's', 'c', 'a', 'n', ' ', 'p', 'r', 'o', 'b', 'e', ' ', 'v', '1' };
+
+// builds the advertisement for sequence number `seq` from identity `ident`, `wall` is negative
+// when the time isn't synced
+
+void
+probe_payload(esp_ble_ibeacon_t * const payload, esp_ble_ibeacon_t const * const ident, probe_mode_t const mode,
+              uint16_t const seq, int64_t const wall)
+{
+    *payload = *ident;
+    esp_ble_ibeacon_vendor_t * const vendor = &payload->ibeacon_vendor;
+    memcpy(vendor->proximity_uuid, probe_uuid, sizeof(vendor->proximity_uuid));
+
+    uint16_t minor = seq & PROBE_SEQ_MASK;
+    if (mode == PROBE_MODE_time && wall >= 0) {
+        vendor->major = ENDIAN_CHANGE_U16((uint16_t)(wall / PROBE_TIME_UNIT_US));
+        minor |= PROBE_FLAG_TIME;
+    }
+    vendor->minor = ENDIAN_CHANGE_U16(minor);
+}
+
+static uint
+_find(probe_t const * const tbl, uint8_t const * const bda)
+{
+    for (uint ii = 0; ii < PROBE_LEN; ii++) {
+        if (tbl->used[ii] && memcmp(tbl->bda[ii], bda, sizeof(tbl->bda[ii])) == 0) {
+            return ii;
+        }
+    }
+    return PROBE_LEN;
+}
+
+// returns an empty slot, after forgetting the least recently heard advertiser when there is none
+
+static uint
+_claim(probe_t * const tbl)
+{
+    uint lru = 0;
+    for (uint ii = 0; ii < PROBE_LEN; ii++) {
+        if (!tbl->used[ii]) {
+            return ii;
+        }
+        if (tbl->last[ii] < tbl->last[lru]) {
+            lru = ii;
+        }
+    }
+    tbl->evictions++;
+    return lru;
+}
+
+static void
+_reset(probe_t * const tbl, uint const ii)
+{
+    tbl->rx[ii] = 0;
+    tbl->lost[ii] = 0;
+    tbl->gaps[ii] = 0;
+    tbl->maxGap[ii] = 0;
+    tbl->copies[ii] = 0;
+    tbl->restarts[ii] = 0;
+    tbl->skewed[ii] = 0;
+    histo_reset(&tbl->latency[ii]);
+}
+
+// the major holds the low bits of the transmit time, the receive time supplies the rest; the
+// advertiser floors the time to a unit, so taking the middle of the unit halves the error
+
+static void
+_latency(probe_t * const tbl, uint const ii, uint16_t const major, int64_t const wall)
+{
+    int64_t const rxUnits = wall / PROBE_TIME_UNIT_US;
+    int16_t const units = (int16_t)((uint16_t)rxUnits - major);  // the transmit time is this many units ago
+    int64_t const us = wall - (rxUnits - units) * PROBE_TIME_UNIT_US - PROBE_TIME_UNIT_US / 2;
+
+    if (us < -PROBE_TIME_UNIT_US / 2) {
+        tbl->skewed[ii]++;
+        return;
+    }
+    histo_add(&tbl->latency[ii], (uint32_t)MIN(MAX(us, (int64_t)0), (int64_t)UINT32_MAX));  // within half a unit
+}
+
+void
+probe_init(probe_t * const tbl, probe_emit_t const emit, void * const priv, int64_t const time)
+{
+    memset(tbl->used, 0, sizeof(tbl->used));
+    tbl->start = time;
+    tbl->evictions = 0;
+    tbl->emit = emit;
+    tbl->priv = priv;
+}
+
+// notes a probe advertisement from `bda` received at `time` [usec], `wall` is the Unix time at
+// hand-over [usec], negative when the time isn't synced
+
+void
+probe_update(probe_t * const tbl, uint8_t const * const bda, uint16_t const major, uint16_t const minor,
+             int64_t const time, int64_t const wall)
+{
+    uint16_t const seq = minor & PROBE_SEQ_MASK;
+    uint ii = _find(tbl, bda);
+
+    if (ii == PROBE_LEN) {  // first heard, or forgotten
+        ii = _claim(tbl);
+        memcpy(tbl->bda[ii], bda, sizeof(tbl->bda[ii]));
+        tbl->used[ii] = true;
+        _reset(tbl, ii);
+    } else {
+        uint16_t const ahead = (seq - tbl->seq[ii]) & PROBE_SEQ_MASK;
+        if (ahead == 0) {
+            tbl->copies[ii]++;
+            tbl->last[ii] = time;
+            return;
+        }
+        if (ahead > PROBE_SEQ_MASK / 2) {  // went back
+            tbl->restarts[ii]++;
+        } else if (ahead > 1) {
+            tbl->lost[ii] += ahead - 1;
+            tbl->gaps[ii]++;
+            tbl->maxGap[ii] = MAX(tbl->maxGap[ii], (uint)ahead - 1);
+        }
+    }
+    tbl->seq[ii] = seq;
+    tbl->last[ii] = time;
+    tbl->rx[ii]++;
+    if ((minor & PROBE_FLAG_TIME) && wall >= 0) {  // only the first copy was sent close to the advertised time
+        _latency(tbl, ii, major, wall);
+    }
+}
+
+// reports each advertiser heard in the window that ends at `time` and starts the next; those
+// not heard are forgotten, so that the table only holds advertisers in range
+
+void
+probe_flush(probe_t * const tbl, int64_t const time)
+{
+    uint const windowMs = (time - tbl->start) / 1000;
+    tbl->start = time;
+
+    for (uint ii = 0; ii < PROBE_LEN; ii++) {
+        if (!tbl->used[ii]) {
+            continue;
+        }
+        if (tbl->rx[ii] == 0 && tbl->copies[ii] == 0) {
+            tbl->used[ii] = false;
+            continue;
+        }
+        probe_report_t report = {
+            .windowMs = windowMs,
+            .rx = tbl->rx[ii],
+            .lost = tbl->lost[ii],
+            .gaps = tbl->gaps[ii],
+            .maxGap = tbl->maxGap[ii],
+            .copies = tbl->copies[ii],
+            .restarts = tbl->restarts[ii],
+            .skewed = tbl->skewed[ii],
+            .latency = &tbl->latency[ii],
+        };
+        memcpy(report.bda, tbl->bda[ii], sizeof(report.bda));
+        tbl->emit(&report, tbl->priv);
+        _reset(tbl, ii);
+    }
+}
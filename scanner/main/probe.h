@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+ * Sequence-numbered probe advertisements, for measuring how many advertisements a scanner
+ * catches.  An advertiser in probe mode sends iBeacons with the probe UUID, and a rolling
+ * sequence number in the low 15 bits of the minor.  When the top bit of the minor is set,
+ * the major carries the Unix time at which the payload was handed to the controller, in
+ * PROBE_TIME_UNIT_US units modulo 2^16, so that a scanner with synced time can tell the
+ * latency to within half a unit.
+ *
+ * Scanners keep per-advertiser sequence gaps, duplicates and latencies, and report them
+ * per window.  Relies on esp_ibeacon_api.h and histo.h.
+ */
+
+#define PROBE_LEN (CONFIG_BLESCAN_PROBE_TABLE_LEN)
+#define PROBE_SEQ_MASK (0x7FFF)
+#define PROBE_FLAG_TIME (0x8000)
+#define PROBE_TIME_UNIT_US (10000LL)  // wraps after about 11 minutes
+
+#define PROBE_MODE_MAP(XX) \
+  XX(0, off) \
+  XX(1, seq)  /* sequence number only, the major stays that of the identity */ \
+  XX(2, time) /* .. and the time in the major, once synced */
+
+typedef enum probe_mode_t {
+#define XX(num, name) PROBE_MODE_##name = num,
+  PROBE_MODE_MAP(XX)
+#undef XX
+  PROBE_MODE_COUNT
+} probe_mode_t;
+
+extern char const * const probe_modeNames[PROBE_MODE_COUNT];
+extern uint8_t const probe_uuid[16];
+
+typedef struct probe_report_t {
+    uint8_t  bda[6];
+    uint     windowMs;  // since the previous report [msec]
+    uint     rx;        // distinct sequence numbers received in this window
+    uint     lost;      // .. skipped
+    uint     gaps;      // runs of skipped sequence numbers
+    uint     maxGap;    // longest run
+    uint     copies;    // advertisements with a sequence number already received
+    uint     restarts;  // times the sequence number went back, e.g. when the advertiser rebooted
+    uint     skewed;    // timestamps from the future, the clocks disagree
+    histo_t const * latency;  // from the advertised time to the hand-over to the MQTT task [usec]
+} probe_report_t;
+
+typedef void (* probe_emit_t)(probe_report_t const * const report, void * const priv);
+
+// small enough for a linear scan, advertisers are looked up by address
+
+typedef struct probe_t {
+    uint8_t  bda[PROBE_LEN][6];
+    bool     used[PROBE_LEN];
+    uint16_t seq[PROBE_LEN];       // last sequence number received
+    int64_t  last[PROBE_LEN];      // also used to find the least recently heard advertiser
+    uint     rx[PROBE_LEN];
+    uint     lost[PROBE_LEN];
+    uint     gaps[PROBE_LEN];
+    uint     maxGap[PROBE_LEN];
+    uint     copies[PROBE_LEN];
+    uint     restarts[PROBE_LEN];
+    uint     skewed[PROBE_LEN];
+    histo_t  latency[PROBE_LEN];
+    int64_t  start;                // of the window [usec]
+    uint     evictions;            // advertisers forgotten to make room
+    probe_emit_t emit;
+    void *   priv;
+} probe_t;
+
+void probe_payload(esp_ble_ibeacon_t * const payload, esp_ble_ibeacon_t const * const ident, probe_mode_t const mode,
+                   uint16_t const seq, int64_t const wall);
+void probe_init(probe_t * const tbl, probe_emit_t const emit, void * const priv, int64_t const time);
+void probe_update(probe_t * const tbl, uint8_t const * const bda, uint16_t const major, uint16_t const minor,
+                  int64_t const time, int64_t const wall);
+void probe_flush(probe_t * const tbl, int64_t const time);
@@ -0,0 +1,422 @@
+/**
+ * @brief scan_filter, allow/deny rules on iBeacon UUID, major, minor and address prefix
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdatomic.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <esp_log.h>
+#include <nvs.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "esp_ibeacon_api.h"
+#include "ipc.h"
+#include "scan_filter.h"
+
+static char const * const TAG = "scan_filter";
+
+/*
+ * A rule is compiled so that matching is a few integer compares: the address prefix is
+ * compared under a mask, the UUID as two 64-bit words, and major/minor as ranges that
+ * default to everything.
+ *
+ * The GAP callback reads the active rule set without locking.  An update compiles into the
+ * inactive set and then swaps the pointer.  Each set has its own counters, so a swap resets
+ * them without touching those the callback is incrementing.  The callback pins the set it
+ * reads in `busy`, and an update waits for the inactive set to be unpinned before rewriting
+ * it; otherwise two quick updates could rewrite the set the callback is still matching.
+ */
+
+#define SCAN_FILTER_MAX_RULES (CONFIG_BLESCAN_FILTER_MAX_RULES)
+#define SCAN_FILTER_NVS_KEY "filter"
+#define SCAN_FILTER_VERSION (1)  // bump when scanFilterRule_t changes
+
+typedef struct scanFilterRule_t {
+    uint64_t bda;       // address prefix, left aligned in the lower 48 bits
+    uint64_t bdaMask;   // 0 matches any address
+    uint64_t uuid[2];
+    uint16_t majorMin, majorMax;
+    uint16_t minorMin, minorMax;
+    uint8_t  hasUuid;
+    uint8_t  allow;
+    uint8_t  bdaLen;    // prefix length [bytes]
+} scanFilterRule_t;
+
+typedef struct scanFilterSet_t {
+    uint16_t         version;
+    uint16_t         cnt;
+    uint8_t          anyAllow;  // reject what doesn't match
+    scanFilterRule_t rule[SCAN_FILTER_MAX_RULES];
+} scanFilterSet_t;
+
+typedef struct scanFilterCount_t {
+    uint hit[SCAN_FILTER_MAX_RULES];  // per rule
+    uint miss;                        // matched no rule
+    uint reject;
+} scanFilterCount_t;
+
+static struct {
+    scanFilterSet_t           set[2];
+    scanFilterCount_t         count[2];  // of the set with the same index
+    _Atomic uint              busy[2];   // GAP callbacks reading the set with the same index
+    _Atomic(scanFilterSet_t *) active;
+    SemaphoreHandle_t         mutex;     // held while replacing the rules, "filter" and "set" come from different tasks
+} _filter = {
+    .active = &_filter.set[0],
+};
+
+static uint64_t
+_bda2u64(uint8_t const * const bda)
+{
+    uint64_t value = 0;
+    for (uint ii = 0; ii < ESP_BD_ADDR_LEN; ii++) {
+        value = (value << 8) | bda[ii];
+    }
+    return value;
+}
+
+// returns the index of the active set, after marking it busy so that it isn't rewritten
+
+static uint
+_pin(void)
+{
+    for (;;) {
+        scanFilterSet_t * const set = atomic_load(&_filter.active);
+        uint const idx = set - _filter.set;
+        atomic_fetch_add(&_filter.busy[idx], 1);
+        if (atomic_load(&_filter.active) == set) {
+            return idx;
+        }
+        atomic_fetch_sub(&_filter.busy[idx], 1);  // swapped meanwhile, an update may be rewriting it
+    }
+}
+
+static void
+_unpin(uint const idx)
+{
+    atomic_fetch_sub_explicit(&_filter.busy[idx], 1, memory_order_release);
+}
+
+static bool
+_accept(scanFilterSet_t const * const set, scanFilterCount_t * const count,
+        uint8_t const * const bda, esp_ble_ibeacon_vendor_t const * const vendor)
+{
+    if (set->cnt == 0) {
+        return true;
+    }
+    uint64_t const addr = _bda2u64(bda);
+    uint64_t uuid[2];
+    memcpy(uuid, vendor->proximity_uuid, sizeof(uuid));
+    uint16_t const major = ENDIAN_CHANGE_U16(vendor->major);
+    uint16_t const minor = ENDIAN_CHANGE_U16(vendor->minor);
+
+    for (uint ii = 0; ii < set->cnt; ii++) {
+        scanFilterRule_t const * const r = &set->rule[ii];
+        if ((addr & r->bdaMask) == r->bda &&
+            (!r->hasUuid || (uuid[0] == r->uuid[0] && uuid[1] == r->uuid[1])) &&
+            major >= r->majorMin && major <= r->majorMax &&
+            minor >= r->minorMin && minor <= r->minorMax) {
+
+            count->hit[ii]++;
+            if (!r->allow) {
+                count->reject++;
+            }
+            return r->allow;
+        }
+    }
+    count->miss++;
+    if (set->anyAllow) {
+        count->reject++;
+    }
+    return !set->anyAllow;
+}
+
+bool
+scanFilter_accept(uint8_t const * const bda, esp_ble_ibeacon_vendor_t const * const vendor)
+{
+    uint const idx = _pin();
+    bool const accept = _accept(&_filter.set[idx], &_filter.count[idx], bda, vendor);
+    _unpin(idx);
+    return accept;
+}
+
+/*
+ * Parses one rule:  allow|deny [uuid=HEX32] [major=N[-M]] [minor=N[-M]] [bda=aa:bb[:..]]
+ */
+
+static bool
+_parseRange(char const * const str, uint16_t * const min, uint16_t * const max)
+{
+    char * end;
+    unsigned long const lo = strtoul(str, &end, 10);
+    unsigned long hi = lo;
+    if (end == str) {
+        return false;
+    }
+    if (*end == '-') {
+        char const * const hiStr = end + 1;
+        hi = strtoul(hiStr, &end, 10);
+        if (end == hiStr) {
+            return false;
+        }
+    }
+    if (*end || lo > hi || hi > 0xFFFF) {
+        return false;
+    }
+    *min = lo;
+    *max = hi;
+    return true;
+}
+
+static bool
+_parseRule(char * const text, scanFilterRule_t * const r)
+{
+    *r = (scanFilterRule_t) {
+        .majorMax = 0xFFFF,
+        .minorMax = 0xFFFF,
+    };
+    char * save;
+    char const * tok = strtok_r(text, " \t", &save);
+    if (tok == NULL || (strcmp(tok, "allow") && strcmp(tok, "deny"))) {
+        return false;
+    }
+    r->allow = strcmp(tok, "allow") == 0;
+
+    while ((tok = strtok_r(NULL, " \t", &save))) {
+        if (strncmp(tok, "uuid=", 5) == 0) {
+            uint8_t uuid[ESP_UUID_LEN_128];
+            char const * hex = tok + 5;
+            for (uint ii = 0; ii < sizeof(uuid); ii++) {
+                if (*hex == '-') {
+                    hex++;  // allow the dashed notation
+                }
+                unsigned int byte;
+                if (!isxdigit((int)hex[0]) || !isxdigit((int)hex[1]) || sscanf(hex, "%2x", &byte) != 1) {
+                    return false;
+                }
+                uuid[ii] = byte;
+                hex += 2;
+            }
+            if (*hex) {
+                return false;
+            }
+            memcpy(r->uuid, uuid, sizeof(r->uuid));
+            r->hasUuid = true;
+        } else if (strncmp(tok, "major=", 6) == 0) {
+            if (!_parseRange(tok + 6, &r->majorMin, &r->majorMax)) {
+                return false;
+            }
+        } else if (strncmp(tok, "minor=", 6) == 0) {
+            if (!_parseRange(tok + 6, &r->minorMin, &r->minorMax)) {
+                return false;
+            }
+        } else if (strncmp(tok, "bda=", 4) == 0) {
+            uint8_t prefix[ESP_BD_ADDR_LEN] = {};
+            char const * p = tok + 4;
+            uint len = 0;
+            while (*p && len < ESP_BD_ADDR_LEN) {
+                unsigned int byte;
+                if (!isxdigit((int)p[0]) || !isxdigit((int)p[1]) || sscanf(p, "%2x", &byte) != 1) {
+                    return false;
+                }
+                prefix[len++] = byte;
+                p += 2;
+                if (*p == ':') {
+                    p++;
+                }
+            }
+            if (*p || len == 0) {
+                return false;
+            }
+            uint64_t const mask = ((1ULL << (8 * len)) - 1) << (8 * (ESP_BD_ADDR_LEN - len));
+            r->bda = _bda2u64(prefix) & mask;
+            r->bdaMask = mask;
+            r->bdaLen = len;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+_activate(scanFilterSet_t const * const compiled)
+{
+    uint const idx = (atomic_load(&_filter.active) == &_filter.set[0]) ? 1 : 0;
+    while (atomic_load(&_filter.busy[idx])) {
+        vTaskDelay(1);  // a GAP callback still matches against the set that was active before
+    }
+    _filter.set[idx] = *compiled;
+    _filter.count[idx] = (scanFilterCount_t) {};
+    atomic_store(&_filter.active, &_filter.set[idx]);
+}
+
+esp_err_t
+scanFilter_init(void)
+{
+    nvs_handle_t nvs_handle;
+    static scanFilterSet_t set;  // too large for the stack
+    size_t len = sizeof(set);
+
+    _filter.mutex = xSemaphoreCreateMutex();
+    assert(_filter.mutex);
+
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &nvs_handle);
+    if (err == ESP_OK) {
+        err = nvs_get_blob(nvs_handle, SCAN_FILTER_NVS_KEY, &set, &len);
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        return err;  // no rules, accept everything
+    }
+    if (len != sizeof(set) || set.version != SCAN_FILTER_VERSION || set.cnt > SCAN_FILTER_MAX_RULES) {
+        ESP_LOGW(TAG, "ignoring stored filter");
+        return ESP_ERR_INVALID_SIZE;
+    }
+    _activate(&set);
+    ESP_LOGI(TAG, "%u rules", set.cnt);
+    return ESP_OK;
+}
+
+static esp_err_t
+_load(char const * const text, size_t const text_len)
+{
+    char * const copy = strndup(text, text_len);
+    if (copy == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    static scanFilterSet_t set;  // too large for the stack
+    set = (scanFilterSet_t) {
+        .version = SCAN_FILTER_VERSION,
+    };
+    esp_err_t err = ESP_OK;
+    char * save;
+    for (char * line = strtok_r(copy, ";\n", &save); line; line = strtok_r(NULL, ";\n", &save)) {
+        while (isspace((int)*line)) {
+            line++;
+        }
+        if (*line == '\0' || strcmp(line, "clear") == 0) {
+            continue;
+        }
+        if (set.cnt == SCAN_FILTER_MAX_RULES) {
+            err = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if (!_parseRule(line, &set.rule[set.cnt])) {
+            ESP_LOGW(TAG, "can't parse rule %u", set.cnt + 1);
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        set.anyAllow |= set.rule[set.cnt].allow;
+        set.cnt++;
+    }
+    free(copy);
+    if (err != ESP_OK) {
+        return err;
+    }
+    _activate(&set);
+
+    nvs_handle_t nvs_handle;
+    if ((err = nvs_open("storage", NVS_READWRITE, &nvs_handle)) == ESP_OK) {
+        if ((err = nvs_set_blob(nvs_handle, SCAN_FILTER_NVS_KEY, &set, sizeof(set))) == ESP_OK) {
+            err = nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "can't store filter (%s)", esp_err_to_name(err));
+    }
+    return err;
+}
+
+/*
+ * Replaces the rules with those in `text`, separated by ';' or newlines.  An empty `text` or
+ * "clear" removes all rules.  Nothing changes when a rule can't be parsed.
+ */
+
+esp_err_t
+scanFilter_load(char const * const text, size_t const text_len)
+{
+    xSemaphoreTake(_filter.mutex, portMAX_DELAY);
+    esp_err_t const err = _load(text, text_len);
+    xSemaphoreGive(_filter.mutex);
+    return err;
+}
+
+/*
+ * Writes the rules and their counters as a JSON object.  Rules that don't fit in `buf` are
+ * counted in "more".
+ */
+
+int
+scanFilter_describe(char * const buf, size_t const buf_len)
+{
+    uint const idx = _pin();
+    scanFilterSet_t const * const set = &_filter.set[idx];
+    scanFilterCount_t const * const count = &_filter.count[idx];
+    size_t len = snprintf(buf, buf_len, "{ \"miss\": %u, \"reject\": %u, \"rules\": [", count->miss, count->reject);
+    size_t const reserve = 32;  // for "more" and the closing brackets
+    uint ii = 0;
+
+    for (; ii < set->cnt; ii++) {
+        scanFilterRule_t const * const r = &set->rule[ii];
+        char rule[160];
+        int rlen = snprintf(rule, sizeof(rule), "%s{ \"rule\": \"%s", ii ? ", " : " ", r->allow ? "allow" : "deny");
+        if (r->hasUuid) {
+            uint8_t uuid[ESP_UUID_LEN_128];
+            memcpy(uuid, r->uuid, sizeof(uuid));
+            rlen += snprintf(rule + rlen, sizeof(rule) - rlen, " uuid=");
+            for (uint jj = 0; jj < sizeof(uuid); jj++) {
+                rlen += snprintf(rule + rlen, sizeof(rule) - rlen, "%02x", uuid[jj]);
+            }
+        }
+        if (r->majorMin != 0 || r->majorMax != 0xFFFF) {
+            rlen += snprintf(rule + rlen, sizeof(rule) - rlen, " major=%u-%u", r->majorMin, r->majorMax);
+        }
+        if (r->minorMin != 0 || r->minorMax != 0xFFFF) {
+            rlen += snprintf(rule + rlen, sizeof(rule) - rlen, " minor=%u-%u", r->minorMin, r->minorMax);
+        }
+        for (uint jj = 0; jj < r->bdaLen; jj++) {
+            uint8_t const byte = r->bda >> (8 * (ESP_BD_ADDR_LEN - 1 - jj));
+            rlen += snprintf(rule + rlen, sizeof(rule) - rlen, "%s%02x", jj ? ":" : " bda=", byte);
+        }
+        rlen += snprintf(rule + rlen, sizeof(rule) - rlen, "\", \"hit\": %u }", count->hit[ii]);
+
+        if (len + rlen + reserve >= buf_len) {
+            break;
+        }
+        memcpy(buf + len, rule, rlen + 1);
+        len += rlen;
+    }
+    if (ii < set->cnt) {
+        len += snprintf(buf + len, buf_len - len, " ], \"more\": %u }", set->cnt - ii);
+    } else {
+        len += snprintf(buf + len, buf_len - len, " ] }");
+    }
+    _unpin(idx);
+    return len;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+/*
+ * Early-reject filter for iBeacon scan results, applied in the GAP callback before anything
+ * is copied or formatted.  Rules are tried in order and the first match decides.  When no
+ * rule matches, the result is accepted unless there is at least one `allow` rule.
+ */
+
+esp_err_t scanFilter_init(void);
+bool scanFilter_accept(uint8_t const * const bda, esp_ble_ibeacon_vendor_t const * const vendor);
+esp_err_t scanFilter_load(char const * const text, size_t const text_len);
+int scanFilter_describe(char * const buf, size_t const buf_len);
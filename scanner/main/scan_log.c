@@ -0,0 +1,334 @@
+/**
+ * @brief scan_log, store-and-forward ring of scan results in a flash partition
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include <freertos/FreeRTOS.h>
+
+#include "blescan_wire.h"
+#include "ipc.h"
+#include "scan_log.h"
+
+static char const * const TAG = "scan_log";
+
+/*
+ * The partition is used as a ring of sectors.  Each sector starts with a header holding a
+ * sequence number, followed by fixed-width records; an erased record reads as all ones.
+ * Sectors are filled in sequence order and erased once replayed, or when the ring wraps,
+ * so every sector sees the same number of erase cycles.  At boot, the sector headers tell
+ * where the oldest and newest records are.
+ *
+ * Records are buffered in RAM and written a flash page at a time.  Positions are absolute
+ * record numbers (sequence * records per sector + slot) that don't wrap in practice.
+ */
+
+#define SCANLOG_MAGIC (0x474C5342)  // "BSLG"
+#define SCANLOG_PAGE (256)
+
+typedef struct scanLogHdr_t {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t reserved[2];
+} scanLogHdr_t;
+
+typedef struct scanLogRec_t {
+    uint32_t timeMs;  // esp_timer_get_time() of the boot that wrote it [msec]
+    uint8_t  bda[6];
+    int8_t   rssi;
+    int8_t   txPwr;
+    uint16_t major;
+    uint16_t minor;
+} scanLogRec_t;
+
+_Static_assert(sizeof(scanLogRec_t) == 16, "scanLogRec_t must be 16 bytes");
+_Static_assert(sizeof(scanLogHdr_t) == sizeof(scanLogRec_t), "scanLogHdr_t takes the place of a record");
+
+#define SCANLOG_RECS_PER_SECTOR (SPI_FLASH_SEC_SIZE / sizeof(scanLogRec_t) - 1)
+#define SCANLOG_RECS_PER_PAGE (SCANLOG_PAGE / sizeof(scanLogRec_t))
+
+static struct {
+    esp_partition_t const * part;  // NULL when the partition table lacks "scanlog"
+    uint                    sectors;
+    uint32_t                head;       // position of the next record to write
+    uint32_t                tail;       // position of the oldest record not taken yet
+    uint32_t                bootStart;  // records before this position were written by an earlier boot
+    scanLogRec_t            buf[SCANLOG_RECS_PER_PAGE];  // not yet written, they follow `head`
+    uint                    bufCnt;
+    struct {
+        uint32_t            tail;       // where the records returned by scanLog_peek() start
+        uint                taken;      // .. positions they span, including erased ones
+        uint                cnt;        // .. records
+    } peek;
+    scanLog_stats_t         stats;
+} _log = {};
+
+static size_t
+_offset(uint32_t const pos)
+{
+    return (pos / SCANLOG_RECS_PER_SECTOR % _log.sectors) * SPI_FLASH_SEC_SIZE + (1 + pos % SCANLOG_RECS_PER_SECTOR) * sizeof(scanLogRec_t);
+}
+
+static void
+_erase(uint32_t const seq)
+{
+    esp_err_t const err = esp_partition_erase_range(_log.part, (seq % _log.sectors) * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "erase failed (%s)", esp_err_to_name(err));
+    }
+    _log.stats.erases++;
+}
+
+// erases the sector for `seq`, and gives up the oldest records when the ring is full
+
+static void
+_openSector(uint32_t const seq)
+{
+    uint32_t const oldest = (seq >= _log.sectors) ? (seq - _log.sectors + 1) * SCANLOG_RECS_PER_SECTOR : 0;
+    if (_log.tail < oldest) {
+        _log.stats.lost += oldest - _log.tail;
+        _log.tail = oldest;
+    }
+    _erase(seq);
+    scanLogHdr_t const hdr = {
+        .magic = SCANLOG_MAGIC,
+        .seq = seq,
+    };
+    esp_err_t const err = esp_partition_write(_log.part, (seq % _log.sectors) * SPI_FLASH_SEC_SIZE, &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "write failed (%s)", esp_err_to_name(err));
+    }
+}
+
+void
+scanLog_sync(void)
+{
+    if (_log.bufCnt) {
+        esp_err_t const err = esp_partition_write(_log.part, _offset(_log.head), _log.buf, _log.bufCnt * sizeof(scanLogRec_t));
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "write failed (%s)", esp_err_to_name(err));
+        }
+        _log.head += _log.bufCnt;
+        _log.bufCnt = 0;
+    }
+}
+
+void
+scanLog_append(blescan_wire_rec_t const * const rec, int64_t const time)
+{
+    if (_log.part == NULL) {
+        return;
+    }
+    uint32_t const pos = _log.head + _log.bufCnt;
+    if (pos % SCANLOG_RECS_PER_SECTOR == 0) {  // the buffer never spans sectors
+        scanLog_sync();
+        _openSector(pos / SCANLOG_RECS_PER_SECTOR);
+    }
+    scanLogRec_t * const dst = &_log.buf[_log.bufCnt++];
+    *dst = (scanLogRec_t) {
+        .timeMs = time / 1000,
+        .rssi = rec->rssi,
+        .txPwr = rec->txPwr,
+        .major = rec->major,
+        .minor = rec->minor,
+    };
+    memcpy(dst->bda, rec->bda, sizeof(dst->bda));
+    _log.stats.logged++;
+
+    if (_log.bufCnt == SCANLOG_RECS_PER_PAGE) {
+        scanLog_sync();
+    }
+}
+
+uint
+scanLog_pending(void)
+{
+    return _log.head + _log.bufCnt - _log.tail;
+}
+
+/*
+ * Fills `buf` with a binary scan payload holding the oldest records, that stay in the log until
+ * scanLog_consume().  A payload doesn't mix boots, and doesn't span more time than a timeDelta
+ * can express.  Returns the payload length, or 0 when the log is empty.
+ */
+
+uint
+scanLog_peek(uint8_t * const buf, uint const buf_len)
+{
+    _log.peek.taken = 0;
+    scanLog_sync();
+
+    uint32_t const sectorEnd = (_log.tail / SCANLOG_RECS_PER_SECTOR + 1) * SCANLOG_RECS_PER_SECTOR;
+    uint32_t end = MIN(_log.head, sectorEnd);
+    if (_log.tail < _log.bootStart) {
+        end = MIN(end, _log.bootStart);
+    }
+    uint const max = MIN(end - _log.tail, (buf_len - sizeof(blescan_wire_hdr_t)) / sizeof(blescan_wire_rec_t));
+    if (_log.part == NULL || max == 0) {
+        return 0;
+    }
+    scanLogRec_t recs[SCANLOG_RECS_PER_PAGE];
+    blescan_wire_hdr_t * const hdr = (blescan_wire_hdr_t *)buf;
+    blescan_wire_rec_t * const out = (blescan_wire_rec_t *)(hdr + 1);
+    uint cnt = 0;
+    uint taken = 0;
+    uint32_t baseMs = 0;
+
+    while (taken < max) {
+        uint const n = MIN(max - taken, SCANLOG_RECS_PER_PAGE);
+        if (esp_partition_read(_log.part, _offset(_log.tail + taken), recs, n * sizeof(scanLogRec_t)) != ESP_OK) {
+            ESP_LOGE(TAG, "read failed");
+            break;
+        }
+        uint ii = 0;
+        for (; ii < n; ii++) {
+            scanLogRec_t const * const rec = &recs[ii];
+            if (rec->timeMs == UINT32_MAX) {  // erased, lost in a power failure
+                continue;
+            }
+            if (cnt == 0) {
+                baseMs = rec->timeMs;
+            } else if (rec->timeMs < baseMs || rec->timeMs - baseMs > UINT32_MAX / 1000) {
+                break;  // next payload
+            }
+            out[cnt] = (blescan_wire_rec_t) {
+                .rssi = rec->rssi,
+                .txPwr = rec->txPwr,
+                .major = rec->major,
+                .minor = rec->minor,
+                .timeDelta = (rec->timeMs - baseMs) * 1000,
+            };
+            memcpy(out[cnt].bda, rec->bda, sizeof(out[cnt].bda));
+            cnt++;
+        }
+        taken += ii;
+        if (ii < n) {
+            break;
+        }
+    }
+    *hdr = (blescan_wire_hdr_t) {
+        .version = BLESCAN_WIRE_VERSION,
+        .flags = BLESCAN_WIRE_FLAG_REPLAY | (_log.tail < _log.bootStart ? BLESCAN_WIRE_FLAG_PRIOR_BOOT : 0),
+        .count = cnt,
+        .baseTime = (int64_t)baseMs * 1000,
+    };
+    _log.peek.tail = _log.tail;
+    _log.peek.taken = taken;
+    _log.peek.cnt = cnt;
+    return cnt ? sizeof(*hdr) + cnt * sizeof(*out) : 0;
+}
+
+// forgets the records returned by the last scanLog_peek(), once they are published
+
+void
+scanLog_consume(void)
+{
+    if (_log.peek.taken == 0 || _log.peek.tail != _log.tail) {  // nothing peeked, or lost since
+        return;
+    }
+    _log.tail += _log.peek.taken;
+    _log.stats.replayed += _log.peek.cnt;
+    _log.peek.taken = 0;
+
+    if (_log.tail % SCANLOG_RECS_PER_SECTOR == 0) {  // done with this sector
+        _erase(_log.tail / SCANLOG_RECS_PER_SECTOR - 1);
+    }
+    if (_log.tail == _log.head) {  // all replayed, start with a fresh sector next time
+        if (_log.head % SCANLOG_RECS_PER_SECTOR) {
+            _erase(_log.head / SCANLOG_RECS_PER_SECTOR);
+        }
+        _log.head = _log.tail = (_log.head + SCANLOG_RECS_PER_SECTOR - 1) / SCANLOG_RECS_PER_SECTOR * SCANLOG_RECS_PER_SECTOR;
+    }
+}
+
+bool
+scanLog_enabled(void)
+{
+    return _log.part != NULL;
+}
+
+scanLog_stats_t const *
+scanLog_stats(void)
+{
+    return &_log.stats;
+}
+
+// finds the newest sector, and follows the sequence numbers back to the oldest one
+
+esp_err_t
+scanLog_init(void)
+{
+    _log.part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "scanlog");
+    if (_log.part == NULL || _log.part->size < 2 * SPI_FLASH_SEC_SIZE) {
+        ESP_LOGW(TAG, "no scanlog partition, scan results are lost while disconnected");
+        _log.part = NULL;
+        return ESP_ERR_NOT_FOUND;
+    }
+    _log.sectors = _log.part->size / SPI_FLASH_SEC_SIZE;
+
+    uint32_t * const seqs = calloc(_log.sectors, sizeof(uint32_t));
+    bool * const valid = calloc(_log.sectors, sizeof(bool));
+    if (seqs == NULL || valid == NULL) {
+        free(seqs);
+        free(valid);
+        _log.part = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    bool any = false;
+    uint32_t newest = 0;
+    for (uint ii = 0; ii < _log.sectors; ii++) {
+        scanLogHdr_t hdr;
+        valid[ii] = esp_partition_read(_log.part, ii * SPI_FLASH_SEC_SIZE, &hdr, sizeof(hdr)) == ESP_OK &&
+                    hdr.magic == SCANLOG_MAGIC && hdr.seq % _log.sectors == ii;
+        seqs[ii] = hdr.seq;
+        if (valid[ii] && (!any || hdr.seq > newest)) {
+            newest = hdr.seq;
+            any = true;
+        }
+    }
+    if (any) {
+        uint32_t oldest = newest;
+        while (oldest > 0 && newest - oldest + 1 < _log.sectors) {
+            uint const ii = (oldest - 1) % _log.sectors;
+            if (!valid[ii] || seqs[ii] != oldest - 1) {
+                break;
+            }
+            oldest--;
+        }
+        // the first erased slot in the newest sector is where writing continues
+        uint slot = 0;
+        scanLogRec_t rec;
+        while (slot < SCANLOG_RECS_PER_SECTOR &&
+               esp_partition_read(_log.part, _offset(newest * SCANLOG_RECS_PER_SECTOR + slot), &rec, sizeof(rec)) == ESP_OK &&
+               rec.timeMs != UINT32_MAX) {
+            slot++;
+        }
+        _log.tail = oldest * SCANLOG_RECS_PER_SECTOR;
+        _log.head = newest * SCANLOG_RECS_PER_SECTOR + slot;
+    }
+    _log.bootStart = _log.head;
+    free(seqs);
+    free(valid);
+    ESP_LOGI(TAG, "%u sectors, %u records from before the restart", _log.sectors, (uint)scanLog_pending());
+    return ESP_OK;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/*
+ * Store-and-forward log for scan results, kept in the "scanlog" data partition.  While the
+ * broker is unreachable, scan results are appended; after reconnecting they are read back,
+ * oldest first, as binary scan payloads (see blescan_wire.h), and only forgotten once published.
+ * Only used from mqtt_task, apart from scanLog_enabled().
+ */
+
+typedef struct scanLog_stats_t {
+    uint logged;    // records appended
+    uint replayed;  // records published from the log
+    uint lost;      // records overwritten because the log was full
+    uint erases;    // sectors erased
+} scanLog_stats_t;
+
+esp_err_t scanLog_init(void);
+bool scanLog_enabled(void);
+void scanLog_append(blescan_wire_rec_t const * const rec, int64_t const time);
+void scanLog_sync(void);
+uint scanLog_pending(void);
+uint scanLog_peek(uint8_t * const buf, uint const buf_len);
+void scanLog_consume(void);
+scanLog_stats_t const * scanLog_stats(void);
@@ -0,0 +1,457 @@
+/**
+ * @brief scan_task, turns raw beacon scan results into MQTT scan messages
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <esp_bt_defs.h>
+#include <esp_gap_ble_api.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "esp_ibeacon_api.h"
+#include "ble_adv.h"
+#include "blescan_wire.h"
+#include "ipc.h"
+#include "devname.h"
+#include "beacon_tbl.h"
+#include "beacon_track.h"
+#include "histo.h"
+#include "probe.h"
+#include "scan_filter.h"
+#include "scan_log.h"
+#include "timesync.h"
+#include "scan_task.h"
+
+static char const * const TAG = "scan_task";
+
+/*
+ * Lock-free single-producer/single-consumer ring between the GAP callback (producer) and
+ * scan_task (consumer).  The GAP callback only copies the fields it needs, so that it returns
+ * to Bluedroid as fast as possible.  The indices run freely and are masked on access.
+ */
+
+#define SCAN_RING_LEN (CONFIG_BLESCAN_SCAN_RING_LEN)
+_Static_assert((SCAN_RING_LEN & (SCAN_RING_LEN - 1)) == 0, "BLESCAN_SCAN_RING_LEN must be a power of 2");
+
+typedef struct scan_raw_t {
+    int64_t                   time;  // esp_timer_get_time() when the GAP callback was called [usec]
+    uint8_t                   bda[ESP_BD_ADDR_LEN];
+    int8_t                    rssi;
+    esp_ble_ibeacon_vendor_t  vendor;
+} scan_raw_t;
+
+static struct {
+    scan_raw_t   slot[SCAN_RING_LEN];
+    atomic_uint  head;      // only written by the producer
+    atomic_uint  tail;      // only written by the consumer
+    TaskHandle_t consumer;  // notified when a record is added
+} _ring = {};
+
+static bool
+_ringPush(scan_raw_t const * const raw, uint * const used)
+{
+    uint const head = atomic_load_explicit(&_ring.head, memory_order_relaxed);
+    uint const tail = atomic_load_explicit(&_ring.tail, memory_order_acquire);
+
+    if (head - tail >= SCAN_RING_LEN) {
+        return false;
+    }
+    _ring.slot[head & (SCAN_RING_LEN - 1)] = *raw;
+    atomic_store_explicit(&_ring.head, head + 1, memory_order_release);
+    *used = head + 1 - tail;
+    return true;
+}
+
+static bool
+_ringPop(scan_raw_t * const raw)
+{
+    uint const tail = atomic_load_explicit(&_ring.tail, memory_order_relaxed);
+    uint const head = atomic_load_explicit(&_ring.head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+    *raw = _ring.slot[tail & (SCAN_RING_LEN - 1)];
+    atomic_store_explicit(&_ring.tail, tail + 1, memory_order_release);
+    return true;
+}
+
+/*
+ * Called from the GAP callback for ESP_GAP_BLE_SCAN_RESULT_EVT.  Runs on the Bluedroid
+ * task, so keep it short: no formatting, no allocations, no blocking.
+ */
+
+void
+sendToScan(esp_ble_gap_cb_param_t const * const param, ipc_t * const ipc)
+{
+    int64_t const start = esp_timer_get_time();
+    struct ble_scan_result_evt_param const * const scan_rst = &param->scan_rst;
+
+    ipc->dev.count.advRx++;
+
+    bleAdv_beacon_t beacon;
+    if (scan_rst->search_evt == ESP_GAP_SEARCH_INQ_RES_EVT &&
+        bleAdv_parseBeacon(scan_rst->ble_adv, scan_rst->adv_data_len + scan_rst->scan_rsp_len, &beacon) != BLE_ADV_FMT_NONE &&
+        beacon.id != NULL) {
+
+        ipc->dev.count.beaconRx++;
+
+        // iBeacon, AltBeacon and Eddystone-UID all fit the iBeacon layout (Eddystone's id as UUID)
+        scan_raw_t raw = {
+            .time = start,
+            .rssi = scan_rst->rssi,
+            .vendor = {
+                .major = ENDIAN_CHANGE_U16(beacon.major),
+                .minor = ENDIAN_CHANGE_U16(beacon.minor),
+                .measured_power = beacon.txPwr,
+            },
+        };
+        memcpy(raw.vendor.proximity_uuid, beacon.id, BLE_ADV_ID_LEN);
+
+        if (scanFilter_accept(scan_rst->bda, &raw.vendor)) {
+            memcpy(raw.bda, scan_rst->bda, ESP_BD_ADDR_LEN);
+
+            uint used;
+            if (_ringPush(&raw, &used)) {
+                ipc->dev.count.ringHwm = MAX(ipc->dev.count.ringHwm, used);
+                if (_ring.consumer) {
+                    xTaskNotifyGive(_ring.consumer);
+                }
+            } else {
+                ipc->dev.count.scanDrop++;
+            }
+        }
+    }
+    uint const duration = esp_timer_get_time() - start;
+    ipc->dev.count.gapCbTotUs += duration;
+    ipc->dev.count.gapCbMaxUs = MAX(ipc->dev.count.gapCbMaxUs, duration);
+}
+
+// `est` is NULL unless the beacon's RSSI is smoothed
+
+static void
+_raw2json(scan_raw_t const * const raw, beaconTrack_est_t const * const est, ipc_t * const ipc)
+{
+    ipc_to_mqtt_msg_t * const msg = ipc_claim(ipc->toMqttQ);
+    if (msg == NULL) {
+        return;  // counted by ipc_claim
+    }
+    uint len = 0;
+    char * const payload = msg->data;
+    char devName[BLE_DEVNAME_LEN];
+    bda2devName(raw->bda, devName, BLE_DEVNAME_LEN);
+
+    len += sprintf(payload + len, "{ \"name\": \"%s\"", devName);
+
+    len += sprintf(payload + len, ", \"address\": \"");
+    for (uint ii = 0; ii < ESP_BD_ADDR_LEN; ii++) {
+        len += sprintf(payload + len, "%02x%c", raw->bda[ii], (ii < ESP_BD_ADDR_LEN - 1) ? ':' : '"');
+    }
+    len += sprintf(payload + len, ", \"txPwr\": %d", raw->vendor.measured_power);
+    len += sprintf(payload + len, ", \"RSSI\": %d", raw->rssi);
+    if (est) {
+        len += sprintf(payload + len, ", \"smoothed\": %.1f", est->rssi);
+        if (est->distance >= 0) {
+            len += sprintf(payload + len, ", \"distance\": %.2f", est->distance);
+        }
+    }
+    int64_t wall;
+    if (timeSync_toWall(raw->time, &wall)) {
+        len += sprintf(payload + len, ", \"time\": %" PRId64 " }", wall);
+    } else {
+        len += sprintf(payload + len, ", \"uptime\": %" PRId64 " }", raw->time);
+    }
+
+    msg->dataType = IPC_TO_MQTT_MSGTYPE_SCAN;
+    msg->time = raw->time;
+    msg->dataLen = len;
+    ipc_send(ipc->toMqttQ, msg);
+    ipc->dev.count.scanEnqueued++;
+}
+
+static void
+_raw2bin(scan_raw_t const * const raw, ipc_to_mqtt_typ_t const dataType, ipc_t * const ipc)
+{
+    ipc_to_mqtt_msg_t * const msg = ipc_claim(ipc->toMqttQ);
+    if (msg == NULL) {
+        return;  // counted by ipc_claim
+    }
+    blescan_wire_hdr_t * const hdr = (blescan_wire_hdr_t *)msg->data;
+    blescan_wire_rec_t * const rec = (blescan_wire_rec_t *)(hdr + 1);
+
+    *hdr = (blescan_wire_hdr_t) {
+        .version = BLESCAN_WIRE_VERSION,
+        .count = 1,
+        .baseTime = raw->time,
+    };
+    int64_t wall;
+    if (dataType == IPC_TO_MQTT_MSGTYPE_SCAN_BIN) {
+        if (timeSync_toWall(raw->time, &wall)) {
+            hdr->baseTime = wall;
+        } else {
+            hdr->flags = BLESCAN_WIRE_FLAG_UPTIME;
+        }
+    }
+    *rec = (blescan_wire_rec_t) {
+        .rssi = raw->rssi,
+        .txPwr = raw->vendor.measured_power,
+        .major = ENDIAN_CHANGE_U16(raw->vendor.major),
+        .minor = ENDIAN_CHANGE_U16(raw->vendor.minor),
+        .timeDelta = 0,
+    };
+    memcpy(rec->bda, raw->bda, ESP_BD_ADDR_LEN);
+
+    msg->dataType = dataType;
+    msg->time = raw->time;
+    msg->dataLen = sizeof(*hdr) + sizeof(*rec);
+    ipc_send(ipc->toMqttQ, msg);
+    ipc->dev.count.scanEnqueued++;
+}
+
+/*
+ * In summary mode, advertisements are aggregated per beacon, and one summary per beacon
+ * is published at the end of each window.
+ */
+
+static beaconTbl_t _tbl;
+
+// the end of a window can bring more summaries than there are message slots, so they are
+// paced: when no slot is free, the rest waits until mqtt_task released some
+
+static bool
+_summary2json(beaconSummary_t const * const summary, void * const priv)
+{
+    ipc_t const * const ipc = priv;
+    ipc_to_mqtt_msg_t * const msg = ipc_tryClaim(ipc->toMqttQ);
+    if (msg == NULL) {
+        return false;
+    }
+    char devName[BLE_DEVNAME_LEN];
+    bda2devName(summary->key.bda, devName, BLE_DEVNAME_LEN);
+    char bda[BLE_DEVMAC_LEN];
+    bda2str(summary->key.bda, bda);
+    char uuid[2 * sizeof(summary->key.uuid) + 1];
+    for (uint ii = 0; ii < sizeof(summary->key.uuid); ii++) {
+        sprintf(uuid + 2 * ii, "%02x", summary->key.uuid[ii]);
+    }
+    int64_t first = summary->first, last = summary->last;  // Unix time once synced, else since boot
+    timeSync_toWall(summary->first, &first);
+    timeSync_toWall(summary->last, &last);
+    int const len = snprintf(msg->data, sizeof(msg->data),
+        "{ \"name\": \"%s\", \"address\": \"%s\", \"uuid\": \"%s\", \"major\": %u, \"minor\": %u, \"txPwr\": %d, \"count\": %u, \"RSSI\": { \"min\": %d, \"avg\": %d, \"max\": %d }, \"first\": %" PRId64 ", \"last\": %" PRId64 " }",
+        devName, bda, uuid, summary->key.major, summary->key.minor, summary->txPwr, summary->cnt,
+        summary->rssiMin, summary->rssiAvg, summary->rssiMax, first / 1000, last / 1000);
+
+    msg->dataType = IPC_TO_MQTT_MSGTYPE_SUMMARY;
+    msg->time = 0;
+    msg->dataLen = MIN((uint)len, sizeof(msg->data) - 1);
+    ipc_send(ipc->toMqttQ, msg);
+    return true;
+}
+
+static void
+_raw2key(scan_raw_t const * const raw, beaconKey_t * const key)
+{
+    *key = (beaconKey_t) {
+        .major = ENDIAN_CHANGE_U16(raw->vendor.major),
+        .minor = ENDIAN_CHANGE_U16(raw->vendor.minor),
+    };
+    memcpy(key->bda, raw->bda, sizeof(key->bda));
+    memcpy(key->uuid, raw->vendor.proximity_uuid, sizeof(key->uuid));
+}
+
+static void
+_raw2summary(scan_raw_t const * const raw)
+{
+    beaconKey_t key;
+    _raw2key(raw, &key);
+    beaconTbl_update(&_tbl, &key, raw->rssi, raw->vendor.measured_power, raw->time);
+}
+
+/*
+ * While tracking, a scan result is only reported when its beacon's smoothed RSSI moved
+ * since the last report, or the beacon went unreported for too long.  Binary records then
+ * carry the smoothed RSSI; JSON carries both, and the distance estimate.
+ */
+
+static beaconTrack_t _track;
+static uint _sampleCnt;  // for 1-in-N sampling under backpressure
+
+static bool
+_raw2track(scan_raw_t const * const raw, beaconTrack_cfg_t const * const cfg, beaconTrack_est_t * const est)
+{
+    beaconKey_t key;
+    _raw2key(raw, &key);
+    return beaconTrack_update(&_track, cfg, &key, raw->rssi, raw->vendor.measured_power, raw->time, est);
+}
+
+/*
+ * While measuring, probe advertisements (see probe.h) are also accounted per advertiser, and
+ * the reception statistics are published per window.  They still get reported like any other
+ * scan result.
+ */
+
+static probe_t _probe;
+
+static void
+_probe2json(probe_report_t const * const report, void * const priv)
+{
+    ipc_t const * const ipc = priv;
+    ipc_to_mqtt_msg_t * const msg = ipc_claim(ipc->toMqttQ);
+    if (msg == NULL) {
+        return;  // counted by ipc_claim
+    }
+    char devName[BLE_DEVNAME_LEN];
+    bda2devName(report->bda, devName, BLE_DEVNAME_LEN);
+    char bda[BLE_DEVMAC_LEN];
+    bda2str(report->bda, bda);
+    histo_t const * const latency = report->latency;
+    uint const expected = report->rx + report->lost;
+    int const len = snprintf(msg->data, sizeof(msg->data),
+        "{ \"name\": \"%s\", \"address\": \"%s\", \"window\": %u, \"rx\": %u, \"lost\": %u, \"ratio\": %.3f, "
+        "\"gaps\": %u, \"maxGap\": %u, \"copies\": %u, \"restarts\": %u, "
+        "\"latencyUs\": { \"n\": %u, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u, \"skewed\": %u } }",
+        devName, bda, report->windowMs, report->rx, report->lost, expected ? (double)report->rx / expected : 0.0,
+        report->gaps, report->maxGap, report->copies, report->restarts,
+        latency->cnt, histo_percentile(latency, 50), histo_percentile(latency, 90), histo_percentile(latency, 99),
+        latency->max, report->skewed);
+
+    msg->dataType = IPC_TO_MQTT_MSGTYPE_PROBE;
+    msg->time = 0;
+    msg->dataLen = MIN((uint)len, sizeof(msg->data) - 1);
+    ipc_send(ipc->toMqttQ, msg);
+}
+
+static void
+_raw2probe(scan_raw_t const * const raw)
+{
+    int64_t wall;
+    if (!timeSync_toWall(esp_timer_get_time(), &wall)) {
+        wall = -1;
+    }
+    probe_update(&_probe, raw->bda, ENDIAN_CHANGE_U16(raw->vendor.major), ENDIAN_CHANGE_U16(raw->vendor.minor),
+                 raw->time, wall);
+}
+
+// ticks to wait for a deadline `remaining` [usec] away, rounded up, so it doesn't spin
+
+static TickType_t
+_waitTicks(int64_t const remaining)
+{
+    int64_t const waitMs = (MAX(remaining, (int64_t)0) + 999) / 1000;
+    return (TickType_t)((waitMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS);
+}
+
+void
+scan_task(void * ipc_void) {
+
+    ESP_LOGI(TAG, "starting ..");
+	ipc_t * ipc = ipc_void;
+
+    _ring.consumer = xTaskGetCurrentTaskHandle();
+    beaconTbl_init(&_tbl, _summary2json, ipc);
+    beaconTrack_init(&_track);
+    int64_t windowStart = esp_timer_get_time();
+    int64_t windowEnd = 0;  // of the window being flushed, 0 when done
+    probe_init(&_probe, _probe2json, ipc, windowStart);
+
+	while (1) {
+        uint const pressure = ipc->cfg.pressure;
+        uint const summaryMs = ipc->cfg.summaryMs ?: (pressure == IPC_PRESSURE_summary ? CONFIG_BLESCAN_BACKPRESSURE_SUMMARY_MSEC : 0);
+        TickType_t wait = (TickType_t)(1000L / portTICK_PERIOD_MS);
+        if (summaryMs) {
+            wait = MIN(wait, _waitTicks((int64_t)summaryMs * 1000L - (esp_timer_get_time() - windowStart)));
+        }
+        uint const probeMs = ipc->cfg.probeMs;
+        if (probeMs) {
+            wait = MIN(wait, _waitTicks((int64_t)probeMs * 1000L - (esp_timer_get_time() - _probe.start)));
+        }
+        if (windowEnd) {
+            wait = MIN(wait, (TickType_t)1);  // for mqtt_task to free message slots
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        bool const offline = !ipc->dev.online && scanLog_enabled();
+        beaconTrack_cfg_t const track = {
+            .filter = ipc->cfg.trackFilter,
+            .hystDb = ipc->cfg.trackDb,
+            .silenceMs = ipc->cfg.trackMs,
+        };
+        scan_raw_t raw;
+        while (_ringPop(&raw)) {
+            if (probeMs && memcmp(raw.vendor.proximity_uuid, probe_uuid, sizeof(probe_uuid)) == 0) {
+                _raw2probe(&raw);
+            }
+            if (offline) {  // compact records for the scan log, whatever the format or summary mode
+                _raw2bin(&raw, IPC_TO_MQTT_MSGTYPE_SCAN_LOG, ipc);
+                continue;
+            }
+            if (summaryMs) {
+                _raw2summary(&raw);
+                continue;
+            }
+            beaconTrack_est_t est;
+            beaconTrack_est_t const * smoothed = NULL;
+            if (track.filter != BEACON_TRACK_FILTER_off) {
+                if (!_raw2track(&raw, &track, &est)) {
+                    ipc->dev.count.trackSuppressed++;
+                    continue;
+                }
+                smoothed = &est;
+            }
+            if (pressure == IPC_PRESSURE_sample && _sampleCnt++ % CONFIG_BLESCAN_BACKPRESSURE_SAMPLE_N) {
+                ipc->dev.count.sampleSkip++;
+                continue;
+            }
+            uint const fmt = ipc->cfg.scanFmt;
+            if (fmt & IPC_SCAN_FMT_JSON) {
+                _raw2json(&raw, smoothed, ipc);
+            }
+            if (smoothed) {
+                raw.rssi = lroundf(smoothed->rssi);  // binary records have no room for both
+            }
+            if (fmt & IPC_SCAN_FMT_BIN) {
+                _raw2bin(&raw, IPC_TO_MQTT_MSGTYPE_SCAN_BIN, ipc);
+            }
+        }
+        int64_t const now = esp_timer_get_time();
+        if (windowEnd == 0 && (summaryMs == 0 || now - windowStart >= (int64_t)summaryMs * 1000L)) {
+            windowEnd = now;
+            windowStart = now;
+        }
+        if (windowEnd && beaconTbl_flush(&_tbl, windowEnd)) {  // quick when empty
+            windowEnd = 0;
+        }
+        if (probeMs == 0 || now - _probe.start >= (int64_t)probeMs * 1000L) {
+            probe_flush(&_probe, now);  // reports the last window once turned off, then forgets
+        }
+        ipc->dev.count.summaryEvict = _tbl.evictions;
+        ipc->dev.count.summaryDrop = _tbl.dropped;
+        ipc->dev.count.trackEvict = _track.evictions;
+        ipc->dev.count.probeEvict = _probe.evictions;
+	}
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+void scan_task(void * ipc_void);
+void sendToScan(esp_ble_gap_cb_param_t const * const param, ipc_t * const ipc);
\ No newline at end of file
@@ -0,0 +1,158 @@
+/**
+ * @brief timesync, converts esp_timer time to SNTP synced wall-clock time
+ * 
+ * This file is part of BLEscan.
+ * 
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * 
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License along with BLEscan. 
+ * If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <sdkconfig.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <esp_log.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+
+#include "timesync.h"
+
+static char const * const TAG = "timesync";
+
+/*
+ * At each sync, the local time (esp_timer) and the server's time are noted as a reference
+ * pair.  Local times are converted by scaling their distance to that reference with the
+ * drift.  The drift is estimated from successive syncs, and averaged with the previous
+ * estimate to smooth out SNTP's network jitter.
+ *
+ * scan_task converts without locking: a sync writes the inactive reference and then swaps
+ * the pointer, as the syncs are far enough apart for readers to be done with the old one.
+ */
+
+#define TIMESYNC_MIN_DRIFT_INTERVAL (60 * 1000000LL)  // shorter intervals are dominated by jitter [usec]
+#define TIMESYNC_MAX_DRIFT (500e-6)                  // more means the clock was stepped
+
+typedef struct timeSyncRef_t {
+    int64_t local;  // [usec]
+    int64_t wall;   // Unix time [usec]
+    double  drift;  // wall time elapsed per local time elapsed, minus 1
+} timeSyncRef_t;
+
+static struct {
+    timeSyncRef_t           ref[2];
+    _Atomic(timeSyncRef_t *) active;  // NULL until the first sync
+    uint                    syncs;
+    int64_t                 offsetUs;
+} _sync = {};
+
+static int64_t
+_toWall(timeSyncRef_t const * const ref, int64_t const local)
+{
+    int64_t const elapsed = local - ref->local;
+    return ref->wall + elapsed + (int64_t)(elapsed * ref->drift);
+}
+
+void
+timeSync_update(int64_t const local, int64_t const wall)
+{
+    timeSyncRef_t const * const prev = atomic_load_explicit(&_sync.active, memory_order_acquire);
+    timeSyncRef_t * const next = (prev == &_sync.ref[0]) ? &_sync.ref[1] : &_sync.ref[0];
+
+    *next = (timeSyncRef_t) {
+        .local = local,
+        .wall = wall,
+    };
+    if (prev) {
+        _sync.offsetUs = wall - _toWall(prev, local);
+        next->drift = prev->drift;
+
+        int64_t const interval = local - prev->local;
+        if (interval >= TIMESYNC_MIN_DRIFT_INTERVAL) {
+            double const drift = (double)(wall - prev->wall) / interval - 1;
+            if (drift > -TIMESYNC_MAX_DRIFT && drift < TIMESYNC_MAX_DRIFT) {
+                next->drift = (_sync.syncs > 1) ? (prev->drift + drift) / 2 : drift;
+            }
+        }
+    }
+    atomic_store_explicit(&_sync.active, next, memory_order_release);
+    _sync.syncs++;
+}
+
+bool
+timeSync_toWall(int64_t const local, int64_t * const wall)
+{
+    timeSyncRef_t const * const ref = atomic_load_explicit(&_sync.active, memory_order_acquire);
+    if (ref == NULL) {
+        return false;
+    }
+    *wall = _toWall(ref, local);
+    return true;
+}
+
+// the inverse, for scheduling at a wall-clock time
+
+bool
+timeSync_toLocal(int64_t const wall, int64_t * const local)
+{
+    timeSyncRef_t const * const ref = atomic_load_explicit(&_sync.active, memory_order_acquire);
+    if (ref == NULL) {
+        return false;
+    }
+    *local = ref->local + (int64_t)((wall - ref->wall) / (1 + ref->drift));
+    return true;
+}
+
+void
+timeSync_stats(timeSync_stats_t * const stats)
+{
+    timeSyncRef_t const * const ref = atomic_load_explicit(&_sync.active, memory_order_acquire);
+    *stats = (timeSync_stats_t) {
+        .synced = ref != NULL,
+        .syncs = _sync.syncs,
+        .lastSync = ref ? ref->local : 0,
+        .offsetUs = _sync.offsetUs,
+        .driftPpm = ref ? ref->drift * 1e6 : 0,
+    };
+}
+
+// called by the SNTP client after it set the system time
+
+static void
+_onSync(struct timeval * const tv)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    int64_t const local = esp_timer_get_time();
+    timeSync_update(local, (int64_t)now.tv_sec * 1000000LL + now.tv_usec);
+
+    timeSync_stats_t stats;
+    timeSync_stats(&stats);
+    ESP_LOGI(TAG, "synced, offset %lld usec, drift %.2f ppm", (long long)stats.offsetUs, stats.driftPpm);
+}
+
+// called once Wi-Fi is connected, again on each reconnect
+
+void
+timeSync_start(void)
+{
+    if (sntp_enabled()) {
+        return;
+    }
+    ESP_LOGI(TAG, "using %s", CONFIG_BLESCAN_SNTP_SERVER);
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, CONFIG_BLESCAN_SNTP_SERVER);
+    sntp_set_time_sync_notification_cb(_onSync);
+    sntp_init();
+}
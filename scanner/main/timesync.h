@@ -0,0 +1,21 @@
+#pragma once
+
+/*
+ * Wall-clock time for scan results.  The GAP callback stamps each advertisement with
+ * esp_timer_get_time(); that is converted to Unix time using the offset and drift
+ * measured at each SNTP sync.
+ */
+
+typedef struct timeSync_stats_t {
+    bool    synced;
+    uint    syncs;
+    int64_t lastSync;  // esp_timer_get_time() at the last sync [usec]
+    int64_t offsetUs;  // how far off the estimate was at the last sync [usec]
+    float   driftPpm;  // rate of the local clock relative to the server [ppm]
+} timeSync_stats_t;
+
+void timeSync_start(void);
+void timeSync_update(int64_t const local, int64_t const wall);
+bool timeSync_toWall(int64_t const local, int64_t * const wall);
+bool timeSync_toLocal(int64_t const wall, int64_t * const local);
+void timeSync_stats(timeSync_stats_t * const stats);
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Decodes binary BLEscan scan payloads (see blescan_wire.h) on the host.
+ * Does not depend on the platform's endianness or alignment.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blescan_wire.h"
+
+typedef enum blescan_decode_err_t {
+    BLESCAN_DECODE_ERR_TRUNCATED = -1,  // payload shorter than its header claims
+    BLESCAN_DECODE_ERR_VERSION = -2,    // unsupported wire version
+    BLESCAN_DECODE_ERR_COMPRESSED = -3, // records are compressed, blescan_decode_inflate() the payload first
+    BLESCAN_DECODE_ERR_CORRUPT = -4,    // compressed records don't decompress to `count` records
+} blescan_decode_err_t;
+
+typedef struct blescan_rec_t {
+    uint8_t  bda[6];
+    int8_t   rssi;   // [dBm]
+    int8_t   txPwr;  // [dBm]
+    uint16_t major;
+    uint16_t minor;
+    int64_t  time;   // baseTime + timeDelta, Unix time unless flagged otherwise [usec]
+    uint8_t  flags;  // BLESCAN_WIRE_FLAG_* from the payload header
+} blescan_rec_t;
+
+// returns the number of records in `buf`, or a negative blescan_decode_err_t; for a compressed payload,
+// only its header is checked
+int blescan_decode_count(uint8_t const * const buf, size_t const buf_len);
+
+// decodes up to `recs_len` records into `recs`; returns the number decoded, or a negative blescan_decode_err_t
+int blescan_decode(uint8_t const * const buf, size_t const buf_len, blescan_rec_t * const recs, size_t const recs_len);
+
+// copies the payload in `buf` to `out`, decompressing its records when BLESCAN_WIRE_FLAG_LZ4 is set;
+// returns the length of the uncompressed payload, or a negative blescan_decode_err_t
+int blescan_decode_inflate(uint8_t const * const buf, size_t const buf_len, uint8_t * const out, size_t const out_len);
@@ -0,0 +1,28 @@
+#pragma once
+
+/*
+ * Compresses and decompresses blocks in the LZ4 block format, so that any LZ4 block decoder
+ * (given the uncompressed size) can read what the scanner publishes.  Shared between the
+ * scanner firmware and host-side decoders.
+ *
+ * The compressor is the greedy single-probe kind, with a hash table of 2^BLESCAN_LZ_HASH_LOG
+ * 16-bit positions that the caller provides, so it needs no heap and little stack.  That
+ * also limits a block to 64 KiB.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLESCAN_LZ_HASH_LOG (10)
+#define BLESCAN_LZ_MAX_INPUT (0xFFFF)
+#define BLESCAN_LZ_BOUND(len) ((len) + (len) / 255 + 16)  // worst case compressed size
+
+typedef struct blescan_lz_t {
+    uint16_t hash[1 << BLESCAN_LZ_HASH_LOG];  // position of the last 4-byte sequence with this hash
+} blescan_lz_t;
+
+// returns the compressed length, or 0 when `src` is too long or doesn't fit in `dst_len`
+size_t blescan_lz_compress(blescan_lz_t * const lz, uint8_t const * const src, size_t const src_len, uint8_t * const dst, size_t const dst_len);
+
+// returns the decompressed length, or -1 when `src` is malformed or doesn't fit in `dst_len`
+int blescan_lz_decompress(uint8_t const * const src, size_t const src_len, uint8_t * const dst, size_t const dst_len);
@@ -0,0 +1,39 @@
+#pragma once
+
+/*
+ * Binary wire format for BLEscan scan results, published on `blescan/data/scanbin/DEVNAME`.
+ * Shared between the scanner firmware and host-side decoders.
+ *
+ * A payload is a header followed by `count` fixed-width records.  All multi-byte fields are
+ * little-endian.  See README.md for the byte layout.  When flagged, the records are compressed
+ * as one LZ4 block that decompresses to `count` records.
+ */
+
+#include <stdint.h>
+
+#define BLESCAN_WIRE_VERSION (1)
+
+// header flags, baseTime is Unix time unless BLESCAN_WIRE_FLAG_UPTIME is set
+#define BLESCAN_WIRE_FLAG_REPLAY     (0x01)  // records were stored while disconnected, and are published late
+#define BLESCAN_WIRE_FLAG_PRIOR_BOOT (0x02)  // .. by an earlier boot, so baseTime is relative to that boot
+#define BLESCAN_WIRE_FLAG_UPTIME     (0x04)  // baseTime is time since boot, the clock wasn't synced yet
+#define BLESCAN_WIRE_FLAG_LZ4        (0x08)  // the records that follow the header are an LZ4 block, see blescan_lz.h
+
+typedef struct blescan_wire_hdr_t {
+    uint8_t  version;    // BLESCAN_WIRE_VERSION
+    uint8_t  flags;      // BLESCAN_WIRE_FLAG_*
+    uint16_t count;      // number of records that follow
+    int64_t  baseTime;   // time of the first record, Unix time or since boot [usec]
+} __attribute__((packed)) blescan_wire_hdr_t;
+
+typedef struct blescan_wire_rec_t {
+    uint8_t  bda[6];     // advertiser's BLE device address
+    int8_t   rssi;       // received signal strength [dBm]
+    int8_t   txPwr;      // iBeacon measured power at 1 m [dBm]
+    uint16_t major;      // iBeacon major
+    uint16_t minor;      // iBeacon minor
+    uint32_t timeDelta;  // [usec] relative to baseTime in the header
+} __attribute__((packed)) blescan_wire_rec_t;
+
+_Static_assert(sizeof(blescan_wire_hdr_t) == 12, "blescan_wire_hdr_t must be 12 bytes");
+_Static_assert(sizeof(blescan_wire_rec_t) == 16, "blescan_wire_rec_t must be 16 bytes");
@@ -0,0 +1,114 @@
+/**
+ * @brief decodes binary BLEscan scan payloads
+ *
+ * This file is part of BLEscan.
+ *
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with BLEscan.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+#include <string.h>
+
+#include "blescan_decode.h"
+#include "blescan_lz.h"
+
+static uint16_t
+_le16(uint8_t const * const p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+_le32(uint8_t const * const p)
+{
+    return (uint32_t)_le16(p) | ((uint32_t)_le16(p + 2) << 16);
+}
+
+static int64_t
+_le64(uint8_t const * const p)
+{
+    return (int64_t)((uint64_t)_le32(p) | ((uint64_t)_le32(p + 4) << 32));
+}
+
+int
+blescan_decode_count(uint8_t const * const buf, size_t const buf_len)
+{
+    if (buf_len < sizeof(blescan_wire_hdr_t)) {
+        return BLESCAN_DECODE_ERR_TRUNCATED;
+    }
+    if (buf[offsetof(blescan_wire_hdr_t, version)] != BLESCAN_WIRE_VERSION) {
+        return BLESCAN_DECODE_ERR_VERSION;
+    }
+    uint16_t const count = _le16(buf + offsetof(blescan_wire_hdr_t, count));
+    if (buf[offsetof(blescan_wire_hdr_t, flags)] & BLESCAN_WIRE_FLAG_LZ4) {
+        return count;
+    }
+    if (buf_len < sizeof(blescan_wire_hdr_t) + (size_t)count * sizeof(blescan_wire_rec_t)) {
+        return BLESCAN_DECODE_ERR_TRUNCATED;
+    }
+    return count;
+}
+
+int
+blescan_decode(uint8_t const * const buf, size_t const buf_len, blescan_rec_t * const recs, size_t const recs_len)
+{
+    int const count = blescan_decode_count(buf, buf_len);
+    if (count < 0) {
+        return count;
+    }
+    if (buf[offsetof(blescan_wire_hdr_t, flags)] & BLESCAN_WIRE_FLAG_LZ4) {
+        return BLESCAN_DECODE_ERR_COMPRESSED;
+    }
+    int64_t const baseTime = _le64(buf + offsetof(blescan_wire_hdr_t, baseTime));
+    uint8_t const flags = buf[offsetof(blescan_wire_hdr_t, flags)];
+    uint8_t const * p = buf + sizeof(blescan_wire_hdr_t);
+
+    size_t ii = 0;
+    for (; ii < (size_t)count && ii < recs_len; ii++, p += sizeof(blescan_wire_rec_t)) {
+        blescan_rec_t * const rec = recs + ii;
+        memcpy(rec->bda, p + offsetof(blescan_wire_rec_t, bda), sizeof(rec->bda));
+        rec->rssi = (int8_t)p[offsetof(blescan_wire_rec_t, rssi)];
+        rec->txPwr = (int8_t)p[offsetof(blescan_wire_rec_t, txPwr)];
+        rec->major = _le16(p + offsetof(blescan_wire_rec_t, major));
+        rec->minor = _le16(p + offsetof(blescan_wire_rec_t, minor));
+        rec->time = baseTime + _le32(p + offsetof(blescan_wire_rec_t, timeDelta));
+        rec->flags = flags;
+    }
+    return (int)ii;
+}
+
+int
+blescan_decode_inflate(uint8_t const * const buf, size_t const buf_len, uint8_t * const out, size_t const out_len)
+{
+    int const count = blescan_decode_count(buf, buf_len);
+    if (count < 0) {
+        return count;
+    }
+    size_t const len = sizeof(blescan_wire_hdr_t) + (size_t)count * sizeof(blescan_wire_rec_t);
+    if (out_len < len) {
+        return BLESCAN_DECODE_ERR_TRUNCATED;
+    }
+    uint8_t const flags = buf[offsetof(blescan_wire_hdr_t, flags)];
+    memcpy(out, buf, sizeof(blescan_wire_hdr_t));
+    out[offsetof(blescan_wire_hdr_t, flags)] = flags & ~BLESCAN_WIRE_FLAG_LZ4;
+
+    uint8_t const * const recs = buf + sizeof(blescan_wire_hdr_t);
+    size_t const recs_len = len - sizeof(blescan_wire_hdr_t);
+    if (!(flags & BLESCAN_WIRE_FLAG_LZ4)) {
+        memcpy(out + sizeof(blescan_wire_hdr_t), recs, recs_len);
+    } else if (blescan_lz_decompress(recs, buf_len - sizeof(blescan_wire_hdr_t), out + sizeof(blescan_wire_hdr_t), recs_len) != (int)recs_len) {
+        return BLESCAN_DECODE_ERR_CORRUPT;
+    }
+    return (int)len;
+}
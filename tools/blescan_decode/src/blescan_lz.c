@@ -0,0 +1,207 @@
+/**
+ * @brief LZ4 block format compressor and decompressor for binary scan payloads
+ *
+ * This file is part of BLEscan.
+ *
+ * BLEscan is free software: you can redistribute it and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * BLEscan is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with BLEscan.
+ * If not, see <https://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ * SPDX-FileCopyrightText: 2020-2022, Johan and Coert Vonk
+ */
+
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "blescan_lz.h"
+
+/*
+ * A block is a series of sequences.  Each starts with a token byte, whose high nibble is the
+ * number of literals and low nibble the match length minus MINMATCH, where 15 means that more
+ * length bytes follow.  Then come the literals, and a 2-byte little-endian offset back into the
+ * output.  The last sequence has literals only.
+ */
+
+#define MINMATCH     (4)
+#define LASTLITERALS (5)   // the block ends with at least this many literals
+#define MFLIMIT      (12)  // .. and the last match starts at least this far from the end
+#define MAX_OFFSET   (0xFFFF)
+#define ML_MASK      (0x0F)
+#define RUN_MASK     (0x0F)
+
+static uint32_t
+_read32(uint8_t const * const p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned
+_hash(uint32_t const seq)
+{
+    return (seq * 2654435761U) >> (32 - BLESCAN_LZ_HASH_LOG);
+}
+
+// writes the extra bytes of a length that didn't fit in its nibble
+
+static uint8_t *
+_writeLen(uint8_t * op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// writes a sequence, returns NULL when it doesn't fit
+
+static uint8_t *
+_writeSeq(uint8_t * op, uint8_t const * const oend, uint8_t const * const lit, size_t const litLen, unsigned const offset, size_t const matchLen)
+{
+    if ((size_t)(oend - op) < 1 + litLen / 255 + 1 + litLen + (matchLen ? 2 + matchLen / 255 + 1 : 0)) {
+        return NULL;
+    }
+    uint8_t * const token = op++;
+    *token = (uint8_t)((litLen < RUN_MASK ? litLen : RUN_MASK) << 4);
+    if (litLen >= RUN_MASK) {
+        op = _writeLen(op, litLen - RUN_MASK);
+    }
+    memcpy(op, lit, litLen);
+    op += litLen;
+    if (matchLen) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        size_t const ml = matchLen - MINMATCH;
+        *token |= (uint8_t)(ml < ML_MASK ? ml : ML_MASK);
+        if (ml >= ML_MASK) {
+            op = _writeLen(op, ml - ML_MASK);
+        }
+    }
+    return op;
+}
+
+size_t
+blescan_lz_compress(blescan_lz_t * const lz, uint8_t const * const src, size_t const src_len, uint8_t * const dst, size_t const dst_len)
+{
+    if (src_len > BLESCAN_LZ_MAX_INPUT) {
+        return 0;
+    }
+    uint8_t const * const iend = src + src_len;
+    uint8_t const * const oend = dst + dst_len;
+    uint8_t const * ip = src;
+    uint8_t const * anchor = src;  // start of the literals not yet written
+    uint8_t * op = dst;
+
+    memset(lz->hash, 0, sizeof(lz->hash));
+    if (src_len >= MFLIMIT + 1) {
+        uint8_t const * const mflimit = iend - MFLIMIT;
+        uint8_t const * const matchlimit = iend - LASTLITERALS;
+
+        while (ip <= mflimit) {
+            uint32_t const seq = _read32(ip);
+            unsigned const h = _hash(seq);
+            uint8_t const * ref = src + lz->hash[h];
+            lz->hash[h] = (uint16_t)(ip - src);
+
+            if (ref >= ip || ip - ref > MAX_OFFSET || _read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {  // extend backwards
+                ip--;
+                ref--;
+            }
+            size_t len = MINMATCH;
+            while (ip + len < matchlimit && ip[len] == ref[len]) {
+                len++;
+            }
+            op = _writeSeq(op, oend, anchor, ip - anchor, ip - ref, len);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+            if (ip <= mflimit) {  // so the next sequence can refer to the end of this match
+                lz->hash[_hash(_read32(ip - 2))] = (uint16_t)(ip - 2 - src);
+            }
+        }
+    }
+    op = _writeSeq(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? (size_t)(op - dst) : 0;
+}
+
+// reads the extra bytes of a length whose nibble was 15, returns false when `src` ends first
+
+static bool
+_readLen(uint8_t const ** const ip, uint8_t const * const iend, size_t * const len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int
+blescan_lz_decompress(uint8_t const * const src, size_t const src_len, uint8_t * const dst, size_t const dst_len)
+{
+    uint8_t const * ip = src;
+    uint8_t const * const iend = src + src_len;
+    uint8_t * op = dst;
+    uint8_t * const oend = dst + dst_len;
+
+    while (ip < iend) {
+        uint8_t const token = *ip++;
+
+        size_t litLen = token >> 4;
+        if (litLen == RUN_MASK && !_readLen(&ip, iend, &litLen)) {
+            return -1;
+        }
+        if (litLen > (size_t)(iend - ip) || litLen > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, litLen);
+        op += litLen;
+        ip += litLen;
+        if (ip == iend) {  // the last sequence has no match
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t const offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t matchLen = token & ML_MASK;
+        if (matchLen == ML_MASK && !_readLen(&ip, iend, &matchLen)) {
+            return -1;
+        }
+        matchLen += MINMATCH;
+        if (matchLen > (size_t)(oend - op)) {
+            return -1;
+        }
+        uint8_t const * ref = op - offset;
+        for (size_t ii = 0; ii < matchLen; ii++) {  // byte by byte, as the match may overlap
+            *op++ = *ref++;
+        }
+    }
+    return (int)(op - dst);
+}
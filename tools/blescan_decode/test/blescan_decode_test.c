@@ -0,0 +1,133 @@
+/**
+ * @brief tests the binary scan payload decoder against hand-assembled payloads
+ **/
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "blescan_decode.h"
+#include "blescan_lz.h"
+
+static uint8_t const _payload[] = {
+    BLESCAN_WIRE_VERSION, 0x00, 0x02, 0x00,          // version, flags, count = 2
+    0x40, 0x42, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x00,  // baseTime = 1000000 usec
+    0xAC, 0x67, 0xB2, 0x53, 0x82, 0x8A,              // bda
+    0xD8, 0xC5,                                      // rssi = -40, txPwr = -59
+    0xB7, 0x27, 0x06, 0xF2,                          // major = 10167, minor = 61958
+    0x00, 0x00, 0x00, 0x00,                          // timeDelta = 0
+    0x30, 0xAE, 0xA4, 0xCC, 0x32, 0x4E,
+    0xDB, 0xC5,                                      // rssi = -37
+    0x01, 0x00, 0x02, 0x00,                          // major = 1, minor = 2
+    0xE8, 0x03, 0x00, 0x00,                          // timeDelta = 1000 usec
+};
+
+// round trips `len` bytes through the LZ4 compressor, returns the compressed length
+
+static size_t
+_roundTrip(uint8_t const * const src, size_t const len)
+{
+    static blescan_lz_t lz;
+    static uint8_t packed[BLESCAN_LZ_BOUND(4096)];
+    static uint8_t unpacked[4096];
+
+    size_t const packed_len = blescan_lz_compress(&lz, src, len, packed, sizeof(packed));
+    assert(packed_len > 0 && packed_len <= BLESCAN_LZ_BOUND(len));
+    assert(blescan_lz_decompress(packed, packed_len, unpacked, sizeof(unpacked)) == (int)len);
+    assert(memcmp(src, unpacked, len) == 0);
+    return packed_len;
+}
+
+static void
+_testLz(void)
+{
+    uint8_t buf[4096];
+
+    // literals only, too short for a match, and incompressible
+    assert(_roundTrip((uint8_t const *)"", 0) == 1);
+    assert(_roundTrip(_payload, 12) == 13);
+    uint32_t x = 1;
+    for (size_t ii = 0; ii < sizeof(buf); ii++) {
+        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+        buf[ii] = (uint8_t)x;
+    }
+    assert(_roundTrip(buf, sizeof(buf)) <= BLESCAN_LZ_BOUND(sizeof(buf)));
+
+    // overlapping match, and lengths that need extra bytes
+    memset(buf, 'a', sizeof(buf));
+    assert(_roundTrip(buf, sizeof(buf)) < 32);
+
+    // the same two records over and over, as a batch from few beacons looks
+    for (size_t ii = 0; ii + 32 <= sizeof(buf); ii += 32) {
+        memcpy(buf + ii, _payload + sizeof(blescan_wire_hdr_t), 32);
+        buf[ii + 28] = (uint8_t)ii;  // timeDelta differs
+    }
+    assert(_roundTrip(buf, sizeof(buf)) < sizeof(buf) / 2);
+
+    // block produced by the reference lz4 for "abcabcabcabcabcabcabcabc"
+    uint8_t const ref[] = { 0x3C, 'a', 'b', 'c', 0x03, 0x00, 0x50, 'b', 'c', 'a', 'b', 'c' };
+    assert(blescan_lz_decompress(ref, sizeof(ref), buf, sizeof(buf)) == 24);
+    assert(memcmp(buf, "abcabcabcabcabcabcabcabc", 24) == 0);
+
+    // malformed blocks
+    uint8_t const badOffset[] = { 0x10, 'a', 0x02, 0x00, 0x00 };  // refers before the start
+    assert(blescan_lz_decompress(badOffset, sizeof(badOffset), buf, sizeof(buf)) == -1);
+    uint8_t const badLen[] = { 0xF0, 0xFF };  // literal length runs past the end
+    assert(blescan_lz_decompress(badLen, sizeof(badLen), buf, sizeof(buf)) == -1);
+    uint8_t const tooLong[] = { 0x40, 'a', 'b', 'c', 'd' };
+    assert(blescan_lz_decompress(tooLong, sizeof(tooLong), buf, 3) == -1);  // doesn't fit
+}
+
+int
+main(void)
+{
+    blescan_rec_t recs[4];
+
+    assert(blescan_decode_count(_payload, sizeof(_payload)) == 2);
+    assert(blescan_decode(_payload, sizeof(_payload), recs, 4) == 2);
+
+    uint8_t const bda0[6] = {0xAC, 0x67, 0xB2, 0x53, 0x82, 0x8A};
+    assert(memcmp(recs[0].bda, bda0, 6) == 0);
+    assert(recs[0].rssi == -40 && recs[0].txPwr == -59);
+    assert(recs[0].major == 10167 && recs[0].minor == 61958);
+    assert(recs[0].time == 1000000);
+    assert(recs[1].rssi == -37 && recs[1].major == 1 && recs[1].minor == 2);
+    assert(recs[1].time == 1001000);
+    assert(recs[0].flags == 0);
+
+    // caller's array is smaller than the payload
+    assert(blescan_decode(_payload, sizeof(_payload), recs, 1) == 1);
+
+    // malformed payloads
+    assert(blescan_decode_count(_payload, sizeof(_payload) - 1) == BLESCAN_DECODE_ERR_TRUNCATED);
+    assert(blescan_decode_count(_payload, 4) == BLESCAN_DECODE_ERR_TRUNCATED);
+    uint8_t bad[sizeof(_payload)];
+    memcpy(bad, _payload, sizeof(bad));
+    bad[1] = BLESCAN_WIRE_FLAG_REPLAY;
+    assert(blescan_decode(bad, sizeof(bad), recs, 4) == 2 && recs[1].flags == BLESCAN_WIRE_FLAG_REPLAY);
+    bad[0] = BLESCAN_WIRE_VERSION + 1;
+    assert(blescan_decode(bad, sizeof(bad), recs, 4) == BLESCAN_DECODE_ERR_VERSION);
+
+    // compressed payload
+    uint8_t packed[sizeof(blescan_wire_hdr_t) + BLESCAN_LZ_BOUND(sizeof(_payload))];
+    blescan_lz_t lz;
+    memcpy(packed, _payload, sizeof(blescan_wire_hdr_t));
+    packed[1] = BLESCAN_WIRE_FLAG_LZ4 | BLESCAN_WIRE_FLAG_REPLAY;
+    size_t const packed_len = sizeof(blescan_wire_hdr_t) + blescan_lz_compress(&lz, _payload + sizeof(blescan_wire_hdr_t), sizeof(_payload) - sizeof(blescan_wire_hdr_t),
+                                                                               packed + sizeof(blescan_wire_hdr_t), sizeof(packed) - sizeof(blescan_wire_hdr_t));
+    assert(blescan_decode_count(packed, packed_len) == 2);
+    assert(blescan_decode(packed, packed_len, recs, 4) == BLESCAN_DECODE_ERR_COMPRESSED);
+    uint8_t inflated[sizeof(_payload)];
+    assert(blescan_decode_inflate(packed, packed_len, inflated, sizeof(inflated)) == sizeof(_payload));
+    assert(inflated[1] == BLESCAN_WIRE_FLAG_REPLAY && memcmp(inflated + 2, _payload + 2, sizeof(_payload) - 2) == 0);
+    assert(blescan_decode_inflate(packed, packed_len, inflated, sizeof(inflated) - 1) == BLESCAN_DECODE_ERR_TRUNCATED);
+    assert(blescan_decode_inflate(packed, packed_len - 1, inflated, sizeof(inflated)) == BLESCAN_DECODE_ERR_CORRUPT);
+    assert(blescan_decode_inflate(_payload, sizeof(_payload), inflated, sizeof(inflated)) == sizeof(_payload));
+    assert(memcmp(inflated, _payload, sizeof(_payload)) == 0);
+
+    _testLz();
+
+    printf("blescan_decode_test: OK\n");
+    return 0;
+}